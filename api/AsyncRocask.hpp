@@ -0,0 +1,92 @@
+#pragma once
+
+#include <asio.hpp>
+
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../database/Rocask.hpp"
+#include "../database/utils.hpp"
+
+// Rocask's callback API as asio async operations, so they take any
+// completion token: a callback, asio::use_future, or asio::use_awaitable
+// for co_await in a C++20 coroutine:
+//
+//     std::string value = co_await async_read<std::string, std::string>(db, key, asio::use_awaitable);
+//
+// The completion signature is void(std::exception_ptr, V). With
+// use_awaitable a non-null exception is rethrown at the co_await, the same
+// one the blocking call throws. The handler runs on its associated
+// executor, never on the thread that reaped the I/O.
+namespace rocask_async {
+    // the handler moves into a shared_ptr, Rocask's callbacks must be
+    // copyable and asio handlers usually aren't. The work guard keeps the
+    // executor's context running until the result is posted back
+    template<typename Handler, typename... Args>
+    auto completion(Handler&& handler) {
+        using Decayed = std::decay_t<Handler>;
+        auto executor = asio::get_associated_executor(handler);
+        auto shared = std::make_shared<Decayed>(std::forward<Handler>(handler));
+        auto work = std::make_shared<asio::executor_work_guard<decltype(executor)>>(executor);
+        return [shared, work](Args... args) {
+            auto executor = work->get_executor();
+            asio::post(executor, [shared, work, args...]() mutable {
+                (*shared)(std::move(args)...);
+                work->reset();
+            });
+        };
+    }
+}
+
+template<typename K, typename V, typename CompletionToken>
+auto async_read(Rocask& db, const K& key, CompletionToken&& token) {
+    return asio::async_initiate<CompletionToken, void(std::exception_ptr, V)>(
+        [&db](auto handler, std::string key) {
+            auto done = rocask_async::completion<decltype(handler), std::exception_ptr, V>(std::move(handler));
+            db.read_async(key, [done](std::exception_ptr error, std::string raw) {
+                V value{};
+                if(error) {
+                    // nothing to convert
+                } else if constexpr(std::is_same_v<V, std::string>) {
+                    value = std::move(raw);
+                } else {
+                    try {
+                        value = deserialize<V>(raw);
+                    } catch(...) {
+                        error = std::current_exception();
+                    }
+                }
+                done(error, std::move(value));
+            });
+        },
+        token, serialize<K>(key)
+    );
+}
+
+template<typename K, typename V, typename CompletionToken>
+auto async_write(Rocask& db, const K& key, const V& value, CompletionToken&& token, uint64_t ttl_seconds = 0) {
+    return asio::async_initiate<CompletionToken, void(std::exception_ptr)>(
+        [&db](auto handler, std::string key, std::string value, uint64_t ttl_seconds) {
+            auto done = rocask_async::completion<decltype(handler), std::exception_ptr>(std::move(handler));
+            db.write_async(key, value, ttl_seconds, done);
+        },
+        token, serialize<K>(key), serialize<V>(value), ttl_seconds
+    );
+}
+
+template<typename CompletionToken>
+auto async_multi_read(Rocask& db, const std::vector<std::string>& keys, CompletionToken&& token) {
+    using Values = std::vector<std::optional<std::string>>;
+    return asio::async_initiate<CompletionToken, void(std::exception_ptr, Values)>(
+        [&db](auto handler, const std::vector<std::string>& keys) {
+            auto done = rocask_async::completion<decltype(handler), std::exception_ptr, Values>(std::move(handler));
+            db.multi_read_async(keys, done);
+        },
+        token, keys
+    );
+}
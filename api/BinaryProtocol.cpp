@@ -0,0 +1,155 @@
+#include "BinaryProtocol.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "../replication/ReplicationFollower.hpp"
+
+// reads fields off a request payload, throws std::invalid_argument when the
+// payload ends first
+class PayloadReader {
+    public:
+    explicit PayloadReader(std::string_view payload) : payload_(payload) {}
+
+    template<typename T>
+    T integer() {
+        T value;
+        std::memcpy(&value, take(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+
+    std::string_view string() {
+        uint32_t size = integer<uint32_t>();
+        return take(size);
+    }
+
+    std::string_view rest() {
+        return take(payload_.size() - offset_);
+    }
+
+    bool done() const { return offset_ == payload_.size(); }
+
+    private:
+    std::string_view take(uint64_t size) {
+        if(size > payload_.size() - offset_) {
+            throw std::invalid_argument("Request payload is truncated.");
+        }
+        std::string_view field = payload_.substr(offset_, size);
+        offset_ += size;
+        return field;
+    }
+
+    std::string_view payload_;
+    uint64_t offset_ = 0;
+};
+
+template<typename T>
+static void append_integer(std::string& output, T value) {
+    output.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// length | request_id | status, the length is patched in by finish_response
+static std::string response_header(uint32_t request_id, BinaryStatus status) {
+    std::string header;
+    append_integer<uint32_t>(header, 0);
+    append_integer<uint32_t>(header, request_id);
+    header.push_back(static_cast<char>(status));
+    return header;
+}
+
+static std::string finish_response(std::string response) {
+    uint32_t length = static_cast<uint32_t>(response.size() - sizeof(uint32_t));
+    std::memcpy(response.data(), &length, sizeof(length));
+    return response;
+}
+
+static std::string error_response(uint32_t request_id, BinaryStatus status, std::string_view message) {
+    std::string response = response_header(request_id, status);
+    response.append(message);
+    return finish_response(std::move(response));
+}
+
+static const char *STALE_MESSAGE = "This follower is too far behind its leader, read from the leader.";
+
+std::string handle_binary_request(Rocask& db, std::string_view frame, const ReplicationFollower *follower) {
+    uint32_t request_id;
+    std::memcpy(&request_id, frame.data(), sizeof(request_id));
+    BinaryOp op = static_cast<BinaryOp>(frame[sizeof(request_id)]);
+    PayloadReader payload(frame.substr(BINARY_REQUEST_HEADER_SIZE));
+
+    try {
+        switch(op) {
+            case BinaryOp::Ping: {
+                return finish_response(response_header(request_id, BinaryStatus::Ok));
+            }
+            case BinaryOp::Get: {
+                if(follower != nullptr && !follower->fresh()) {
+                    return error_response(request_id, BinaryStatus::Stale, STALE_MESSAGE);
+                }
+                std::string key(payload.string());
+                // the value is read straight in behind the header
+                std::string response;
+                db.read_framed(key, response_header(request_id, BinaryStatus::Ok), "", response);
+                return finish_response(std::move(response));
+            }
+            case BinaryOp::Put: {
+                std::string key(payload.string());
+                uint64_t ttl = payload.integer<uint64_t>();
+                std::string value(payload.rest());
+                db.write<std::string, std::string>(key, value, ttl);
+                return finish_response(response_header(request_id, BinaryStatus::Ok));
+            }
+            case BinaryOp::Delete: {
+                std::string key(payload.string());
+                BinaryStatus status = db.remove<std::string>(key) ? BinaryStatus::Ok : BinaryStatus::NotFound;
+                return finish_response(response_header(request_id, status));
+            }
+            case BinaryOp::MultiGet: {
+                if(follower != nullptr && !follower->fresh()) {
+                    return error_response(request_id, BinaryStatus::Stale, STALE_MESSAGE);
+                }
+                uint32_t count = payload.integer<uint32_t>();
+                std::vector<std::string> keys;
+                for(uint32_t i = 0; i < count; i++) {
+                    keys.emplace_back(payload.string());
+                }
+
+                std::vector<std::optional<std::string>> values = db.multi_read(keys);
+                std::string response = response_header(request_id, BinaryStatus::Ok);
+                append_integer<uint32_t>(response, count);
+                for(const auto& value : values) {
+                    response.push_back(value ? 1 : 0);
+                    if(value) {
+                        append_integer<uint32_t>(response, static_cast<uint32_t>(value->size()));
+                        response.append(*value);
+                    }
+                }
+                return finish_response(std::move(response));
+            }
+            case BinaryOp::Batch: {
+                uint32_t count = payload.integer<uint32_t>();
+                std::vector<std::pair<std::string, std::string>> items;
+                for(uint32_t i = 0; i < count; i++) {
+                    std::string key(payload.string());
+                    items.emplace_back(std::move(key), payload.string());
+                }
+                if(!payload.done()) {
+                    throw std::invalid_argument("Batch has trailing bytes.");
+                }
+                db.write_batch<std::string, std::string>(items);
+                return finish_response(response_header(request_id, BinaryStatus::Ok));
+            }
+        }
+    } catch(const std::out_of_range& _) {
+        return finish_response(response_header(request_id, BinaryStatus::NotFound));
+    } catch(const std::invalid_argument& e) {
+        return error_response(request_id, BinaryStatus::BadRequest, e.what());
+    } catch(const ReadOnlyError& e) {
+        return error_response(request_id, BinaryStatus::ReadOnly, e.what());
+    } catch(const std::exception& e) {
+        return error_response(request_id, BinaryStatus::Error, e.what());
+    }
+
+    return error_response(request_id, BinaryStatus::BadRequest, "Unknown op " + std::to_string(static_cast<int>(op)) + ".");
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "../database/Rocask.hpp"
+
+class ReplicationFollower;
+
+// Length prefixed binary protocol, served next to the HTTP api for clients
+// that don't want to pay for HTTP headers and JSON on every small request.
+// All integers are little endian, a string is a u32 length and its bytes.
+//
+// request:  u32 length | u32 request_id | u8 op | payload
+// response: u32 length | u32 request_id | u8 status | payload
+//
+// length counts everything after itself. Requests on one connection run
+// concurrently and their responses come back in completion order, clients
+// pipeline and match them up by request_id.
+//
+// Values are stored as given, the HTTP api expects the values it reads to
+// be JSON, so don't mix both on one key unless they are.
+
+enum class BinaryOp : uint8_t {
+    Ping = 0,       // -> Ok
+    Get = 1,        // key -> Ok value (rest of the frame) | NotFound
+    Put = 2,        // key | u64 ttl_seconds | value (rest of the frame) -> Ok
+    Delete = 3,     // key -> Ok | NotFound
+    MultiGet = 4,   // u32 count | key... -> Ok u32 count | (u8 found | [value])...
+    Batch = 5       // u32 count | (key | value)... -> Ok, all or nothing
+};
+
+enum class BinaryStatus : uint8_t {
+    Ok = 0,
+    NotFound = 1,
+    BadRequest = 2, // payload is the error message
+    Error = 3,      // same
+    Stale = 4,      // a follower too far behind its leader to read from, same
+    ReadOnly = 5    // a write to a follower, same
+};
+
+// request_id and op
+const uint32_t BINARY_REQUEST_HEADER_SIZE = 5;
+// anything larger is a broken client, the connection gets dropped
+const uint32_t MAX_BINARY_FRAME_SIZE = 64 * 1024 * 1024;
+
+// runs one request, frame is everything after the length prefix (at least
+// BINARY_REQUEST_HEADER_SIZE bytes). Returns the complete response frame.
+// On a follower, reads are answered Stale while it isn't fresh()
+std::string handle_binary_request(Rocask& db, std::string_view frame, const ReplicationFollower *follower = nullptr);
@@ -0,0 +1,228 @@
+#include "BinaryServer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "BinaryProtocol.hpp"
+
+// requests of one connection that may be running or waiting to be written,
+// past that it isn't read from until responses drain
+static const uint32_t MAX_IN_FLIGHT = 256;
+// socket reads go into a buffer of at least this much free space
+static const uint64_t READ_CHUNK = 64 * 1024;
+
+// Everything touching the socket and the counters below runs on the
+// connection's strand. Requests run on the whole pool, so a slow one
+// doesn't hold up the rest of the pipeline.
+class BinaryServer::Connection : public std::enable_shared_from_this<Connection> {
+    public:
+    Connection(asio::ip::tcp::socket socket, asio::io_context& io, Rocask& db, const ReplicationFollower *follower)
+        : socket_(std::move(socket)), io_(io), db_(db), follower_(follower) {}
+
+    void start() {
+        asio::error_code ec;
+        socket_.set_option(asio::ip::tcp::no_delay(true), ec);
+        read();
+    }
+
+    private:
+    void read() {
+        // move the partial frame (if any) to the front
+        if(in_start_ > 0) {
+            std::memmove(in_.data(), in_.data() + in_start_, in_end_ - in_start_);
+            in_end_ -= in_start_;
+            in_start_ = 0;
+        }
+        uint64_t size = std::max(in_end_ + READ_CHUNK, partial_size_);
+        if(in_.size() < size) {
+            in_.resize(size);
+        }
+
+        auto self = shared_from_this();
+        socket_.async_read_some(
+            asio::buffer(in_.data() + in_end_, in_.size() - in_end_),
+            [self](const asio::error_code& ec, size_t n) {
+                if(ec) {
+                    self->close();
+                    return;
+                }
+                self->in_end_ += n;
+                self->process_input();
+            }
+        );
+    }
+
+    // dispatches every complete frame in the buffer, then reads more
+    void process_input() {
+        while(in_end_ - in_start_ >= sizeof(uint32_t)) {
+            if(in_flight_ >= MAX_IN_FLIGHT) {
+                // write_done picks up from here
+                paused_ = true;
+                return;
+            }
+
+            uint32_t length;
+            std::memcpy(&length, in_.data() + in_start_, sizeof(length));
+            if(length < BINARY_REQUEST_HEADER_SIZE || length > MAX_BINARY_FRAME_SIZE) {
+                std::cerr << "Error: Dropping binary connection, bad frame length " << length << std::endl;
+                close();
+                return;
+            }
+
+            uint64_t frame_size = sizeof(uint32_t) + length;
+            if(in_end_ - in_start_ < frame_size) {
+                // read() makes room for the rest of it
+                partial_size_ = frame_size;
+                break;
+            }
+            partial_size_ = 0;
+
+            dispatch(std::string(in_.data() + in_start_ + sizeof(uint32_t), length));
+            in_start_ += frame_size;
+        }
+        read();
+    }
+
+    void dispatch(std::string frame) {
+        in_flight_++;
+        auto self = shared_from_this();
+        asio::post(io_, [self, frame = std::move(frame)]() {
+            std::string response = handle_binary_request(self->db_, frame, self->follower_);
+            asio::post(self->socket_.get_executor(), [self, response = std::move(response)]() mutable {
+                self->queue(std::move(response));
+            });
+        });
+    }
+
+    void queue(std::string response) {
+        if(closed_) {
+            return;
+        }
+        pending_.push_back(std::move(response));
+        if(!writing_) {
+            write();
+        }
+    }
+
+    // everything that piled up goes out in one gathered write
+    void write() {
+        writing_ = true;
+        std::swap(sending_, pending_);
+        pending_.clear();
+
+        std::vector<asio::const_buffer> buffers;
+        buffers.reserve(sending_.size());
+        for(const std::string& response : sending_) {
+            buffers.push_back(asio::buffer(response));
+        }
+
+        auto self = shared_from_this();
+        asio::async_write(socket_, buffers, [self](const asio::error_code& ec, size_t) {
+            self->write_done(ec);
+        });
+    }
+
+    void write_done(const asio::error_code& ec) {
+        in_flight_ -= static_cast<uint32_t>(sending_.size());
+        sending_.clear();
+        writing_ = false;
+        if(ec) {
+            close();
+            return;
+        }
+
+        if(!pending_.empty()) {
+            write();
+        }
+        if(paused_ && in_flight_ < MAX_IN_FLIGHT) {
+            paused_ = false;
+            process_input();
+        }
+    }
+
+    // requests still running finish, their responses are dropped
+    void close() {
+        if(closed_) {
+            return;
+        }
+        closed_ = true;
+        paused_ = false;
+        asio::error_code ec;
+        socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+        socket_.close(ec);
+    }
+
+    asio::ip::tcp::socket socket_;
+    asio::io_context& io_;
+    Rocask& db_;
+    const ReplicationFollower *follower_;
+
+    std::vector<char> in_;
+    uint64_t in_start_ = 0;
+    uint64_t in_end_ = 0;
+    // size of the frame at in_start_ when only part of it is in
+    uint64_t partial_size_ = 0;
+
+    uint32_t in_flight_ = 0;
+    bool paused_ = false;
+    bool closed_ = false;
+
+    bool writing_ = false;
+    std::deque<std::string> pending_;
+    std::deque<std::string> sending_;
+};
+
+BinaryServer::BinaryServer(Rocask& db, uint16_t port, const ReplicationFollower *follower, unsigned threads)
+    : db_(db), follower_(follower), port_(port), thread_count_(threads), acceptor_(io_) {
+    if(thread_count_ == 0) {
+        thread_count_ = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+BinaryServer::~BinaryServer() {
+    stop();
+}
+
+void BinaryServer::start() {
+    asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), port_);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    accept();
+
+    for(unsigned i = 0; i < thread_count_; i++) {
+        threads_.emplace_back([this]() {
+            io_.run();
+        });
+    }
+}
+
+void BinaryServer::stop() {
+    io_.stop();
+    for(std::thread& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+
+    // nothing runs any more, connections go with the io_context
+    asio::error_code ec;
+    acceptor_.close(ec);
+}
+
+void BinaryServer::accept() {
+    // each connection gets a strand of its own
+    acceptor_.async_accept(asio::make_strand(io_), [this](const asio::error_code& ec, asio::ip::tcp::socket socket) {
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+        if(!ec) {
+            std::make_shared<Connection>(std::move(socket), io_, db_, follower_)->start();
+        }
+        accept();
+    });
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <asio.hpp>
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "../database/Rocask.hpp"
+#include "../replication/ReplicationFollower.hpp"
+
+// TCP listener for the binary protocol (see BinaryProtocol.hpp). Runs its
+// own io_context on its own threads, next to whatever serves HTTP.
+class BinaryServer {
+    public:
+    // threads = 0 for one per core. follower is null on a leader, see
+    // handle_binary_request
+    BinaryServer(Rocask& db, uint16_t port, const ReplicationFollower *follower = nullptr, unsigned threads = 0);
+    ~BinaryServer();
+
+    BinaryServer(const BinaryServer&) = delete;
+    BinaryServer& operator=(const BinaryServer&) = delete;
+
+    // binds and returns, connections are served in the background
+    void start();
+    void stop();
+
+    private:
+    class Connection;
+
+    void accept();
+
+    Rocask& db_;
+    const ReplicationFollower *follower_;
+    uint16_t port_;
+    unsigned thread_count_;
+
+    asio::io_context io_;
+    asio::ip::tcp::acceptor acceptor_;
+    std::vector<std::thread> threads_;
+};
@@ -20,6 +20,13 @@ std::string fix_formatting(const std::string& in) {
     return res;
 }
 
+// a follower too far behind its leader sends readers to the leader
+static bool too_stale(const ReplicationFollower *follower) {
+    return follower != nullptr && !follower->fresh();
+}
+
+static const char *STALE_MESSAGE = "This follower is too far behind its leader, read from the leader.";
+
 // GET /ping 
 void handle_ping(
     crow::SimpleApp& app
@@ -59,8 +66,24 @@ void handle_insert(
         crow::json::wvalue raw_value = x["value"];
         std::string value = raw_value.dump();
 
+        // optional, seconds until the key expires
+        uint64_t ttl = 0;
+        if(x.has("ttl")) {
+            if(x["ttl"].t() != crow::json::type::Number || x["ttl"].i() < 0) {
+                return crow::response(400, "ttl must be a non-negative number of seconds.");
+            }
+            ttl = static_cast<uint64_t>(x["ttl"].i());
+        }
 
-        db.write<std::string, std::string>(key, value);
+        try {
+            db.write<std::string, std::string>(key, value, ttl);
+        } catch(const std::invalid_argument& e) {
+            return crow::response(400, e.what());
+        } catch(const ReadOnlyError& e) {
+            return crow::response(403, e.what());
+        } catch(...) {
+            return crow::response(500, "Server error. Try again.");
+        }
         
         // std::cout << fix_formatting(value) << std::endl;
         crow::json::wvalue res;
@@ -79,15 +102,85 @@ void handle_insert(
     });
 }
 
+// PUT /api/batch
+void handle_batch(
+    crow::SimpleApp& app,
+    Rocask& db
+) {
+    CROW_ROUTE(app, "/api/batch")
+    .methods(crow::HTTPMethod::PUT)
+    ([&db](const crow::request& req) {
+        auto x = crow::json::load(req.body);
+
+        if(!x) {
+            return crow::response(400, "Invalid JSON");
+        }
+
+        if(!x.has("items") || x["items"].t() != crow::json::type::List) {
+            return crow::response(400, "Missing items.");
+        }
+
+        std::vector<std::pair<std::string, std::string>> items;
+        for(const auto& item : x["items"]) {
+            if(item.t() != crow::json::type::Object || !item.has("key") || !item.has("value")) {
+                return crow::response(400, "Missing key or value.");
+            }
+            crow::json::wvalue raw_value = item["value"];
+            items.emplace_back(item["key"].s(), raw_value.dump());
+        }
+
+        try {
+            db.write_batch<std::string, std::string>(items);
+        } catch(const std::invalid_argument& e) {
+            return crow::response(400, e.what());
+        } catch(const ReadOnlyError& e) {
+            return crow::response(403, e.what());
+        } catch(...) {
+            return crow::response(500, "Server error. Try again.");
+        }
+
+        crow::json::wvalue res;
+        res["message"] = "Successfully wrote " + std::to_string(items.size()) + " objects.";
+
+        CROW_LOG_INFO << "BATCH count=" << items.size();
+
+        crow::response response(res);
+        response.code = 201;
+        response.set_header("Content-Type", "application/json");
+
+        return response;
+    });
+}
+
 // GET /api/get/<key:string>
+// with ?raw=1 the stored JSON goes into the payload as it is, never parsed
+// or re-serialized. Only for values written through the API, those are JSON
 void handle_get(
     crow::SimpleApp& app,
-    Rocask& db
+    Rocask& db,
+    const ReplicationFollower *follower
 ) {
     CROW_ROUTE(app, "/api/get/<string>")
     .methods(crow::HTTPMethod::GET)
-    ([&db](std::string key) {
-        
+    ([&db, follower](const crow::request& req, std::string key) {
+        if(too_stale(follower)) {
+            return crow::response(503, STALE_MESSAGE);
+        }
+
+        if(req.url_params.get("raw") != nullptr) {
+            crow::response response(200);
+            try {
+                db.read_framed(key, "{\"payload\":", "}", response.body);
+            } catch(const std::out_of_range& _) {
+                return crow::response(400, "Key not found.");
+            } catch(...) {
+                return crow::response(500, "Server error. Try again.");
+            }
+            response.set_header("Content-Type", "application/json");
+
+            return response;
+        }
+
         std::string raw_value;
 
         try {
@@ -105,4 +198,291 @@ void handle_get(
 
         return crow::response(200, res);
     });
-}
\ No newline at end of file
+}
+
+// DELETE /api/delete/<key:string>
+void handle_delete(
+    crow::SimpleApp& app,
+    Rocask& db
+) {
+    CROW_ROUTE(app, "/api/delete/<string>")
+    .methods(crow::HTTPMethod::DELETE)
+    ([&db](std::string key) {
+        bool removed;
+
+        try {
+            removed = db.remove<std::string>(key);
+        } catch(const ReadOnlyError& e) {
+            return crow::response(403, e.what());
+        } catch(...) {
+            return crow::response(500, "Server error. Try again.");
+        }
+
+        if(!removed) {
+            return crow::response(400, "Key not found.");
+        }
+
+        CROW_LOG_INFO << "DELETE key=" << key;
+
+        crow::json::wvalue res;
+        res["message"] = "Successfully deleted object at key: " + key;
+
+        return crow::response(200, res);
+    });
+}
+
+// POST /api/mget
+void handle_mget(
+    crow::SimpleApp& app,
+    Rocask& db,
+    const ReplicationFollower *follower
+) {
+    CROW_ROUTE(app, "/api/mget")
+    .methods(crow::HTTPMethod::POST)
+    ([&db, follower](const crow::request& req) {
+        if(too_stale(follower)) {
+            return crow::response(503, STALE_MESSAGE);
+        }
+
+        auto x = crow::json::load(req.body);
+
+        if(!x) {
+            return crow::response(400, "Invalid JSON");
+        }
+
+        if(!x.has("keys") || x["keys"].t() != crow::json::type::List) {
+            return crow::response(400, "Missing keys.");
+        }
+
+        std::vector<std::string> keys;
+        for(const auto& key : x["keys"]) {
+            if(key.t() != crow::json::type::String) {
+                return crow::response(400, "keys must be strings");
+            }
+            keys.push_back(key.s());
+        }
+
+        std::vector<std::optional<std::string>> raw_values;
+        try {
+            raw_values = db.multi_read(keys);
+        } catch(...) {
+            return crow::response(500, "Server error. Try again.");
+        }
+
+        crow::json::wvalue::object payload;
+        std::vector<crow::json::wvalue> missing;
+        for(size_t i = 0; i < keys.size(); i++) {
+            if(!raw_values[i].has_value()) {
+                missing.emplace_back(keys[i]);
+                continue;
+            }
+            payload[keys[i]] = crow::json::load(*raw_values[i]);
+        }
+
+        crow::json::wvalue res;
+        res["payload"] = std::move(payload);
+        res["missing"] = std::move(missing);
+
+        return crow::response(200, res);
+    });
+}
+
+// GET /api/scan?prefix=<prefix> or ?start=<key>&end=<key>, both optional,
+// plus limit (default 100) and cursor. A response with a cursor has more
+// after it, pass it back for the next page
+void handle_scan(
+    crow::SimpleApp& app,
+    Rocask& db,
+    const ReplicationFollower *follower
+) {
+    CROW_ROUTE(app, "/api/scan")
+    .methods(crow::HTTPMethod::GET)
+    ([&db, follower](const crow::request& req) {
+        if(too_stale(follower)) {
+            return crow::response(503, STALE_MESSAGE);
+        }
+
+        const char *prefix = req.url_params.get("prefix");
+        const char *start = req.url_params.get("start");
+        const char *end = req.url_params.get("end");
+        const char *cursor = req.url_params.get("cursor");
+        if(prefix != nullptr && (start != nullptr || end != nullptr)) {
+            return crow::response(400, "Give either prefix or start and end.");
+        }
+
+        size_t limit = 100;
+        if(req.url_params.get("limit") != nullptr) {
+            try {
+                limit = std::stoull(req.url_params.get("limit"));
+            } catch(...) {
+                return crow::response(400, "limit must be a number.");
+            }
+            if(limit == 0 || limit > MAX_SCAN_LIMIT) {
+                return crow::response(400, "limit must be between 1 and " + std::to_string(MAX_SCAN_LIMIT) + ".");
+            }
+        }
+
+        // the page starts right after the cursor, the smallest key past it
+        std::string from = start != nullptr ? start : "";
+        if(cursor != nullptr) {
+            from = std::max(from, std::string(cursor) + '\0');
+        }
+
+        ScanPage page;
+        try {
+            if(prefix != nullptr) {
+                page = db.prefix_scan(prefix, limit, from);
+            } else {
+                std::optional<std::string> until;
+                if(end != nullptr) {
+                    until = end;
+                }
+                page = db.scan(from, until, limit);
+            }
+        } catch(...) {
+            return crow::response(500, "Server error. Try again.");
+        }
+
+        std::vector<crow::json::wvalue> items;
+        for(const auto& [key, value] : page.items) {
+            crow::json::wvalue item;
+            item["key"] = key;
+            item["value"] = crow::json::load(value);
+            items.push_back(std::move(item));
+        }
+
+        crow::json::wvalue res;
+        res["items"] = std::move(items);
+        if(page.more) {
+            res["cursor"] = page.last_key;
+        }
+
+        return crow::response(200, res);
+    });
+}
+
+// GET /api/stats
+void handle_stats(
+    crow::SimpleApp& app,
+    Rocask& db
+) {
+    CROW_ROUTE(app, "/api/stats")
+    .methods(crow::HTTPMethod::GET)
+    ([&db]() {
+        RocaskStats stats = db.stats();
+
+        crow::json::wvalue res;
+        res["num_keys"] = stats.num_keys;
+        res["num_datafiles"] = stats.num_datafiles;
+        res["total_disk_used"] = stats.total_disk_used;
+        res["actual_data_size"] = stats.actual_data_size;
+        res["num_compactions"] = stats.num_compactions;
+        res["recovery_ms"] = stats.recovery_ms;
+        res["recovery_peak_keys"] = stats.recovery_peak_keys;
+        res["keydir_memory"] = stats.keydir_memory;
+        res["keydir_bytes_per_key"] = stats.keydir_bytes_per_key;
+        res["key_index_memory"] = stats.key_index_memory;
+        res["keydir_disk_bytes"] = stats.keydir_disk_bytes;
+        res["cache_hits"] = stats.cache_hits;
+        res["cache_misses"] = stats.cache_misses;
+        res["cache_evictions"] = stats.cache_evictions;
+        res["cache_bytes"] = stats.cache_bytes;
+        res["compaction_throttled_ms"] = stats.compaction_throttled_ms;
+        res["compression_input_bytes"] = stats.compression_input_bytes;
+        res["compression_output_bytes"] = stats.compression_output_bytes;
+        res["compression_ratio"] = stats.compression_ratio;
+        res["io_uring"] = stats.io_uring;
+
+        return crow::response(200, res);
+    });
+}
+// PUT /api/compaction/rate
+void handle_compaction_rate(
+    crow::SimpleApp& app,
+    Rocask& db
+) {
+    CROW_ROUTE(app, "/api/compaction/rate")
+    .methods(crow::HTTPMethod::PUT)
+    ([&db](const crow::request& req) {
+        auto x = crow::json::load(req.body);
+
+        if(!x) {
+            return crow::response(400, "Invalid JSON");
+        }
+
+        // 0 lifts the limit
+        if(!x.has("bytes_per_sec") || x["bytes_per_sec"].t() != crow::json::type::Number || x["bytes_per_sec"].i() < 0) {
+            return crow::response(400, "bytes_per_sec must be a non-negative number.");
+        }
+        uint64_t bytes_per_sec = static_cast<uint64_t>(x["bytes_per_sec"].i());
+
+        db.set_compaction_rate_limit(bytes_per_sec);
+
+        CROW_LOG_INFO << "COMPACTION rate=" << bytes_per_sec;
+
+        crow::json::wvalue res;
+        res["message"] = "Compaction rate limit set to " + std::to_string(bytes_per_sec) + " bytes/sec";
+
+        return crow::response(200, res);
+    });
+}
+
+// GET /api/replication
+// a leader lists its followers and how far behind each is, a follower its
+// leader and how stale it is
+void handle_replication(
+    crow::SimpleApp& app,
+    Rocask& db,
+    ReplicationLeader *leader,
+    const ReplicationFollower *follower
+) {
+    CROW_ROUTE(app, "/api/replication")
+    .methods(crow::HTTPMethod::GET)
+    ([&db, leader, follower]() {
+        crow::json::wvalue res;
+
+        if(follower != nullptr) {
+            res["role"] = "follower";
+            res["leader"] = follower->leader_host() + ":" + std::to_string(follower->leader_port());
+            res["connected"] = follower->connected();
+            std::optional<LogPosition> applied = follower->applied();
+            if(applied.has_value()) {
+                res["applied"]["file_id"] = applied->file_id;
+                res["applied"]["offset"] = applied->offset;
+            }
+            // left out until it first caught up
+            uint64_t staleness_ms = follower->staleness_ms();
+            if(staleness_ms != UINT64_MAX) {
+                res["staleness_ms"] = staleness_ms;
+            }
+            res["max_staleness_ms"] = follower->max_staleness_ms();
+            res["serving_reads"] = follower->fresh();
+            return crow::response(200, res);
+        }
+
+        res["role"] = "leader";
+        LogPosition log_end = db.log_end();
+        res["log_end"]["file_id"] = log_end.file_id;
+        res["log_end"]["offset"] = log_end.offset;
+
+        std::vector<crow::json::wvalue> followers;
+        if(leader != nullptr) {
+            for(const ReplicationLeader::FollowerStatus& status : leader->followers()) {
+                crow::json::wvalue entry;
+                entry["address"] = status.address;
+                entry["streaming"] = status.streaming;
+                entry["acked"]["file_id"] = status.acked.file_id;
+                entry["acked"]["offset"] = status.acked.offset;
+                // left out while it gets a snapshot
+                if(status.lag_bytes != UINT64_MAX) {
+                    entry["lag_bytes"] = status.lag_bytes;
+                }
+                entry["last_ack_ms"] = status.last_ack_ms;
+                followers.push_back(std::move(entry));
+            }
+        }
+        res["followers"] = std::move(followers);
+
+        return crow::response(200, res);
+    });
+}
@@ -1,10 +1,24 @@
 #pragma once 
 #include "crow.h"
 #include "../database/Rocask.hpp"
+#include "../replication/ReplicationFollower.hpp"
+#include "../replication/ReplicationLeader.hpp"
 
 #include <string>
 
+// most keys a page of /api/scan may ask for
+const size_t MAX_SCAN_LIMIT = 10000;
+
 void handle_ping(crow::SimpleApp& app);
 
 void handle_insert(crow::SimpleApp& app, Rocask& db);
-void handle_get(crow::SimpleApp& app, Rocask& db);
\ No newline at end of file
+void handle_batch(crow::SimpleApp& app, Rocask& db);
+// on a follower, reads get a 503 while it's further behind than it may be
+void handle_get(crow::SimpleApp& app, Rocask& db, const ReplicationFollower *follower = nullptr);
+void handle_mget(crow::SimpleApp& app, Rocask& db, const ReplicationFollower *follower = nullptr);
+void handle_scan(crow::SimpleApp& app, Rocask& db, const ReplicationFollower *follower = nullptr);
+void handle_delete(crow::SimpleApp& app, Rocask& db);
+void handle_stats(crow::SimpleApp& app, Rocask& db);
+void handle_compaction_rate(crow::SimpleApp& app, Rocask& db);
+// one of leader and follower is null, depending on what this node is
+void handle_replication(crow::SimpleApp& app, Rocask& db, ReplicationLeader *leader, const ReplicationFollower *follower);
@@ -0,0 +1,176 @@
+#include "BlockIO.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.hpp"
+
+// cleared the first time the kernel or filesystem says no, for good
+static std::atomic<bool> copy_file_range_supported{true};
+
+BlockReader::BlockReader(const std::string& path, uint64_t block_size, RateLimiter* limiter)
+    : path_(path), block_size_(block_size), limiter_(limiter) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        throw std::runtime_error("Could not open datafile " + path + ": " + std::strerror(errno));
+    }
+    file_ = std::make_shared<FileHandle>(fd);
+
+    struct stat st;
+    if(::fstat(fd, &st) != 0) {
+        throw std::runtime_error("Could not stat datafile " + path + ": " + std::strerror(errno));
+    }
+    size_ = static_cast<uint64_t>(st.st_size);
+
+    // sequential from start to end, let the kernel read ahead
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+bool BlockReader::fill(uint64_t offset, uint64_t size) {
+    if(offset + size > size_) {
+        return false;
+    }
+    if(contains(offset, size)) {
+        return true;
+    }
+
+    // the window only grows past block_size for a single larger record
+    uint64_t length = std::min(std::max(block_size_, size), size_ - offset);
+    if(limiter_) {
+        limiter_->acquire(length);
+    }
+    if(!read_at_offset(file_->fd(), offset, length, window_)) {
+        throw std::runtime_error("Read from datafile " + path_ + " failed");
+    }
+    start_ = offset;
+    return true;
+}
+
+BlockWriter::BlockWriter(uint64_t block_size, RateLimiter* limiter)
+    : block_size_(block_size), limiter_(limiter) {
+    buffer_.reserve(block_size);
+}
+
+void BlockWriter::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        throw std::runtime_error("Could not create datafile " + path + ": " + std::strerror(errno));
+    }
+    file_ = std::make_shared<FileHandle>(fd);
+    path_ = path;
+    flushed_ = 0;
+}
+
+void BlockWriter::close() {
+    if(file_) {
+        flush();
+        file_.reset();
+    }
+}
+
+void BlockWriter::append(const char *data, uint64_t size) {
+    if(buffer_.size() + size > block_size_) {
+        flush();
+    }
+    // nothing gained by copying a block or more through the buffer
+    if(size >= block_size_) {
+        write_out(data, size);
+        return;
+    }
+    buffer_.append(data, size);
+}
+
+void BlockWriter::copy(const BlockReader& reader, uint64_t offset, uint64_t size) {
+    if(size < block_size_ && reader.contains(offset, size)) {
+        append(reader.data(offset), size);
+        return;
+    }
+    flush();
+    copy_range(reader.fd(), offset, size);
+}
+
+void BlockWriter::flush() {
+    if(buffer_.empty()) {
+        return;
+    }
+    write_out(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+void BlockWriter::sync() {
+    flush();
+    if(::fdatasync(file_->fd()) != 0) {
+        throw std::runtime_error("fdatasync on datafile " + path_ + " failed: " + std::strerror(errno));
+    }
+}
+
+void BlockWriter::write_out(const char *data, uint64_t size) {
+    if(limiter_) {
+        limiter_->acquire(size);
+    }
+
+    uint64_t done = 0;
+    while(done < size) {
+        ssize_t n = ::write(file_->fd(), data + done, size - done);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0) {
+            throw std::runtime_error("Write to datafile " + path_ + " failed: " + std::strerror(errno));
+        }
+        done += static_cast<uint64_t>(n);
+    }
+    flushed_ += size;
+}
+
+// the caller flushed, so the file offset is flushed_
+void BlockWriter::copy_range(int in_fd, uint64_t in_offset, uint64_t size) {
+    uint64_t done = 0;
+    while(done < size && copy_file_range_supported.load(std::memory_order_relaxed)) {
+        uint64_t chunk = std::min(size - done, block_size_);
+        if(limiter_) {
+            // read and written
+            limiter_->acquire(2 * chunk);
+        }
+
+        loff_t from = static_cast<loff_t>(in_offset + done);
+        ssize_t n = ::copy_file_range(in_fd, &from, file_->fd(), nullptr, chunk, 0);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+            copy_file_range_supported = false;
+            break;
+        }
+        if(n < 0) {
+            throw std::runtime_error("Copy into datafile " + path_ + " failed: " + std::strerror(errno));
+        }
+        if(n == 0) {
+            throw std::runtime_error("Copy into datafile " + path_ + " ran past the end of its input");
+        }
+        done += static_cast<uint64_t>(n);
+        flushed_ += static_cast<uint64_t>(n);
+    }
+
+    // through user space, a block at a time
+    while(done < size) {
+        uint64_t chunk = std::min(size - done, block_size_);
+        if(limiter_) {
+            limiter_->acquire(chunk);
+        }
+        if(!read_at_offset(in_fd, in_offset + done, chunk, buffer_)) {
+            throw std::runtime_error("Read for datafile " + path_ + " failed");
+        }
+        write_out(buffer_.data(), chunk);
+        buffer_.clear();
+        done += chunk;
+    }
+}
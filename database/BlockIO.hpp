@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "FileTable.hpp"
+#include "RateLimiter.hpp"
+
+// Sequential block I/O for compaction. Both sides charge what they move
+// against an optional RateLimiter. Not thread safe, one merge owns them.
+
+// Reads a file through one reusable window of at least block_size bytes.
+class BlockReader {
+    public:
+    BlockReader(const std::string& path, uint64_t block_size, RateLimiter* limiter = nullptr);
+
+    BlockReader(const BlockReader&) = delete;
+    BlockReader& operator=(const BlockReader&) = delete;
+
+    // makes [offset, offset + size) readable through data(offset), moving the
+    // window forward to offset if needed. false if it runs past the file end
+    bool fill(uint64_t offset, uint64_t size);
+
+    bool contains(uint64_t offset, uint64_t size) const {
+        return offset >= start_ && offset + size <= start_ + window_.size();
+    }
+    const char* data(uint64_t offset) const { return window_.data() + (offset - start_); }
+
+    int fd() const { return file_->fd(); }
+    uint64_t size() const { return size_; }
+
+    private:
+    std::shared_ptr<FileHandle> file_;
+    std::string path_;
+    uint64_t size_ = 0;
+    uint64_t block_size_;
+    RateLimiter* limiter_;
+
+    std::string window_;
+    uint64_t start_ = 0;
+};
+
+// Writes a new file through a block_size buffer, so small records turn into
+// block sized writes. Large ranges of another file are copied in the kernel
+// with copy_file_range, falling back to pread/write where it isn't supported.
+class BlockWriter {
+    public:
+    BlockWriter(uint64_t block_size, RateLimiter* limiter = nullptr);
+
+    BlockWriter(const BlockWriter&) = delete;
+    BlockWriter& operator=(const BlockWriter&) = delete;
+
+    // flushes and closes the current file (if any), then creates path
+    void open(const std::string& path);
+    void close();
+
+    void append(const char *data, uint64_t size);
+
+    // appends [offset, offset + size) of the reader's file, from its window
+    // when the bytes are still there
+    void copy(const BlockReader& reader, uint64_t offset, uint64_t size);
+
+    void flush();
+    // flush, then fdatasync the file
+    void sync();
+
+    // end of file once everything buffered is written
+    uint64_t offset() const { return flushed_ + buffer_.size(); }
+
+    private:
+    void write_out(const char *data, uint64_t size);
+    void copy_range(int in_fd, uint64_t in_offset, uint64_t size);
+
+    std::shared_ptr<FileHandle> file_;
+    std::string path_;
+    uint64_t flushed_ = 0;
+    uint64_t block_size_;
+    RateLimiter* limiter_;
+
+    std::string buffer_;
+};
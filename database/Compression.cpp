@@ -0,0 +1,297 @@
+#include "Compression.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef ROCASK_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// LZ4 block format: sequences of token | literal length | literals |
+// offset (2) | match length. The token holds both lengths in 4 bits each,
+// 15 means more length bytes follow. The last sequence is literals only,
+// and the last 5 bytes are always literals.
+static const uint64_t MIN_MATCH = 4;
+static const uint64_t LAST_LITERALS = 5;
+static const uint64_t MF_LIMIT = 12; // no match starts in the last 12 bytes
+static const uint64_t MAX_DISTANCE = 65535;
+
+// zlib's default, most of the ratio of 9 at a fraction of the time
+static const int DEFLATE_LEVEL = 6;
+
+// raw size prefix of every compressed value
+static const uint64_t PREFIX_SIZE = sizeof(uint32_t);
+
+static uint32_t read32(const char *ptr) {
+    uint32_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static uint32_t lz4_hash(uint32_t sequence, int hash_log) {
+    return (sequence * 2654435761u) >> (32 - hash_log);
+}
+
+static char* write_length(char *op, uint64_t length) {
+    while(length >= 255) {
+        *op++ = static_cast<char>(255);
+        length -= 255;
+    }
+    *op++ = static_cast<char>(length);
+    return op;
+}
+
+uint64_t lz4_compress_bound(uint64_t size) {
+    return size + size / 255 + 16;
+}
+
+uint64_t lz4_compress(const char *src, uint64_t size, char *dst) {
+    char *op = dst;
+    uint64_t anchor = 0;
+
+    if(size > MF_LIMIT) {
+        // small values don't need (or want to clear) the big table
+        int hash_log = size < 4096 ? 10 : 14;
+        thread_local uint32_t table[1 << 14];
+        std::memset(table, 0, sizeof(uint32_t) << hash_log);
+
+        const uint64_t match_limit = size - LAST_LITERALS;
+        const uint64_t ip_limit = size - MF_LIMIT;
+
+        uint64_t ip = 1;
+        // skip faster the longer nothing matches
+        uint64_t search = 1 << 6;
+        while(ip <= ip_limit) {
+            uint32_t sequence = read32(src + ip);
+            uint32_t hash = lz4_hash(sequence, hash_log);
+            uint64_t ref = table[hash];
+            table[hash] = static_cast<uint32_t>(ip);
+
+            if(ip - ref > MAX_DISTANCE || read32(src + ref) != sequence) {
+                ip += search++ >> 6;
+                continue;
+            }
+            search = 1 << 6;
+
+            // the match may start earlier than where it was found
+            while(ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            uint64_t match_length = MIN_MATCH;
+            while(ip + match_length < match_limit && src[ip + match_length] == src[ref + match_length]) {
+                match_length++;
+            }
+
+            uint64_t literal_length = ip - anchor;
+            char *token = op++;
+            uint8_t token_value;
+            if(literal_length >= 15) {
+                token_value = 15 << 4;
+                op = write_length(op, literal_length - 15);
+            } else {
+                token_value = static_cast<uint8_t>(literal_length << 4);
+            }
+            std::memcpy(op, src + anchor, literal_length);
+            op += literal_length;
+
+            uint64_t offset = ip - ref;
+            *op++ = static_cast<char>(offset & 0xff);
+            *op++ = static_cast<char>(offset >> 8);
+
+            uint64_t extra = match_length - MIN_MATCH;
+            if(extra >= 15) {
+                token_value |= 15;
+                op = write_length(op, extra - 15);
+            } else {
+                token_value |= static_cast<uint8_t>(extra);
+            }
+            *token = static_cast<char>(token_value);
+
+            ip += match_length;
+            anchor = ip;
+            if(ip <= ip_limit) {
+                table[lz4_hash(read32(src + ip - 2), hash_log)] = static_cast<uint32_t>(ip - 2);
+            }
+        }
+    }
+
+    uint64_t literal_length = size - anchor;
+    if(literal_length >= 15) {
+        *op++ = static_cast<char>(15 << 4);
+        op = write_length(op, literal_length - 15);
+    } else {
+        *op++ = static_cast<char>(literal_length << 4);
+    }
+    std::memcpy(op, src + anchor, literal_length);
+    op += literal_length;
+
+    return static_cast<uint64_t>(op - dst);
+}
+
+// lengths run on in 255s, false if the input ends first
+static bool read_length(const uint8_t*& ip, const uint8_t *end, uint64_t& length) {
+    uint8_t byte;
+    do {
+        if(ip >= end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+bool lz4_decompress(const char *input, uint64_t input_size, char *output, uint64_t size) {
+    const uint8_t *ip = reinterpret_cast<const uint8_t*>(input);
+    const uint8_t *end = ip + input_size;
+    uint64_t op = 0;
+
+    while(true) {
+        if(ip >= end) {
+            return false;
+        }
+        uint8_t token = *ip++;
+
+        uint64_t literal_length = token >> 4;
+        if(literal_length == 15 && !read_length(ip, end, literal_length)) {
+            return false;
+        }
+        if(literal_length > static_cast<uint64_t>(end - ip) || literal_length > size - op) {
+            return false;
+        }
+        std::memcpy(output + op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        // the last sequence has no match
+        if(ip == end) {
+            break;
+        }
+
+        if(end - ip < 2) {
+            return false;
+        }
+        uint64_t offset = ip[0] | (static_cast<uint64_t>(ip[1]) << 8);
+        ip += 2;
+        if(offset == 0 || offset > op) {
+            return false;
+        }
+
+        uint64_t match_length = token & 15;
+        if(match_length == 15 && !read_length(ip, end, match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if(match_length > size - op) {
+            return false;
+        }
+
+        // an offset shorter than the match repeats the bytes it just wrote
+        char *dst = output + op;
+        const char *ref = dst - offset;
+        if(offset >= match_length) {
+            std::memcpy(dst, ref, match_length);
+        } else {
+            for(uint64_t i = 0; i < match_length; i++) {
+                dst[i] = ref[i];
+            }
+        }
+        op += match_length;
+    }
+
+    return op == size;
+}
+
+bool codec_available(Codec codec) {
+    switch(codec) {
+        case Codec::None:
+        case Codec::Lz4:
+            return true;
+        case Codec::Deflate:
+#ifdef ROCASK_HAVE_ZLIB
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+const char* codec_name(Codec codec) {
+    switch(codec) {
+        case Codec::None: return "none";
+        case Codec::Lz4: return "lz4";
+        case Codec::Deflate: return "deflate";
+    }
+    return "unknown";
+}
+
+bool compress(Codec codec, std::string_view input, std::string& output) {
+    uint64_t size = input.size();
+    if(codec == Codec::None || !codec_available(codec) || size > UINT32_MAX) {
+        return false;
+    }
+
+    uint32_t raw_size = static_cast<uint32_t>(size);
+    uint64_t compressed_size = 0;
+    if(codec == Codec::Lz4) {
+        output.resize(PREFIX_SIZE + lz4_compress_bound(size));
+        compressed_size = lz4_compress(input.data(), size, output.data() + PREFIX_SIZE);
+    } else {
+#ifdef ROCASK_HAVE_ZLIB
+        uLongf dest_size = compressBound(static_cast<uLong>(size));
+        output.resize(PREFIX_SIZE + dest_size);
+        int status = compress2(
+            reinterpret_cast<Bytef*>(output.data() + PREFIX_SIZE), &dest_size,
+            reinterpret_cast<const Bytef*>(input.data()), static_cast<uLong>(size),
+            DEFLATE_LEVEL
+        );
+        if(status != Z_OK) {
+            return false;
+        }
+        compressed_size = dest_size;
+#endif
+    }
+
+    std::memcpy(output.data(), &raw_size, sizeof(raw_size));
+    output.resize(PREFIX_SIZE + compressed_size);
+    return output.size() < size;
+}
+
+void decompress(Codec codec, std::string_view input, std::string& output) {
+    if(!codec_available(codec) || codec == Codec::None) {
+        throw std::runtime_error(std::string("Value codec ") + codec_name(codec) + " is not available in this build.");
+    }
+    if(input.size() < PREFIX_SIZE) {
+        throw std::runtime_error("Compressed value is truncated.");
+    }
+
+    uint32_t raw_size;
+    std::memcpy(&raw_size, input.data(), sizeof(raw_size));
+    const char *payload = input.data() + PREFIX_SIZE;
+    uint64_t payload_size = input.size() - PREFIX_SIZE;
+
+    // neither codec expands by more than about 1000x, anything past that is
+    // a corrupt prefix and not worth allocating for
+    if(raw_size > payload_size * 1032 + 64) {
+        throw std::runtime_error("Compressed value has an impossible size.");
+    }
+    output.resize(raw_size);
+
+    bool ok = false;
+    if(codec == Codec::Lz4) {
+        ok = lz4_decompress(payload, payload_size, output.data(), raw_size);
+    } else {
+#ifdef ROCASK_HAVE_ZLIB
+        uLongf dest_size = raw_size;
+        ok = uncompress(
+            reinterpret_cast<Bytef*>(output.data()), &dest_size,
+            reinterpret_cast<const Bytef*>(payload), static_cast<uLong>(payload_size)
+        ) == Z_OK && dest_size == raw_size;
+#endif
+    }
+    if(!ok) {
+        throw std::runtime_error(std::string("Corrupt ") + codec_name(codec) + " value.");
+    }
+}
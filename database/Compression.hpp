@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Value codecs, the id is stored in every record header (see Record.hpp).
+// A compressed value is the raw size as a 4 byte little endian prefix
+// followed by the codec's output.
+enum class Codec : uint8_t {
+    None = 0,
+    Lz4 = 1,     // LZ4 block format, in-tree, fast on both ends
+    Deflate = 2  // zlib, denser and slower, only with ROCASK_HAVE_ZLIB
+};
+
+const Codec MAX_CODEC = Codec::Deflate;
+
+// whether this build can compress and decompress with codec
+bool codec_available(Codec codec);
+
+const char* codec_name(Codec codec);
+
+// compressed form of input into output, false (output unspecified) when the
+// codec can't make it smaller
+bool compress(Codec codec, std::string_view input, std::string& output);
+
+// throws std::runtime_error on corrupt input or a codec this build lacks
+void decompress(Codec codec, std::string_view input, std::string& output);
+
+// the raw kernels, exposed for tests
+uint64_t lz4_compress_bound(uint64_t size);
+uint64_t lz4_compress(const char *input, uint64_t size, char *output);
+// false unless input decodes to exactly size bytes
+bool lz4_decompress(const char *input, uint64_t input_size, char *output, uint64_t size);
@@ -0,0 +1,134 @@
+#include "DataFileWriter.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void DataFileWriter::open(uint64_t file_id, const std::string& path, CrcKind crc_kind) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        throw std::runtime_error("Could not open datafile " + path + ": " + std::strerror(errno));
+    }
+    auto file = std::make_shared<FileHandle>(fd);
+    if(ring_) {
+        file->register_with(ring_);
+    }
+
+    struct stat st;
+    if(::fstat(fd, &st) != 0) {
+        throw std::runtime_error("Could not stat datafile " + path + ": " + std::strerror(errno));
+    }
+
+    file_ = std::move(file);
+    file_id_ = file_id;
+    offset_ = static_cast<uint64_t>(st.st_size);
+    torn_ = false;
+    path_ = path;
+
+    if(offset_ == 0) {
+        char header[DATAFILE_HEADER_SIZE];
+        write_datafile_header(header, crc_kind);
+        append(header, sizeof(header));
+        crc_kind_ = crc_kind;
+        records_start_ = offset_;
+    } else {
+        // appending to an existing file, keep whatever it was written with
+        char header[DATAFILE_HEADER_SIZE];
+        ssize_t n = ::pread(fd, header, sizeof(header), 0);
+        DataFileHeader existing = read_datafile_header(header, n < 0 ? 0 : static_cast<uint64_t>(n));
+        if(existing.version != DATAFILE_VERSION) {
+            throw std::runtime_error("Datafile " + path + " has an older record layout, can't append to it");
+        }
+        crc_kind_ = existing.crc_kind;
+        records_start_ = existing.size;
+    }
+}
+
+void DataFileWriter::close() {
+    file_.reset();
+}
+
+uint64_t DataFileWriter::append(const char *data, uint64_t size) {
+    std::vector<struct iovec> iov{{const_cast<char*>(data), size}};
+    return append(iov);
+}
+
+uint64_t DataFileWriter::append(std::vector<struct iovec>& iov, bool sync) {
+    uint64_t start = offset_;
+    size_t first = 0;
+    bool synced = false;
+    bool ring_write = ring_ && iov.size() <= IOV_MAX;
+    while(first < iov.size()) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+        ssize_t n;
+        if(ring_write) {
+            // the first try only, whatever a short write left goes the plain way
+            ring_write = false;
+            int64_t result = ring_->append(*file_, iov.data(), static_cast<unsigned>(count), sync, synced);
+            n = result;
+            if(result < 0) {
+                errno = static_cast<int>(-result);
+                n = -1;
+            }
+        } else {
+            n = ::writev(file_->fd(), iov.data() + first, count);
+        }
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n < 0) {
+            std::string message = "Write to datafile " + path_ + " failed: " + std::strerror(errno);
+            rewind(start);
+            throw std::runtime_error(message);
+        }
+
+        // keep offsets honest for whatever made it to disk, then skip
+        // past fully written buffers and trim a partially written one
+        offset_ += static_cast<uint64_t>(n);
+        size_t written = static_cast<size_t>(n);
+        while(first < iov.size() && written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if(written > 0) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+            iov[first].iov_len -= written;
+        }
+    }
+
+    if(sync && !synced) {
+        try {
+            this->sync();
+        } catch(...) {
+            rewind(start);
+            throw;
+        }
+    }
+    return start;
+}
+
+// drops whatever an append left past offset
+void DataFileWriter::rewind(uint64_t offset) {
+    offset_ = offset;
+    if(::ftruncate(file_->fd(), static_cast<off_t>(offset)) != 0) {
+        std::cerr << "Error: " << "could not cut datafile " << path_ << " back to " << offset 
+                  << ": " << std::strerror(errno) << std::endl;
+        torn_ = true;
+    }
+}
+
+void DataFileWriter::sync() {
+    if(!file_) {
+        return;
+    }
+    int result = ring_ ? ring_->sync(*file_) : (::fdatasync(file_->fd()) == 0 ? 0 : -errno);
+    if(result != 0) {
+        throw std::runtime_error("fdatasync on datafile " + path_ + " failed: " + std::strerror(-result));
+    }
+}
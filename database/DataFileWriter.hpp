@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+#include "FileTable.hpp"
+#include "IoRing.hpp"
+#include "Record.hpp"
+
+// Append-only writer for the active datafile. Keeps the fd open and tracks
+// the end of file in memory, so a write costs one syscall and rollover
+// doesn't need a stat. Not thread safe, Rocask serializes access.
+class DataFileWriter {
+    public:
+    explicit DataFileWriter(uint64_t max_file_size) : max_file_size_(max_file_size) {}
+
+    DataFileWriter(const DataFileWriter&) = delete;
+    DataFileWriter& operator=(const DataFileWriter&) = delete;
+
+    // closes the current file (if any) and appends to path from its current
+    // size, a new file first gets a header for crc_kind. Records are always
+    // in the current layout, so an existing file must be DATAFILE_VERSION
+    void open(uint64_t file_id, const std::string& path, CrcKind crc_kind);
+    void close();
+
+    // appends and syncs go through ring from the next open on
+    void set_ring(std::shared_ptr<IoRing> ring) { ring_ = std::move(ring); }
+
+    // whether size more bytes fit after the queued ones. An empty file always
+    // takes the first record, so oversized values still land somewhere. A
+    // file a failed append couldn't be cut back on takes nothing more
+    bool fits(uint64_t size, uint64_t queued = 0) const {
+        if(torn_) {
+            return false;
+        }
+        uint64_t end = offset_ + queued;
+        return end == records_start_ || end + size <= max_file_size_;
+    }
+
+    // returns the offset the data was written at. With sync the data is
+    // fdatasync'ed too, through a ring that's one submission for both.
+    // A failed write or sync cuts the file back to where the append started,
+    // so a torn record never sits in front of later ones
+    uint64_t append(const char *data, uint64_t size);
+    uint64_t append(std::vector<struct iovec>& iov, bool sync = false);
+
+    // fdatasync the active file
+    void sync();
+
+    uint64_t file_id() const { return file_id_; }
+    CrcKind crc_kind() const { return crc_kind_; }
+    uint64_t offset() const { return offset_; }
+    const std::string& path() const { return path_; }
+
+    // lets a background syncer fdatasync without holding the writer lock
+    std::shared_ptr<FileHandle> handle() const { return file_; }
+
+    private:
+    uint64_t max_file_size_;
+
+    std::shared_ptr<FileHandle> file_;
+    uint64_t file_id_ = 0;
+    uint64_t offset_ = 0;
+    uint64_t records_start_ = 0;
+    bool torn_ = false; // has bytes past offset_ that couldn't be cut off
+    CrcKind crc_kind_ = CrcKind::Crc32;
+    std::string path_;
+
+    std::shared_ptr<IoRing> ring_;
+
+    void rewind(uint64_t offset);
+};
@@ -0,0 +1,256 @@
+#include "DiskKeyDir.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+DiskKeyDirTable::DiskKeyDirTable(std::string path, uint64_t buckets) : path_(std::move(path)) {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd_ < 0) {
+        throw std::runtime_error("Could not open keydir file " + path_ + ": " + std::strerror(errno));
+    }
+    try {
+        reset(buckets);
+    } catch(...) {
+        ::close(fd_);
+        ::unlink(path_.c_str());
+        throw;
+    }
+}
+
+DiskKeyDirTable::~DiskKeyDirTable() {
+    if(data_ != nullptr) {
+        ::munmap(data_, mapped_pages_ * PAGE_SIZE);
+    }
+    if(fd_ >= 0) {
+        ::close(fd_);
+        ::unlink(path_.c_str());
+    }
+}
+
+std::optional<KeyDirEntry> DiskKeyDirTable::find(const std::string& key, size_t hash) const {
+    if(key.size() > MAX_PAGE_KEY) {
+        auto it = oversize_.find(key);
+        if(it == oversize_.end()) {
+            return std::nullopt;
+        }
+        return it->second.unpack();
+    }
+
+    Location at = locate(key, hash);
+    if(!at.found()) {
+        return std::nullopt;
+    }
+    return read_entry(at);
+}
+
+bool DiskKeyDirTable::remove(const std::string& key, size_t hash) {
+    if(key.size() > MAX_PAGE_KEY) {
+        if(oversize_.erase(key) == 0) {
+            return false;
+        }
+        live_--;
+        return true;
+    }
+
+    Location at = locate(key, hash);
+    if(!at.found()) {
+        return false;
+    }
+    erase(at);
+    return true;
+}
+
+bool DiskKeyDirTable::remove_if(const std::string& key, const KeyDirEntry& expected, size_t hash) {
+    if(key.size() > MAX_PAGE_KEY) {
+        auto it = oversize_.find(key);
+        if(it == oversize_.end() || !(it->second.unpack() == expected)) {
+            return false;
+        }
+        oversize_.erase(it);
+        live_--;
+        return true;
+    }
+
+    Location at = locate(key, hash);
+    if(!at.found() || !(read_entry(at) == expected)) {
+        return false;
+    }
+    erase(at);
+    return true;
+}
+
+void DiskKeyDirTable::clear() {
+    oversize_.clear();
+    reset(4);
+}
+
+size_t DiskKeyDirTable::memory_usage() const {
+    size_t total = sizeof(*this) + oversize_.bucket_count() * sizeof(void*);
+    for(const auto& [key, packed] : oversize_) {
+        total += sizeof(std::pair<const std::string, PackedKeyDirEntry>) + 2 * sizeof(void*) + key.capacity();
+    }
+    return total;
+}
+
+// walks the bucket's chain, the tag skips almost every key compare
+DiskKeyDirTable::Location DiskKeyDirTable::locate(const std::string& key, size_t hash) const {
+    uint16_t tag = tag_of(hash);
+    uint64_t page = hash & (buckets_ - 1);
+    while(true) {
+        const char *base = page_data(page);
+        PageHeader header = page_header(page);
+        for(uint64_t pos = sizeof(PageHeader); pos < sizeof(PageHeader) + header.used; ) {
+            RecordHeader record;
+            std::memcpy(&record, base + pos, sizeof(record));
+            if(record.tag == tag && record.key_size == key.size() &&
+               std::memcmp(base + pos + sizeof(record), key.data(), key.size()) == 0) {
+                return Location{page, static_cast<uint32_t>(pos)};
+            }
+            pos += sizeof(record) + record.key_size;
+        }
+        if(header.next == 0) {
+            return Location{};
+        }
+        page = header.next;
+    }
+}
+
+KeyDirEntry DiskKeyDirTable::read_entry(const Location& at) const {
+    PackedKeyDirEntry packed;
+    std::memcpy(&packed, page_data(at.page) + at.offset, sizeof(packed));
+    return packed.unpack();
+}
+
+void DiskKeyDirTable::write_entry(const Location& at, const PackedKeyDirEntry& packed) {
+    std::memcpy(page_data(at.page) + at.offset, &packed, sizeof(packed));
+}
+
+// into the first page of the chain with room, a new overflow page if none has
+void DiskKeyDirTable::insert(const std::string& key, size_t hash, const PackedKeyDirEntry& packed) {
+    uint64_t record_size = sizeof(RecordHeader) + key.size();
+    // keep the buckets at most 7/8 full on average, like the memory table
+    if((record_bytes_ + record_size) * 8 > buckets_ * PAGE_CAPACITY * 7) {
+        grow();
+    }
+
+    uint64_t page = hash & (buckets_ - 1);
+    PageHeader header = page_header(page);
+    while(header.used + record_size > PAGE_CAPACITY) {
+        if(header.next == 0) {
+            uint64_t added = add_page();
+            header.next = static_cast<uint32_t>(added);
+            set_page_header(page, header);
+            page = added;
+            header = page_header(page);
+            break;
+        }
+        page = header.next;
+        header = page_header(page);
+    }
+
+    RecordHeader record{packed, tag_of(hash), static_cast<uint16_t>(key.size())};
+    char *dest = page_data(page) + sizeof(PageHeader) + header.used;
+    std::memcpy(dest, &record, sizeof(record));
+    std::memcpy(dest + sizeof(record), key.data(), key.size());
+    header.used += static_cast<uint32_t>(record_size);
+    set_page_header(page, header);
+
+    live_++;
+    record_bytes_ += record_size;
+}
+
+// closes the gap in its page, an emptied overflow page stays in the chain
+// for later inserts
+void DiskKeyDirTable::erase(const Location& at) {
+    char *base = page_data(at.page);
+    PageHeader header = page_header(at.page);
+    RecordHeader record;
+    std::memcpy(&record, base + at.offset, sizeof(record));
+
+    uint64_t record_size = sizeof(record) + record.key_size;
+    uint64_t end = sizeof(PageHeader) + header.used;
+    std::memmove(base + at.offset, base + at.offset + record_size, end - at.offset - record_size);
+    header.used -= static_cast<uint32_t>(record_size);
+    set_page_header(at.page, header);
+
+    live_--;
+    record_bytes_ -= record_size;
+}
+
+uint64_t DiskKeyDirTable::add_page() {
+    if(pages_ >= UINT32_MAX) {
+        throw std::length_error("KeyDir: keydir file " + path_ + " is out of page numbers.");
+    }
+    if(pages_ == mapped_pages_) {
+        map(mapped_pages_ * 2);
+    }
+    return pages_++;
+}
+
+void DiskKeyDirTable::reset(uint64_t buckets) {
+    if(data_ != nullptr) {
+        ::munmap(data_, mapped_pages_ * PAGE_SIZE);
+        data_ = nullptr;
+        mapped_pages_ = 0;
+    }
+    // truncating to nothing first zeroes every page, an all zero header is
+    // an empty page without overflow
+    if(::ftruncate(fd_, 0) != 0) {
+        throw std::runtime_error("Could not truncate keydir file " + path_ + ": " + std::strerror(errno));
+    }
+    map(buckets);
+    pages_ = buckets;
+    buckets_ = buckets;
+    live_ = oversize_.size();
+    record_bytes_ = 0;
+}
+
+// the file is sized to the mapping, the pages past pages_ are spare
+void DiskKeyDirTable::map(uint64_t pages) {
+    if(::ftruncate(fd_, pages * PAGE_SIZE) != 0) {
+        throw std::runtime_error("Could not grow keydir file " + path_ + ": " + std::strerror(errno));
+    }
+
+    void *addr;
+    if(data_ == nullptr) {
+        addr = ::mmap(nullptr, pages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    } else {
+        addr = ::mremap(data_, mapped_pages_ * PAGE_SIZE, pages * PAGE_SIZE, MREMAP_MAYMOVE);
+    }
+    if(addr == MAP_FAILED) {
+        throw std::runtime_error("Could not map keydir file " + path_ + ": " + std::strerror(errno));
+    }
+    data_ = static_cast<char*>(addr);
+    mapped_pages_ = pages;
+
+    // lookups touch one page here and there, readahead would only evict
+    // hot buckets
+    ::madvise(data_, mapped_pages_ * PAGE_SIZE, MADV_RANDOM);
+}
+
+void DiskKeyDirTable::grow() {
+    DiskKeyDirTable bigger(path_ + ".grow", buckets_ * 2);
+    std::hash<std::string> hasher;
+    std::string key;
+    for_each_record([&](const char *key_data, const RecordHeader& record) {
+        key.assign(key_data, record.key_size);
+        bigger.insert(key, hasher(key), record.entry);
+    });
+
+    if(std::rename(bigger.path_.c_str(), path_.c_str()) != 0) {
+        throw std::runtime_error("Could not replace keydir file " + path_ + ": " + std::strerror(errno));
+    }
+    // bigger leaves with the old file, its name is already gone
+    std::swap(fd_, bigger.fd_);
+    std::swap(data_, bigger.data_);
+    std::swap(mapped_pages_, bigger.mapped_pages_);
+    std::swap(pages_, bigger.pages_);
+    std::swap(buckets_, bigger.buckets_);
+    std::swap(record_bytes_, bigger.record_bytes_);
+}
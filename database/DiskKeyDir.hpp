@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "KeyDirEntry.hpp"
+
+// One keydir stripe in a memory-mapped file of 4 KiB pages, for more keys
+// than fit in memory. A key hashes to one of a power of two bucket pages, a
+// full bucket chains overflow pages appended to the file. The page cache
+// keeps the hot buckets in memory, a lookup in a cold one costs a page read.
+// Entries are updated in place. The file is scratch: rebuilt from the
+// datafiles on every open and removed on destruction.
+// Keys too long for a page are kept in memory.
+// The hash passed in must be std::hash<std::string>, growing recomputes it.
+class DiskKeyDirTable {
+    public:
+    static constexpr size_t PAGE_SIZE = 4096;
+
+    // creates the file, or empties the one already at path
+    explicit DiskKeyDirTable(std::string path, uint64_t buckets = 4);
+    ~DiskKeyDirTable();
+
+    DiskKeyDirTable(const DiskKeyDirTable&) = delete;
+    DiskKeyDirTable& operator=(const DiskKeyDirTable&) = delete;
+
+    std::optional<KeyDirEntry> find(const std::string& key, size_t hash) const;
+
+    std::optional<KeyDirEntry> put(const std::string& key, const KeyDirEntry& value, size_t hash) {
+        return put_if_impl(key, value, hash, [](const KeyDirEntry&) { return true; }).second;
+    }
+
+    template<typename Func>
+    bool put_if(const std::string& key, const KeyDirEntry& value, size_t hash, Func replace) {
+        return put_if_impl(key, value, hash, replace).first;
+    }
+
+    bool remove(const std::string& key, size_t hash);
+    bool remove_if(const std::string& key, const KeyDirEntry& expected, size_t hash);
+
+    template<typename Func>
+    bool update(const std::string& key, const KeyDirEntry& expected, size_t hash, Func updater) {
+        if(key.size() > MAX_PAGE_KEY) {
+            auto it = oversize_.find(key);
+            if(it == oversize_.end() || !(it->second.unpack() == expected)) {
+                return false;
+            }
+            KeyDirEntry entry = expected;
+            updater(entry);
+            it->second = PackedKeyDirEntry::pack(entry);
+            return true;
+        }
+
+        Location at = locate(key, hash);
+        if(!at.found()) {
+            return false;
+        }
+        KeyDirEntry entry = read_entry(at);
+        if(!(entry == expected)) {
+            return false;
+        }
+        updater(entry);
+        write_entry(at, PackedKeyDirEntry::pack(entry));
+        return true;
+    }
+
+    template<typename Func>
+    void for_each(Func func) const {
+        std::string key;
+        for_each_record([&](const char *key_data, const RecordHeader& record) {
+            key.assign(key_data, record.key_size);
+            func(static_cast<const std::string&>(key), record.entry.unpack());
+        });
+        for(const auto& [long_key, packed] : oversize_) {
+            func(long_key, packed.unpack());
+        }
+    }
+
+    size_t size() const { return live_; }
+    void clear();
+
+    // heap only, the mapping is up to the page cache
+    size_t memory_usage() const;
+    uint64_t disk_usage() const { return pages_ * PAGE_SIZE; }
+
+    private:
+    struct PageHeader {
+        uint32_t next; // overflow page after this one, 0 for none
+        uint32_t used; // bytes of records after the header
+    };
+
+    // records are packed back to back in a page, so copy them in and out
+    struct RecordHeader {
+        PackedKeyDirEntry entry;
+        uint16_t tag;
+        uint16_t key_size; // the key follows
+    };
+    static_assert(sizeof(RecordHeader) == 28, "disk keydir records should have 28 byte headers");
+
+    static constexpr size_t PAGE_CAPACITY = PAGE_SIZE - sizeof(PageHeader);
+    static constexpr size_t MAX_PAGE_KEY = PAGE_CAPACITY - sizeof(RecordHeader);
+
+    // a record in a page, offset 0 for none (records start after the header)
+    struct Location {
+        uint64_t page = 0;
+        uint32_t offset = 0;
+        bool found() const { return offset != 0; }
+    };
+
+    std::string path_;
+    int fd_ = -1;
+    char *data_ = nullptr;
+    uint64_t mapped_pages_ = 0;
+    uint64_t pages_ = 0;       // buckets, then overflow pages
+    uint64_t buckets_ = 0;
+    size_t live_ = 0;
+    uint64_t record_bytes_ = 0; // in pages, what decides when to grow
+    std::unordered_map<std::string, PackedKeyDirEntry> oversize_;
+
+    static uint16_t tag_of(size_t hash) {
+        return static_cast<uint16_t>(static_cast<uint64_t>(hash) >> 48);
+    }
+
+    char *page_data(uint64_t page) const { return data_ + page * PAGE_SIZE; }
+
+    PageHeader page_header(uint64_t page) const {
+        PageHeader header;
+        std::memcpy(&header, page_data(page), sizeof(header));
+        return header;
+    }
+
+    void set_page_header(uint64_t page, const PageHeader& header) {
+        std::memcpy(page_data(page), &header, sizeof(header));
+    }
+
+    template<typename Func>
+    void for_each_record(Func func) const {
+        for(uint64_t page = 0; page < pages_; page++) {
+            const char *base = page_data(page);
+            PageHeader header = page_header(page);
+            for(uint64_t pos = sizeof(PageHeader); pos < sizeof(PageHeader) + header.used; ) {
+                RecordHeader record;
+                std::memcpy(&record, base + pos, sizeof(record));
+                func(base + pos + sizeof(record), record);
+                pos += sizeof(record) + record.key_size;
+            }
+        }
+    }
+
+    Location locate(const std::string& key, size_t hash) const;
+    KeyDirEntry read_entry(const Location& at) const;
+    void write_entry(const Location& at, const PackedKeyDirEntry& packed);
+    void insert(const std::string& key, size_t hash, const PackedKeyDirEntry& packed);
+    void erase(const Location& at);
+    uint64_t add_page();
+    // an empty file of buckets pages
+    void reset(uint64_t buckets);
+    void map(uint64_t pages);
+    // twice the buckets, in a new file that replaces this one
+    void grow();
+
+    template<typename Func>
+    std::pair<bool, std::optional<KeyDirEntry>> put_if_impl(
+        const std::string& key,
+        const KeyDirEntry& value,
+        size_t hash,
+        Func replace
+    ) {
+        if(key.size() > MAX_PAGE_KEY) {
+            auto it = oversize_.find(key);
+            if(it == oversize_.end()) {
+                oversize_.emplace(key, PackedKeyDirEntry::pack(value));
+                live_++;
+                return {true, std::nullopt};
+            }
+            KeyDirEntry previous = it->second.unpack();
+            if(!replace(static_cast<const KeyDirEntry&>(previous))) {
+                return {false, previous};
+            }
+            it->second = PackedKeyDirEntry::pack(value);
+            return {true, previous};
+        }
+
+        Location at = locate(key, hash);
+        if(at.found()) {
+            KeyDirEntry previous = read_entry(at);
+            if(!replace(static_cast<const KeyDirEntry&>(previous))) {
+                return {false, previous};
+            }
+            write_entry(at, PackedKeyDirEntry::pack(value));
+            return {true, previous};
+        }
+
+        insert(key, hash, PackedKeyDirEntry::pack(value));
+        return {true, std::nullopt};
+    }
+};
@@ -0,0 +1,86 @@
+#include "FileTable.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "IoRing.hpp"
+
+FileHandle::~FileHandle() {
+    // nothing is in flight on a handle nobody holds any more
+    if(ring_slot_ >= 0) {
+        ring_->unregister_file(ring_slot_);
+    }
+    if(fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void FileHandle::register_with(const std::shared_ptr<IoRing>& ring) {
+    if(ring_slot_ >= 0) {
+        return;
+    }
+    ring_slot_ = ring->register_file(fd_);
+    if(ring_slot_ >= 0) {
+        ring_ = ring;
+    }
+}
+
+std::shared_ptr<FileHandle> FileTable::acquire(uint64_t file_id, const std::string& path) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = handles_.find(file_id);
+        if(it != handles_.end()) {
+            return it->second;
+        }
+    }
+
+    // open outside the lock, if another reader won the race ours just gets closed
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return nullptr;
+    }
+    auto handle = std::make_shared<FileHandle>(fd);
+    if(ring_) {
+        handle->register_with(ring_);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto [it, inserted] = handles_.emplace(file_id, handle);
+    return it->second;
+}
+
+std::shared_ptr<const MappedFile> FileTable::acquire_mapping(uint64_t file_id, const std::string& path) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = mappings_.find(file_id);
+        if(it != mappings_.end()) {
+            return it->second;
+        }
+    }
+
+    std::shared_ptr<const MappedFile> mapping = MappedFile::open(path);
+    if(!mapping) {
+        return nullptr;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto [it, inserted] = mappings_.emplace(file_id, mapping);
+    return it->second;
+}
+
+void FileTable::invalidate(uint64_t file_id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    handles_.erase(file_id);
+    mappings_.erase(file_id);
+}
+
+void FileTable::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    handles_.clear();
+    mappings_.clear();
+}
+
+size_t FileTable::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return handles_.size();
+}
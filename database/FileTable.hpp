@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "MappedFile.hpp"
+
+class IoRing;
+
+// Descriptor for one datafile. The fd is closed when the last shared_ptr
+// goes away, so a reader holding a handle can finish its pread even if
+// compaction has already unlinked the file.
+class FileHandle {
+    public:
+    explicit FileHandle(int fd) : fd_(fd) {}
+    ~FileHandle();
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    int fd() const { return fd_; }
+
+    // puts the fd in ring's registered file table until the handle goes
+    // away, nothing happens when the table is full
+    void register_with(const std::shared_ptr<IoRing>& ring);
+    // -1 unless registered
+    int ring_slot() const { return ring_slot_; }
+
+    private:
+    int fd_;
+    std::shared_ptr<IoRing> ring_;
+    int ring_slot_ = -1;
+};
+
+// file_id -> open handle and/or read-only mapping, opened lazily on first read.
+class FileTable {
+    public:
+    FileTable() = default;
+
+    // handles opened from now on are registered with ring
+    void set_ring(std::shared_ptr<IoRing> ring) { ring_ = std::move(ring); }
+
+    // nullptr if the file could not be opened
+    std::shared_ptr<FileHandle> acquire(uint64_t file_id, const std::string& path);
+
+    // maps the file as it is now, so only sealed files should be mapped.
+    // nullptr if it could not be mapped
+    std::shared_ptr<const MappedFile> acquire_mapping(uint64_t file_id, const std::string& path);
+
+    // drop the cached handle and mapping, in-flight readers keep theirs alive
+    void invalidate(uint64_t file_id);
+    void clear();
+
+    size_t size() const;
+
+    private:
+    std::unordered_map<uint64_t, std::shared_ptr<FileHandle>> handles_;
+    std::unordered_map<uint64_t, std::shared_ptr<const MappedFile>> mappings_;
+    mutable std::shared_mutex mutex_;
+    std::shared_ptr<IoRing> ring_;
+};
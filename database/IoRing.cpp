@@ -0,0 +1,535 @@
+#include "IoRing.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ROCASK_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+IoRing::Buffer& IoRing::Buffer::operator=(Buffer&& other) noexcept {
+    if(this != &other) {
+        this->~Buffer();
+        ring_ = other.ring_;
+        index_ = other.index_;
+        data_ = other.data_;
+        other.ring_ = nullptr;
+    }
+    return *this;
+}
+
+IoRing::Buffer::~Buffer() {
+    if(ring_) {
+        std::lock_guard<std::mutex> lock(ring_->buffers_mutex_);
+        ring_->free_buffers_.push_back(index_);
+        ring_ = nullptr;
+    }
+}
+
+IoRing::Buffer IoRing::lease_buffer(uint64_t size) {
+    Buffer buffer;
+    if(size > IO_RING_BUFFER_SIZE) {
+        return buffer;
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    if(free_buffers_.empty()) {
+        return buffer;
+    }
+    buffer.ring_ = this;
+    buffer.index_ = free_buffers_.back();
+    buffer.data_ = buffers_ + buffer.index_ * IO_RING_BUFFER_SIZE;
+    free_buffers_.pop_back();
+    return buffer;
+}
+
+int IoRing::register_file(int fd) {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    if(!files_registered_ || free_slots_.empty()) {
+        return -1;
+    }
+    int slot = free_slots_.back();
+
+#ifdef ROCASK_IO_URING
+    struct io_uring_files_update update{};
+    update.offset = static_cast<uint32_t>(slot);
+    update.fds = reinterpret_cast<uint64_t>(&fd);
+    if(::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1) {
+        return -1;
+    }
+#endif
+    free_slots_.pop_back();
+    return slot;
+}
+
+void IoRing::unregister_file(int slot) {
+#ifdef ROCASK_IO_URING
+    int none = -1;
+    struct io_uring_files_update update{};
+    update.offset = static_cast<uint32_t>(slot);
+    update.fds = reinterpret_cast<uint64_t>(&none);
+    ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES_UPDATE, &update, 1);
+#endif
+
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    free_slots_.push_back(slot);
+}
+
+bool IoRing::read(const FileHandle& file, uint64_t offset, uint64_t size, char *output, int buffer_index) {
+    std::vector<Read> reads{{&file, offset, size, output, buffer_index}};
+    return read_all(reads);
+}
+
+int IoRing::sync(const FileHandle& file) {
+#ifdef ROCASK_IO_URING
+    Request request{IORING_OP_FSYNC, &file, 0, 0, 0, IORING_FSYNC_DATASYNC};
+    run(&request, 1);
+    return request.result;
+#else
+    return -ENOSYS;
+#endif
+}
+
+#ifdef ROCASK_IO_URING
+
+// the kernel reads the tail and writes the head of the submission ring,
+// and the other way around for the completion ring
+static unsigned load_acquire(const unsigned *ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned *ptr, unsigned value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+std::shared_ptr<IoRing> IoRing::create(unsigned entries) {
+    struct io_uring_params params{};
+    int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if(fd < 0) {
+        return nullptr;
+    }
+
+    std::shared_ptr<IoRing> ring(new IoRing());
+    ring->fd_ = fd;
+    ring->entries_ = params.sq_entries;
+
+    // every op used here, READ came last (5.6)
+    {
+        std::vector<char> storage(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+        auto *probe = reinterpret_cast<struct io_uring_probe*>(storage.data());
+        if(::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            return nullptr;
+        }
+        for(uint8_t op : {IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_WRITEV, IORING_OP_FSYNC}) {
+            if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return nullptr;
+            }
+        }
+    }
+
+    ring->sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap) {
+        ring->sq_ring_size_ = ring->cq_ring_size_ = std::max(ring->sq_ring_size_, ring->cq_ring_size_);
+    }
+
+    void *sq_ring = ::mmap(nullptr, ring->sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(sq_ring == MAP_FAILED) {
+        return nullptr;
+    }
+    ring->sq_ring_ = sq_ring;
+
+    void *cq_ring = sq_ring;
+    if(!single_mmap) {
+        cq_ring = ::mmap(nullptr, ring->cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(cq_ring == MAP_FAILED) {
+            return nullptr;
+        }
+        ring->cq_ring_ = cq_ring;
+    }
+
+    ring->sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return nullptr;
+    }
+    ring->sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    char *sq = static_cast<char*>(sq_ring);
+    char *cq = static_cast<char*>(cq_ring);
+    ring->sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    ring->sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring->sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring->sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    ring->cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring->cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring->cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring->cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // both tables are optional, without them requests name the plain fd
+    // and read into whatever memory they're given
+    std::vector<int> empty_slots(IO_RING_MAX_FILES, -1);
+    if(::syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, empty_slots.data(), IO_RING_MAX_FILES) == 0) {
+        ring->files_registered_ = true;
+        for(int slot = IO_RING_MAX_FILES - 1; slot >= 0; slot--) {
+            ring->free_slots_.push_back(slot);
+        }
+    }
+
+    void *buffers = ::mmap(nullptr, IO_RING_BUFFER_COUNT * IO_RING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffers != MAP_FAILED) {
+        std::vector<struct iovec> iov(IO_RING_BUFFER_COUNT);
+        for(unsigned i = 0; i < IO_RING_BUFFER_COUNT; i++) {
+            iov[i] = {static_cast<char*>(buffers) + i * IO_RING_BUFFER_SIZE, IO_RING_BUFFER_SIZE};
+        }
+        // pinned memory counts against RLIMIT_MEMLOCK on older kernels
+        if(::syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov.data(), IO_RING_BUFFER_COUNT) == 0) {
+            ring->buffers_ = static_cast<char*>(buffers);
+            for(int i = IO_RING_BUFFER_COUNT - 1; i >= 0; i--) {
+                ring->free_buffers_.push_back(i);
+            }
+        } else {
+            ::munmap(buffers, IO_RING_BUFFER_COUNT * IO_RING_BUFFER_SIZE);
+        }
+    }
+
+    return ring;
+}
+
+IoRing::~IoRing() {
+    if(reaper_.joinable()) {
+        drain();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        reaper_.join();
+    }
+    if(buffers_) {
+        ::munmap(buffers_, IO_RING_BUFFER_COUNT * IO_RING_BUFFER_SIZE);
+    }
+    if(sqes_) {
+        ::munmap(sqes_, sqes_size_);
+    }
+    if(cq_ring_) {
+        ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if(sq_ring_) {
+        ::munmap(sq_ring_, sq_ring_size_);
+    }
+    if(fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+bool IoRing::read_all(std::vector<Read>& reads) {
+    std::vector<Request> requests;
+    std::vector<size_t> pending(reads.size());
+    std::vector<uint64_t> done(reads.size(), 0);
+    for(size_t i = 0; i < reads.size(); i++) {
+        pending[i] = i;
+    }
+
+    // short reads go around again for the rest
+    while(!pending.empty()) {
+        requests.clear();
+        for(size_t i : pending) {
+            const Read& read = reads[i];
+            uint64_t length = std::min<uint64_t>(read.size - done[i], INT_MAX);
+            Request request{
+                read.buffer_index >= 0 ? static_cast<uint8_t>(IORING_OP_READ_FIXED) : static_cast<uint8_t>(IORING_OP_READ),
+                read.file,
+                read.offset + done[i],
+                reinterpret_cast<uint64_t>(read.output + done[i]),
+                static_cast<uint32_t>(length)
+            };
+            request.buffer_index = read.buffer_index;
+            requests.push_back(request);
+        }
+        run(requests.data(), requests.size());
+
+        std::vector<size_t> again;
+        for(size_t j = 0; j < pending.size(); j++) {
+            size_t i = pending[j];
+            int32_t result = requests[j].result;
+            if(result == -EINTR || result == -EAGAIN) {
+                again.push_back(i);
+                continue;
+            }
+            // an error or the end of the file
+            if(result <= 0) {
+                return false;
+            }
+            done[i] += static_cast<uint64_t>(result);
+            if(done[i] < reads[i].size) {
+                again.push_back(i);
+            }
+        }
+        pending = std::move(again);
+    }
+    return true;
+}
+
+int64_t IoRing::append(const FileHandle& file, const struct iovec *iov, unsigned count, bool sync, bool& synced) {
+    // O_APPEND puts it at the end whatever the offset says
+    Request requests[2] = {
+        {IORING_OP_WRITEV, &file, 0, reinterpret_cast<uint64_t>(iov), count},
+        {IORING_OP_FSYNC, &file, 0, 0, 0, IORING_FSYNC_DATASYNC}
+    };
+    requests[0].link = sync;
+    run(requests, sync ? 2 : 1);
+
+    synced = sync && requests[1].result == 0;
+    return requests[0].result;
+}
+
+void IoRing::run(Request *requests, size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    submit(lock, requests, count);
+
+    wait(lock, [&] {
+        for(size_t i = 0; i < count; i++) {
+            if(!requests[i].done) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+void IoRing::read_async(const FileHandle& file, uint64_t offset, uint64_t size, char *output, std::function<void(bool)> done) {
+    uint64_t length = std::min<uint64_t>(size, INT_MAX);
+    Request *request = new Request{IORING_OP_READ, &file, offset, reinterpret_cast<uint64_t>(output), static_cast<uint32_t>(length)};
+
+    // short reads go around again for the rest
+    request->on_complete = [this, &file, offset, size, output, done = std::move(done)](int32_t result) mutable {
+        if(result == -EINTR || result == -EAGAIN) {
+            read_async(file, offset, size, output, std::move(done));
+        } else if(result <= 0) {
+            done(false);
+        } else if(static_cast<uint64_t>(result) < size) {
+            read_async(file, offset + result, size - result, output + result, std::move(done));
+        } else {
+            done(true);
+        }
+    };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(!reaper_.joinable()) {
+        reaper_ = std::thread(&IoRing::reaper, this);
+    }
+    async_in_flight_++;
+    cv_.notify_all();
+    submit(lock, request, 1);
+    // only if the submission failed outright
+    run_callbacks(lock);
+}
+
+void IoRing::drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    wait(lock, [&] {
+        return async_in_flight_ == 0 && callbacks_running_ == 0;
+    });
+}
+
+// reaps while read_async requests are out and nobody else waits for them
+void IoRing::reaper() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(true) {
+        cv_.wait(lock, [&] {
+            return stopping_ || async_in_flight_ > 0;
+        });
+        if(async_in_flight_ == 0) {
+            return;
+        }
+        wait(lock, [&] {
+            return async_in_flight_ == 0;
+        });
+    }
+}
+
+// at most entries_ in flight, so completions can never overflow
+void IoRing::submit(std::unique_lock<std::mutex>& lock, Request *requests, size_t count) {
+    size_t submitted = 0;
+    while(submitted < count) {
+        size_t chunk = std::min<size_t>(count - submitted, entries_);
+        // a chain must not be split
+        while(submitted + chunk < count && chunk > 1 && requests[submitted + chunk - 1].link) {
+            chunk--;
+        }
+        wait(lock, [&] {
+            return in_flight_ + chunk <= entries_;
+        });
+
+        for(size_t i = submitted; i < submitted + chunk; i++) {
+            push(requests[i]);
+        }
+        in_flight_ += static_cast<unsigned>(chunk);
+
+        unsigned to_submit = static_cast<unsigned>(chunk);
+        while(to_submit > 0) {
+            int n = ring_enter(fd_, to_submit, 0, 0);
+            if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+                continue;
+            }
+            if(n <= 0) {
+                // nothing more gets in, fail what's left in the queue
+                // (the kernel has it, but nothing ever tells it to go)
+                int error = n < 0 ? errno : EIO;
+                for(size_t i = submitted + chunk - to_submit; i < submitted + chunk; i++) {
+                    complete(requests[i], -error);
+                }
+                // take them back off the ring
+                store_release(sq_tail_, load_acquire(sq_tail_) - to_submit);
+                in_flight_ -= to_submit;
+                break;
+            }
+            to_submit -= static_cast<unsigned>(n);
+        }
+        submitted += chunk;
+    }
+}
+
+// until done() holds, which takes some completions. Whoever finds nobody
+// waiting in the kernel goes in and reaps for everybody. Only that thread
+// touches the completion queue: one that reaped in between its check and
+// the kernel entry would leave it waiting for a completion already taken
+void IoRing::wait(std::unique_lock<std::mutex>& lock, const std::function<bool()>& done) {
+    while(!done()) {
+        // with nothing in flight only a callback finishing can change things
+        if(reaping_ || in_flight_ == 0) {
+            cv_.wait(lock);
+            continue;
+        }
+
+        reaping_ = true;
+        reap();
+        if(!done()) {
+            lock.unlock();
+            ring_enter(fd_, 0, 1, IORING_ENTER_GETEVENTS);
+            lock.lock();
+            reap();
+        }
+        reaping_ = false;
+        cv_.notify_all();
+        run_callbacks(lock);
+    }
+}
+
+// caller holds mutex_
+void IoRing::push(Request& request) {
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode = request.opcode;
+    int slot = request.file->ring_slot();
+    if(slot >= 0) {
+        sqe->fd = slot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = request.file->fd();
+    }
+    if(request.link) {
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    sqe->off = request.offset;
+    sqe->addr = request.addr;
+    sqe->len = request.length;
+    sqe->fsync_flags = request.op_flags;
+    if(request.buffer_index >= 0) {
+        sqe->buf_index = static_cast<uint16_t>(request.buffer_index);
+    }
+    sqe->user_data = reinterpret_cast<uint64_t>(&request);
+
+    sq_array_[index] = index;
+    store_release(sq_tail_, tail + 1);
+}
+
+// caller holds mutex_
+void IoRing::reap() {
+    unsigned head = *cq_head_;
+    unsigned tail = load_acquire(cq_tail_);
+    if(head == tail) {
+        return;
+    }
+    for(; head != tail; head++) {
+        const struct io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+        in_flight_--;
+        complete(*reinterpret_cast<Request*>(cqe.user_data), cqe.res);
+    }
+    store_release(cq_head_, head);
+    cv_.notify_all();
+}
+
+void IoRing::complete(Request& request, int32_t result) {
+    request.result = result;
+    request.done = true;
+    if(request.on_complete) {
+        async_in_flight_--;
+        callbacks_running_++;
+        completed_.push_back(&request);
+    }
+}
+
+// without the lock, a callback may well submit again
+void IoRing::run_callbacks(std::unique_lock<std::mutex>& lock) {
+    while(!completed_.empty()) {
+        std::vector<Request*> batch;
+        batch.swap(completed_);
+        lock.unlock();
+        for(Request *request : batch) {
+            request->on_complete(request->result);
+            delete request;
+        }
+        lock.lock();
+        callbacks_running_ -= static_cast<unsigned>(batch.size());
+        cv_.notify_all();
+    }
+}
+
+#else
+
+std::shared_ptr<IoRing> IoRing::create(unsigned entries) {
+    return nullptr;
+}
+
+IoRing::~IoRing() {}
+
+bool IoRing::read_all(std::vector<Read>& reads) {
+    return false;
+}
+
+int64_t IoRing::append(const FileHandle& file, const struct iovec *iov, unsigned count, bool sync, bool& synced) {
+    synced = false;
+    return -ENOSYS;
+}
+
+void IoRing::read_async(const FileHandle& file, uint64_t offset, uint64_t size, char *output, std::function<void(bool)> done) {
+    done(false);
+}
+
+void IoRing::drain() {}
+void IoRing::run(Request *requests, size_t count) {}
+void IoRing::submit(std::unique_lock<std::mutex>& lock, Request *requests, size_t count) {}
+void IoRing::wait(std::unique_lock<std::mutex>& lock, const std::function<bool()>& done) {}
+void IoRing::push(Request& request) {}
+void IoRing::reap() {}
+void IoRing::complete(Request& request, int32_t result) {}
+void IoRing::run_callbacks(std::unique_lock<std::mutex>& lock) {}
+void IoRing::reaper() {}
+
+#endif
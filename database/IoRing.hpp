@@ -0,0 +1,165 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sys/uio.h>
+#include <thread>
+#include <vector>
+
+#include "FileTable.hpp"
+
+// registered file table size, files past it are used by plain fd
+const unsigned IO_RING_MAX_FILES = 1024;
+// registered buffers for reads whose bytes are only looked at and copied out
+const unsigned IO_RING_BUFFER_COUNT = 8;
+const uint64_t IO_RING_BUFFER_SIZE = 1024 * 1024;
+
+// One io_uring shared by every thread doing datafile I/O, over the raw
+// syscalls so there's nothing to link. Concurrent callers fill the same
+// submission queue, so the device sees as many requests as there are
+// threads waiting on one. The calls block until their own completions are
+// in, whoever finds nobody waiting in the kernel reaps for everybody (like
+// the group commit leader in Rocask). Thread safe.
+class IoRing {
+    public:
+    // nullptr when the kernel doesn't have io_uring, has it disabled, or
+    // lacks one of the ops used here. Callers fall back to pread/pwrite
+    static std::shared_ptr<IoRing> create(unsigned entries);
+    ~IoRing();
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // slot in the registered file table, -1 when it's full (or the kernel
+    // didn't take the table)
+    int register_file(int fd);
+    void unregister_file(int slot);
+
+    // a registered buffer, given back when it goes away
+    class Buffer {
+        public:
+        Buffer() = default;
+        Buffer(Buffer&& other) noexcept { *this = std::move(other); }
+        Buffer& operator=(Buffer&& other) noexcept;
+        ~Buffer();
+
+        explicit operator bool() const { return ring_ != nullptr; }
+        char* data() const { return data_; }
+        int index() const { return index_; }
+
+        private:
+        friend class IoRing;
+        IoRing* ring_ = nullptr;
+        int index_ = -1;
+        char *data_ = nullptr;
+    };
+
+    // empty when size doesn't fit one or all of them are taken
+    Buffer lease_buffer(uint64_t size);
+
+    struct Read {
+        const FileHandle* file;
+        uint64_t offset;
+        uint64_t size;
+        char *output;         // inside buffer when buffer_index is set
+        int buffer_index = -1;
+    };
+
+    // exactly size bytes, false on end of file or an error like pread
+    bool read(const FileHandle& file, uint64_t offset, uint64_t size, char *output, int buffer_index = -1);
+    // all of them submitted together, false if any of them failed
+    bool read_all(std::vector<Read>& reads);
+
+    // one writev at the end of an O_APPEND file, chained with an fdatasync
+    // when sync is set. Returns the bytes written or -errno, synced says
+    // whether the fdatasync ran and succeeded (a short write cancels it)
+    int64_t append(const FileHandle& file, const struct iovec *iov, unsigned count, bool sync, bool& synced);
+
+    // fdatasync, 0 or -errno
+    int sync(const FileHandle& file);
+
+    // like read, but returns once it's submitted. done runs on whichever
+    // thread reaps the completion (a background one if nobody else is
+    // waiting), so it should hand off anything slow. The caller keeps file
+    // and output alive until then
+    void read_async(const FileHandle& file, uint64_t offset, uint64_t size, char *output, std::function<void(bool)> done);
+
+    // until every read_async has finished, callbacks included
+    void drain();
+
+    private:
+    IoRing() = default;
+
+    struct Request {
+        uint8_t opcode;
+        const FileHandle* file;
+        uint64_t offset;
+        uint64_t addr;
+        uint32_t length;
+        uint32_t op_flags = 0;
+        int buffer_index = -1;
+        bool link = false;    // the next request starts once this one is done
+
+        int32_t result = 0;
+        bool done = false;
+
+        // set for read_async, the ring owns the request then
+        std::function<void(int32_t)> on_complete;
+    };
+
+    // submits requests and waits until every one of them completed
+    void run(Request *requests, size_t count);
+    // the rest expect mutex_ held
+    void submit(std::unique_lock<std::mutex>& lock, Request *requests, size_t count);
+    void wait(std::unique_lock<std::mutex>& lock, const std::function<bool()>& done);
+    void push(Request& request);
+    void reap();
+    void complete(Request& request, int32_t result);
+    void run_callbacks(std::unique_lock<std::mutex>& lock);
+    void reaper();
+
+    int fd_ = -1;
+    unsigned entries_ = 0;
+
+    // the mmapped rings
+    void *sq_ring_ = nullptr;
+    void *cq_ring_ = nullptr;
+    uint64_t sq_ring_size_ = 0;
+    uint64_t cq_ring_size_ = 0;
+    struct io_uring_sqe *sqes_ = nullptr;
+    uint64_t sqes_size_ = 0;
+
+    unsigned *sq_head_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_mask_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned *cq_mask_ = nullptr;
+    struct io_uring_cqe *cqes_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    unsigned in_flight_ = 0;
+    bool reaping_ = false; // somebody waits in the kernel for completions
+
+    // read_async requests and the callbacks they're waiting to run
+    unsigned async_in_flight_ = 0;
+    unsigned callbacks_running_ = 0;
+    std::vector<Request*> completed_;
+    std::thread reaper_;
+    bool stopping_ = false;
+
+    // registered files
+    bool files_registered_ = false;
+    std::vector<int> free_slots_;
+    std::mutex files_mutex_;
+
+    // registered buffers, one mapping cut into IO_RING_BUFFER_COUNT pieces
+    char *buffers_ = nullptr;
+    std::vector<int> free_buffers_;
+    std::mutex buffers_mutex_;
+};
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DiskKeyDir.hpp"
+#include "KeyDirEntry.hpp"
+#include "../datastructures/ShardedMap.hpp"
+
+// Open addressing table for one keydir stripe. Keys are copied into one
+// contiguous arena and slots are a packed 32 bytes, the entry and where its
+// key is in the arena. Keys are at most MAX_KEY_SIZE.
+// A 16 bit tag from the hash lets a probe skip almost every key compare.
+// The hash passed in must be std::hash<std::string>, rehash recomputes it.
+class CompactKeyDirTable {
+    public:
+    std::optional<KeyDirEntry> find(const std::string& key, size_t hash) const {
+        if(slots_.empty()) {
+            return std::nullopt;
+        }
+        size_t pos = locate(key, hash);
+        if(pos == npos) {
+            return std::nullopt;
+        }
+        return slots_[pos].entry.unpack();
+    }
+
+    std::optional<KeyDirEntry> put(const std::string& key, const KeyDirEntry& value, size_t hash) {
+        return put_if_impl(key, value, hash, [](const KeyDirEntry&) { return true; }).second;
+    }
+
+    template<typename Func>
+    bool put_if(const std::string& key, const KeyDirEntry& value, size_t hash, Func replace) {
+        return put_if_impl(key, value, hash, replace).first;
+    }
+
+    bool remove(const std::string& key, size_t hash) {
+        if(slots_.empty()) {
+            return false;
+        }
+        size_t pos = locate(key, hash);
+        if(pos == npos) {
+            return false;
+        }
+        erase_slot(pos);
+        return true;
+    }
+
+    bool remove_if(const std::string& key, const KeyDirEntry& expected, size_t hash) {
+        if(slots_.empty()) {
+            return false;
+        }
+        size_t pos = locate(key, hash);
+        if(pos == npos || !(slots_[pos].entry.unpack() == expected)) {
+            return false;
+        }
+        erase_slot(pos);
+        return true;
+    }
+
+    template<typename Func>
+    bool update(const std::string& key, const KeyDirEntry& expected, size_t hash, Func updater) {
+        if(slots_.empty()) {
+            return false;
+        }
+        size_t pos = locate(key, hash);
+        if(pos == npos) {
+            return false;
+        }
+        KeyDirEntry entry = slots_[pos].entry.unpack();
+        if(!(entry == expected)) {
+            return false;
+        }
+        updater(entry);
+
+        // packed first, a field that doesn't fit must not leave the slot half written
+        slots_[pos].entry = PackedKeyDirEntry::pack(entry);
+        return true;
+    }
+
+    template<typename Func>
+    void for_each(Func func) const {
+        std::string key;
+        for(const Slot& slot : slots_) {
+            if(slot.tag < FIRST_TAG) {
+                continue;
+            }
+            key.assign(arena_.data() + slot.key_offset, slot.key_size);
+            func(static_cast<const std::string&>(key), slot.entry.unpack());
+        }
+    }
+
+    size_t size() const { return live_; }
+
+    void clear() {
+        slots_.clear();
+        slots_.shrink_to_fit();
+        arena_.clear();
+        arena_.shrink_to_fit();
+        live_ = 0;
+        used_ = 0;
+        arena_garbage_ = 0;
+    }
+
+    size_t memory_usage() const {
+        return slots_.capacity() * sizeof(Slot) + arena_.capacity();
+    }
+
+    private:
+    struct Slot {
+        uint32_t key_offset;
+        uint16_t key_size;
+        uint16_t tag;
+        PackedKeyDirEntry entry;
+    };
+    static_assert(sizeof(Slot) == 32, "keydir slots should stay at 32 bytes");
+
+    static constexpr uint16_t EMPTY = 0;
+    static constexpr uint16_t TOMBSTONE = 1;
+    static constexpr uint16_t FIRST_TAG = 2;
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    std::vector<Slot> slots_;
+    std::vector<char> arena_;
+    size_t live_ = 0;           // slots holding a key
+    size_t used_ = 0;           // live + tombstones, what probing has to walk past
+    size_t arena_garbage_ = 0;  // bytes of removed keys still in the arena
+
+    // slot index from the low bits, tag from the top 16
+    static uint16_t tag_of(size_t hash) {
+        uint16_t tag = static_cast<uint16_t>(static_cast<uint64_t>(hash) >> 48);
+        return tag < FIRST_TAG ? tag + FIRST_TAG : tag;
+    }
+
+    bool key_equals(const Slot& slot, const std::string& key) const {
+        return slot.key_size == key.size() &&
+               std::memcmp(arena_.data() + slot.key_offset, key.data(), key.size()) == 0;
+    }
+
+    size_t locate(const std::string& key, size_t hash) const {
+        uint16_t tag = tag_of(hash);
+        size_t mask = slots_.size() - 1;
+        for(size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+            const Slot& slot = slots_[pos];
+            if(slot.tag == EMPTY) {
+                return npos;
+            }
+            if(slot.tag == tag && key_equals(slot, key)) {
+                return pos;
+            }
+        }
+    }
+
+    void erase_slot(size_t pos) {
+        slots_[pos].tag = TOMBSTONE;
+        arena_garbage_ += slots_[pos].key_size;
+        live_--;
+    }
+
+    template<typename Func>
+    std::pair<bool, std::optional<KeyDirEntry>> put_if_impl(
+        const std::string& key,
+        const KeyDirEntry& value,
+        size_t hash,
+        Func replace
+    ) {
+        // keep at most 7/8 of the slots in use, tombstones included
+        if((used_ + 1) * 8 > slots_.size() * 7) {
+            rehash();
+        }
+
+        uint16_t tag = tag_of(hash);
+        size_t mask = slots_.size() - 1;
+        size_t reuse = npos;
+        size_t pos = hash & mask;
+        for(; ; pos = (pos + 1) & mask) {
+            Slot& slot = slots_[pos];
+            if(slot.tag == EMPTY) {
+                break;
+            }
+            if(slot.tag == TOMBSTONE) {
+                if(reuse == npos) {
+                    reuse = pos;
+                }
+                continue;
+            }
+            if(slot.tag == tag && key_equals(slot, key)) {
+                KeyDirEntry previous = slot.entry.unpack();
+                if(!replace(static_cast<const KeyDirEntry&>(previous))) {
+                    return {false, previous};
+                }
+                slot.entry = PackedKeyDirEntry::pack(value);
+                return {true, previous};
+            }
+        }
+
+        Slot fresh{};
+        fresh.entry = PackedKeyDirEntry::pack(value);
+        fresh.key_offset = PackedKeyDirEntry::narrow(arena_.size(), "keydir arena offset");
+        if(key.size() > MAX_KEY_SIZE) {
+            throw std::length_error("KeyDir: key_size exceeds MAX_KEY_SIZE.");
+        }
+        fresh.key_size = static_cast<uint16_t>(key.size());
+        fresh.tag = tag;
+        arena_.insert(arena_.end(), key.begin(), key.end());
+
+        if(reuse != npos) {
+            slots_[reuse] = fresh;
+        } else {
+            slots_[pos] = fresh;
+            used_++;
+        }
+        live_++;
+        return {true, std::nullopt};
+    }
+
+    // grows when mostly live, otherwise rebuilds in place to shed tombstones,
+    // the arena is repacked either way
+    void rehash() {
+        size_t capacity = slots_.empty() ? 16 : slots_.size();
+        while((live_ + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+
+        std::vector<Slot> old_slots(capacity);
+        old_slots.swap(slots_);
+        std::vector<char> old_arena;
+        old_arena.reserve(arena_.size() - arena_garbage_);
+        old_arena.swap(arena_);
+
+        std::hash<std::string> hasher;
+        std::string key;
+        size_t mask = slots_.size() - 1;
+        for(const Slot& slot : old_slots) {
+            if(slot.tag < FIRST_TAG) {
+                continue;
+            }
+            key.assign(old_arena.data() + slot.key_offset, slot.key_size);
+
+            size_t pos = hasher(key) & mask;
+            while(slots_[pos].tag != EMPTY) {
+                pos = (pos + 1) & mask;
+            }
+            slots_[pos] = slot;
+            slots_[pos].key_offset = static_cast<uint32_t>(arena_.size());
+            arena_.insert(arena_.end(), key.begin(), key.end());
+        }
+
+        used_ = live_;
+        arena_garbage_ = 0;
+    }
+};
+
+// A keydir stripe, in memory unless use_disk moved it to a DiskKeyDirTable
+// (RocaskOptions::disk_keydir)
+class KeyDirTable {
+    public:
+    // whatever the stripe held is dropped, so before anything is put
+    void use_disk(const std::string& path) {
+        disk_ = std::make_unique<DiskKeyDirTable>(path);
+        memory_.clear();
+    }
+
+    // null while it's in memory
+    const DiskKeyDirTable *disk() const { return disk_.get(); }
+
+    std::optional<KeyDirEntry> find(const std::string& key, size_t hash) const {
+        return disk_ ? disk_->find(key, hash) : memory_.find(key, hash);
+    }
+
+    std::optional<KeyDirEntry> put(const std::string& key, const KeyDirEntry& value, size_t hash) {
+        return disk_ ? disk_->put(key, value, hash) : memory_.put(key, value, hash);
+    }
+
+    template<typename Func>
+    bool put_if(const std::string& key, const KeyDirEntry& value, size_t hash, Func replace) {
+        return disk_ ? disk_->put_if(key, value, hash, replace) : memory_.put_if(key, value, hash, replace);
+    }
+
+    bool remove(const std::string& key, size_t hash) {
+        return disk_ ? disk_->remove(key, hash) : memory_.remove(key, hash);
+    }
+
+    bool remove_if(const std::string& key, const KeyDirEntry& expected, size_t hash) {
+        return disk_ ? disk_->remove_if(key, expected, hash) : memory_.remove_if(key, expected, hash);
+    }
+
+    template<typename Func>
+    bool update(const std::string& key, const KeyDirEntry& expected, size_t hash, Func updater) {
+        return disk_ ? disk_->update(key, expected, hash, updater) : memory_.update(key, expected, hash, updater);
+    }
+
+    template<typename Func>
+    void for_each(Func func) const {
+        if(disk_) {
+            disk_->for_each(func);
+        } else {
+            memory_.for_each(func);
+        }
+    }
+
+    size_t size() const { return disk_ ? disk_->size() : memory_.size(); }
+
+    void clear() {
+        if(disk_) {
+            disk_->clear();
+        } else {
+            memory_.clear();
+        }
+    }
+
+    size_t memory_usage() const { return disk_ ? disk_->memory_usage() : memory_.memory_usage(); }
+
+    private:
+    CompactKeyDirTable memory_;
+    std::unique_ptr<DiskKeyDirTable> disk_;
+};
+
+// the keydir proper, KeyDirTable stripes behind ShardedMap's locks
+using KeyDir = ShardedMap<std::string, KeyDirEntry, 64, std::hash<std::string>, KeyDirTable>;
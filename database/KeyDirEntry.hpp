@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "Compression.hpp"
+
+const uint64_t MAX_KEY_SIZE = UINT16_MAX;
+// the keydir keeps expiry in 32 bits, a later one can't be indexed
+const uint64_t MAX_EXPIRY = UINT32_MAX;
+
+struct KeyDirEntry {
+    uint64_t file_id;
+    uint64_t value_size;
+    uint64_t value_pos;
+    uint64_t timestamp;
+    uint64_t expiry = 0; // seconds since the epoch, 0 never expires
+    Codec codec = Codec::None; // value_size is the stored (compressed) size
+
+    bool expired(uint64_t now_seconds) const {
+        return expiry != 0 && expiry <= now_seconds;
+    }
+
+    bool operator==(const KeyDirEntry& other) const {
+        return file_id == other.file_id &&
+               value_size == other.value_size &&
+               value_pos == other.value_pos &&
+               timestamp == other.timestamp &&
+               expiry == other.expiry &&
+               codec == other.codec;
+    }
+};
+
+// A KeyDirEntry in 24 bytes: file_id, value_size and expiry are stored in
+// 32 bits, value_pos in 28 next to the 4 bit codec (datafiles are capped at
+// MAX_FILE_SIZE, expiry is in seconds)
+struct PackedKeyDirEntry {
+    static constexpr int VALUE_POS_BITS = 28;
+
+    // all 32 bit fields, so there is no padding to 8 byte alignment
+    uint32_t file_id;
+    uint32_t value_pos : VALUE_POS_BITS;
+    uint32_t codec : 32 - VALUE_POS_BITS;
+    uint32_t value_size;
+    uint32_t timestamp_lo;
+    uint32_t timestamp_hi;
+    uint32_t expiry;
+
+    // throws length_error for a field that doesn't fit
+    static PackedKeyDirEntry pack(const KeyDirEntry& entry) {
+        PackedKeyDirEntry packed;
+        packed.file_id = narrow(entry.file_id, "file_id");
+        packed.value_size = narrow(entry.value_size, "value_size");
+        if(entry.value_pos >= (uint64_t(1) << VALUE_POS_BITS)) {
+            throw std::length_error("KeyDir: value_pos does not fit in " + std::to_string(VALUE_POS_BITS) + " bits.");
+        }
+        packed.value_pos = static_cast<uint32_t>(entry.value_pos);
+        packed.codec = static_cast<uint32_t>(entry.codec);
+        packed.timestamp_lo = static_cast<uint32_t>(entry.timestamp);
+        packed.timestamp_hi = static_cast<uint32_t>(entry.timestamp >> 32);
+        packed.expiry = narrow(entry.expiry, "expiry");
+        return packed;
+    }
+
+    KeyDirEntry unpack() const {
+        uint64_t timestamp = (static_cast<uint64_t>(timestamp_hi) << 32) | timestamp_lo;
+        return KeyDirEntry{file_id, value_size, value_pos, timestamp, expiry, static_cast<Codec>(codec)};
+    }
+
+    static uint32_t narrow(uint64_t value, const char *field) {
+        if(value > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error(std::string("KeyDir: ") + field + " does not fit in 32 bits.");
+        }
+        return static_cast<uint32_t>(value);
+    }
+};
+static_assert(sizeof(PackedKeyDirEntry) == 24, "packed keydir entries should stay at 24 bytes");
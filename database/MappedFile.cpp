@@ -0,0 +1,48 @@
+#include "MappedFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::unique_ptr<MappedFile> MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if(::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    const char *data = nullptr;
+
+    // mmap refuses zero length, an empty file just maps to nothing
+    if(size > 0) {
+        void *addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(addr == MAP_FAILED) {
+            ::close(fd);
+            return nullptr;
+        }
+        data = static_cast<const char*>(addr);
+    }
+
+    // the mapping outlives the descriptor
+    ::close(fd);
+    return std::unique_ptr<MappedFile>(new MappedFile(data, size));
+}
+
+MappedFile::~MappedFile() {
+    if(data_ != nullptr) {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+void MappedFile::advise_sequential() const {
+    if(data_ != nullptr) {
+        ::madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+    }
+}
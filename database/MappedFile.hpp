@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Read-only mmap of a whole file, unmapped on destruction.
+class MappedFile {
+    public:
+    // nullptr if the file can't be opened or mapped
+    static std::unique_ptr<MappedFile> open(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    uint64_t size() const { return size_; }
+
+    // hint the kernel for a front-to-back scan
+    void advise_sequential() const;
+
+    private:
+    MappedFile(const char *data, uint64_t size) : data_(data), size_(size) {}
+
+    const char *data_;
+    uint64_t size_;
+};
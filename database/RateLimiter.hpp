@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Token bucket over bytes, shared by everything that draws from it. A caller
+// may take more than the bucket holds, the debt is paid off by sleeping, so
+// large records still get through at the configured rate. A rate of 0 means
+// unlimited, the rate can be changed at any time and wakes up waiters.
+class RateLimiter {
+    public:
+    explicit RateLimiter(uint64_t bytes_per_sec = 0) : rate_(bytes_per_sec) {}
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    void set_rate(uint64_t bytes_per_sec) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            refill();
+            rate_ = bytes_per_sec;
+            tokens_ = std::min(tokens_, burst());
+        }
+        cv_.notify_all();
+    }
+
+    uint64_t rate() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return rate_;
+    }
+
+    // blocks until bytes may pass
+    void acquire(uint64_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(rate_ == 0) {
+            return;
+        }
+
+        refill();
+        tokens_ -= static_cast<double>(bytes);
+
+        auto start = Clock::now();
+        while(tokens_ < 0 && rate_ != 0) {
+            // wake up now and then, the rate might have changed
+            auto debt = std::chrono::duration<double>(-tokens_ / rate_);
+            cv_.wait_for(lock, std::min<std::chrono::duration<double>>(debt, MAX_WAIT));
+            refill();
+        }
+
+        if(rate_ == 0) {
+            tokens_ = 0;
+        }
+        waited_us_ += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    }
+
+    // total time callers spent blocked
+    uint64_t waited_ms() const { return waited_us_.load() / 1000; }
+
+    private:
+    using Clock = std::chrono::steady_clock;
+
+    // at most a tenth of a second worth of bytes saved up
+    double burst() const { return rate_ / 10.0; }
+
+    void refill() {
+        auto now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+        last_refill_ = now;
+        tokens_ = std::min(tokens_ + elapsed * rate_, burst());
+    }
+
+    static constexpr std::chrono::milliseconds MAX_WAIT{100};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint64_t rate_;
+    double tokens_ = 0;
+    Clock::time_point last_refill_ = Clock::now();
+    std::atomic<uint64_t> waited_us_{0};
+};
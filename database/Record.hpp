@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "Compression.hpp"
+#include "crc.hpp"
+
+// Datafiles open with a header saying which checksum their records use:
+// magic "RCSK" (4) | version (1) | crc kind (1) | reserved (2)
+// Files written before the header existed start straight with a record,
+// they are version 0 and use CrcKind::Crc32.
+// Version 2 added batch markers, version 3 the expiry field and version 4
+// the codec (see below).
+const char DATAFILE_MAGIC[4] = {'R', 'C', 'S', 'K'};
+const uint8_t DATAFILE_VERSION = 4;
+const uint64_t DATAFILE_HEADER_SIZE = 8;
+
+struct DataFileHeader {
+    uint8_t version;
+    CrcKind crc_kind;
+    uint64_t size; // where the first record starts
+};
+
+inline void write_datafile_header(char *ptr, CrcKind crc_kind) {
+    std::memcpy(ptr, DATAFILE_MAGIC, sizeof(DATAFILE_MAGIC));
+    ptr[4] = static_cast<char>(DATAFILE_VERSION);
+    ptr[5] = static_cast<char>(crc_kind);
+    ptr[6] = 0;
+    ptr[7] = 0;
+}
+
+// available is how many bytes ptr holds, anything short of a full header is legacy
+inline DataFileHeader read_datafile_header(const char *ptr, uint64_t available) {
+    if(available < DATAFILE_HEADER_SIZE || std::memcmp(ptr, DATAFILE_MAGIC, sizeof(DATAFILE_MAGIC)) != 0) {
+        return DataFileHeader{0, CrcKind::Crc32, 0};
+    }
+    return DataFileHeader{
+        static_cast<uint8_t>(ptr[4]),
+        static_cast<CrcKind>(ptr[5]),
+        DATAFILE_HEADER_SIZE
+    };
+}
+
+// On-disk record layout, the crc covers everything after itself:
+// crc (4) | timestamp (8) | expiry (8) | key_size (8) | value_size (8) | codec (1) | key | value
+// Files before version 3 have no expiry field, before version 4 no codec.
+// expiry is in seconds since the epoch, 0 for keys that never expire.
+// value_size is what is stored, for a compressed value that's the codec's
+// output (see Compression.hpp).
+struct RecordHeader {
+    uint32_t crc;
+    uint64_t timestamp;
+    uint64_t expiry;
+    uint64_t key_size;
+    uint64_t value_size;
+    Codec codec;
+};
+
+const uint64_t RECORD_HEADER_SIZE = sizeof(uint32_t) + 4 * sizeof(uint64_t) + sizeof(Codec);
+const uint64_t V3_RECORD_HEADER_SIZE = sizeof(uint32_t) + 4 * sizeof(uint64_t);
+const uint64_t V2_RECORD_HEADER_SIZE = sizeof(uint32_t) + 3 * sizeof(uint64_t);
+
+// a delete is written as a record that expired at the epoch
+const uint64_t TOMBSTONE_EXPIRY = 1;
+
+inline uint64_t record_header_size(uint8_t version) {
+    if(version >= 4) {
+        return RECORD_HEADER_SIZE;
+    }
+    return version == 3 ? V3_RECORD_HEADER_SIZE : V2_RECORD_HEADER_SIZE;
+}
+
+inline RecordHeader read_record_header(const char *ptr, uint8_t version) {
+    RecordHeader header;
+    std::memcpy(&header.crc, ptr, sizeof(header.crc));
+    ptr += sizeof(header.crc);
+    std::memcpy(&header.timestamp, ptr, sizeof(header.timestamp));
+    ptr += sizeof(header.timestamp);
+    header.expiry = 0;
+    if(version >= 3) {
+        std::memcpy(&header.expiry, ptr, sizeof(header.expiry));
+        ptr += sizeof(header.expiry);
+    }
+    std::memcpy(&header.key_size, ptr, sizeof(header.key_size));
+    ptr += sizeof(header.key_size);
+    std::memcpy(&header.value_size, ptr, sizeof(header.value_size));
+    ptr += sizeof(header.value_size);
+    header.codec = version >= 4 ? static_cast<Codec>(*ptr) : Codec::None;
+    return header;
+}
+
+// A batch is BATCH_BEGIN marker | records | BATCH_COMMIT marker, recovery
+// only applies its records once the commit marker is there. Markers are a
+// bare record header, key_size holds the marker (never a real key size) and
+// value_size the number of records in the batch.
+const uint64_t BATCH_BEGIN = UINT64_MAX;
+const uint64_t BATCH_COMMIT = UINT64_MAX - 1;
+
+inline bool is_batch_marker(const RecordHeader& header) {
+    return header.key_size == BATCH_BEGIN || header.key_size == BATCH_COMMIT;
+}
+
+// always in the current layout
+inline void write_batch_marker(char *ptr, CrcKind crc_kind, uint64_t marker, uint64_t timestamp, uint64_t count) {
+    const uint64_t expiry = 0;
+    char *body = ptr + sizeof(uint32_t);
+    std::memcpy(body, &timestamp, sizeof(timestamp));
+    std::memcpy(body + sizeof(timestamp), &expiry, sizeof(expiry));
+    std::memcpy(body + sizeof(timestamp) + sizeof(expiry), &marker, sizeof(marker));
+    std::memcpy(body + sizeof(timestamp) + sizeof(expiry) + sizeof(marker), &count, sizeof(count));
+    body[sizeof(timestamp) + sizeof(expiry) + sizeof(marker) + sizeof(count)] = static_cast<char>(Codec::None);
+
+    uint32_t crc = calculate_crc(crc_kind, body, RECORD_HEADER_SIZE - sizeof(crc));
+    std::memcpy(ptr, &crc, sizeof(crc));
+}
+
+// gives every record and marker of records (size bytes, current layout) a
+// new timestamp and crc
+inline void restamp_records(char *records, uint64_t size, CrcKind crc_kind, uint64_t timestamp) {
+    uint64_t pos = 0;
+    while(pos < size) {
+        char *record = records + pos;
+        RecordHeader header = read_record_header(record, DATAFILE_VERSION);
+        uint64_t record_size = RECORD_HEADER_SIZE;
+        if(!is_batch_marker(header)) {
+            record_size += header.key_size + header.value_size;
+        }
+        std::memcpy(record + sizeof(header.crc), &timestamp, sizeof(timestamp));
+        uint32_t crc = calculate_crc(crc_kind, record + sizeof(header.crc), record_size - sizeof(header.crc));
+        std::memcpy(record, &crc, sizeof(crc));
+        pos += record_size;
+    }
+}
+
+// size of the record (or marker) at ptr, or 0 if it runs past available or fails its crc
+inline uint64_t validate_record(const char *ptr, uint64_t available, CrcKind crc_kind, uint8_t version) {
+    uint64_t header_size = record_header_size(version);
+    if(available < header_size) {
+        return 0;
+    }
+
+    RecordHeader header = read_record_header(ptr, version);
+    uint64_t body_size = available - header_size;
+    uint64_t record_size = header_size;
+    if(!is_batch_marker(header)) {
+        if(header.key_size > body_size || header.value_size > body_size - header.key_size) {
+            return 0;
+        }
+        record_size += header.key_size + header.value_size;
+    }
+
+    uint32_t crc = calculate_crc(crc_kind, ptr + sizeof(header.crc), record_size - sizeof(header.crc));
+    return crc == header.crc ? record_size : 0;
+}
@@ -1,88 +1,521 @@
 #include "Rocask.hpp"
 
-Rocask::Rocask(int id) {
+#include <fcntl.h>
+#include <unistd.h>
+
+Rocask::Rocask(int id, RocaskOptions options) {
     db_id = id;
+    _options = options;
+    if(!codec_available(_options.compression)) {
+        throw std::invalid_argument(std::string("Codec ") + codec_name(_options.compression) + " is not available in this build.");
+    }
+    if(_options.cache_capacity > 0) {
+        _cache = std::make_unique<ValueCache>(_options.cache_capacity);
+    }
+    if(_options.ordered_index) {
+        _key_index = std::make_unique<SkipList<std::string>>();
+    }
+    _compaction_limiter.set_rate(_options.compaction_rate_limit);
+    if(_options.io_uring) {
+        _ring = IoRing::create(_options.io_uring_entries);
+        if(_ring) {
+            _handles.set_ring(_ring);
+            _writer.set_ring(_ring);
+        } else {
+            std::cerr << "Warning: " << "io_uring is not available, using pread/pwrite" << std::endl;
+        }
+    }
     datafiles_folder = "datafiles/" + std::to_string(db_id) + "/";
     
-    try {
-        fs::create_directories(datafiles_folder);
-    } catch(const fs::filesystem_error& e) {
-        std::cerr << "Error: " << "could not make folder " << datafiles_folder << std::endl;
-        exit(1);
+    hintfiles_folder = "hintfiles/" + std::to_string(db_id) + "/";
+
+    for(const std::string& folder : {datafiles_folder, hintfiles_folder}) {
+        try {
+            fs::create_directories(folder);
+        } catch(const fs::filesystem_error& e) {
+            std::cerr << "Error: " << "could not make folder " << folder << std::endl;
+            exit(1);
+        }
+    }
+
+    if(_options.disk_keydir) {
+        // scratch like the in-memory keydir, load_datafiles fills it again
+        keydir_folder = "keydir/" + std::to_string(db_id) + "/";
+        try {
+            fs::remove_all(keydir_folder);
+            fs::create_directories(keydir_folder);
+        } catch(const fs::filesystem_error& e) {
+            std::cerr << "Error: " << "could not make folder " << keydir_folder << std::endl;
+            exit(1);
+        }
+        _keydir.for_each_table([this](size_t stripe, KeyDirTable& table) {
+            table.use_disk(keydir_folder + std::to_string(stripe));
+        });
     }
-    
-    std::string _active_path = datafiles_folder + std::to_string(active_file_id.load());
 
-    // create file, add to _files and close.
-    std::ofstream tmp(_active_path);
-    tmp.close();
+    // rebuild _keydir from whatever is already on disk
+    load_datafiles();
+
+    // never append to a file from a previous run, its tail may be torn
+    if(_datafiles.size() > 0 || file_index.load() > 0) {
+        active_file_id.store(file_index.fetch_add(1) + 1);
+    }
+    std::string _active_path = datafiles_folder + std::to_string(active_file_id.load());
 
     // any writes to _datafiles probably will use this
-    _datafiles.put(active_file_id.load(), _active_path);
+    add_log_file(active_file_id.load());
+    _writer.open(active_file_id.load(), _active_path, _options.crc_kind);
+    _datafiles.put(active_file_id.load(), DataFile{_active_path, _options.crc_kind, DATAFILE_VERSION, false, true});
+    account_append(active_file_id.load(), _writer.offset(), UINT64_MAX);
+    total_disk_used += _writer.offset();
 
     _compaction_thread = std::thread(&Rocask::compaction_worker, this);
+    _commit_thread = std::thread(&Rocask::commit_worker, this);
+
+    if(_options.sync_policy == SyncPolicy::Interval) {
+        _sync_thread = std::thread(&Rocask::sync_worker, this);
+    }
 }
 
 Rocask::~Rocask() {
+    // async writes still queued get committed first
+    {
+        std::lock_guard<std::mutex> commit_lock(_commit_mutex);
+        _commit_shutdown = true;
+    }
+    _commit_cv.notify_all();
+    _commit_thread.join();
+
+    // reads in flight call back into us
+    if(_ring) {
+        _ring->drain();
+    }
+
     std::unique_lock<std::mutex> lock(_compaction_mutex);
     _shutdown = true;
     lock.unlock();
 
+    // a throttled merge would hold up the shutdown
+    _compaction_limiter.set_rate(0);
     _compaction_cv.notify_one();
     _compaction_thread.join();
+
+    if(_sync_thread.joinable()) {
+        std::unique_lock<std::mutex> sync_lock(_sync_mutex);
+        _sync_shutdown = true;
+        sync_lock.unlock();
+
+        _sync_cv.notify_one();
+        _sync_thread.join();
+    }
+
+    if(_options.sync_policy != SyncPolicy::None) {
+        std::lock_guard<std::mutex> write_lock(_write_mutex);
+        _writer.sync();
+    }
 }
 
-void Rocask::process_datafile(const std::string& path, const uint64_t& file_id) {
-    std::ifstream fin(path, std::ios::binary);
-    uint64_t cur_value_pos = 0;
+std::string Rocask::hintfile_path(uint64_t file_id) const {
+    return hintfiles_folder + std::to_string(file_id) + ".hint";
+}
 
-    // crc - 4 bytes
-    uint32_t crc;
-    while(fin.read(reinterpret_cast<char*>(&crc), sizeof(crc))) {
-        // timestamp - 4 bytes
-        uint64_t timestamp;
-        fin.read(reinterpret_cast<char*>(&timestamp), sizeof(timestamp));
+void Rocask::load_datafiles() {
+    auto start = std::chrono::steady_clock::now();
 
-        // key_size - 8 bytes 
-        uint64_t key_size;
-        fin.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
-
-        // value_size - 8 bytes 
-        uint64_t value_size;
-        fin.read(reinterpret_cast<char*>(&value_size), sizeof(value_size));             
-
-        // key - key_size bytes 
-        std::vector<char> key_bytes(key_size);
-        fin.read(reinterpret_cast<char*>(key_bytes.data()), key_size);
-        std::string key(key_bytes.data(), key_size);
-        
-        // adjust current value position
-        cur_value_pos += sizeof(crc) + sizeof(timestamp) + sizeof(key_size) + sizeof(value_size) + key_size;
-    
-        // build and store entry
-        KeyDirEntry entry = {
-            file_id,
-            value_size,
-            cur_value_pos,
-            timestamp
+    std::vector<uint64_t> file_ids;
+    for(const auto& dir_entry : fs::directory_iterator(datafiles_folder)) {
+        const std::string name = dir_entry.path().filename().string();
+        if(!dir_entry.is_regular_file() || name.empty() ||
+           !std::all_of(name.begin(), name.end(), ::isdigit)) {
+            continue;
+        }
+        file_ids.push_back(std::stoull(name));
+    }
+    std::sort(file_ids.begin(), file_ids.end());
+
+    size_t num_workers = std::min<size_t>(
+        file_ids.size(), 
+        std::max(1u, std::thread::hardware_concurrency())
+    );
+    // every file of a group is parsed into its own fragment in parallel, then
+    // the fragments are merged on this thread. A disk keydir is there because
+    // the keys don't fit in memory, so its groups are one file per worker
+    // rather than every file at once
+    size_t group_size = _options.disk_keydir ? num_workers : file_ids.size();
+    std::vector<std::optional<DataFileHeader>> headers(file_ids.size());
+    std::vector<uint64_t> min_timestamps(file_ids.size(), UINT64_MAX);
+    for(size_t group_start = 0; group_start < file_ids.size(); group_start += group_size) {
+        size_t group_end = std::min(file_ids.size(), group_start + group_size);
+        std::vector<KeyDirFragment> fragments(group_end - group_start);
+        std::atomic<size_t> next_file{group_start};
+        auto recover = [&] {
+            size_t i;
+            while((i = next_file.fetch_add(1)) < group_end) {
+                uint64_t file_id = file_ids[i];
+                KeyDirFragment& fragment = fragments[i - group_start];
+                std::string hint_path = hintfile_path(file_id);
+                std::string path = datafiles_folder + std::to_string(file_id);
+                if(fs::exists(hint_path)) {
+                    headers[i] = datafile_header(path);
+                    if(headers[i].has_value()) {
+                        process_hintfile(hint_path, headers[i]->version, fragment);
+                    }
+                } else {
+                    headers[i] = process_datafile(path, file_id, fragment);
+                }
+            }
         };
-        _keydir.put(key, entry);
-        // value - ignore value_size bytes, adjust value_pos for next iteration
-        fin.ignore(value_size);
-        cur_value_pos += value_size;
+
+        std::vector<std::thread> workers;
+        for(size_t i = group_start + 1; i < std::min(group_end, group_start + num_workers); i++) {
+            workers.emplace_back(recover);
+        }
+        recover();
+        for(std::thread& worker : workers) {
+            worker.join();
+        }
+
+        uint64_t group_keys = 0;
+        for(size_t i = group_start; i < group_end; i++) {
+            KeyDirFragment& fragment = fragments[i - group_start];
+            group_keys += fragment.size();
+            for(const auto& [key, entry] : fragment) {
+                merge_entry(key, entry);
+                min_timestamps[i] = std::min(min_timestamps[i], entry.timestamp);
+                _last_timestamp = std::max(_last_timestamp, entry.timestamp);
+            }
+            KeyDirFragment().swap(fragment);
+        }
+        recovery_peak_keys = std::max(recovery_peak_keys, group_keys);
+    }
+
+    load_log_files(file_ids);
+
+    std::vector<uint64_t> removed;
+    for(size_t i = 0; i < file_ids.size(); i++) {
+        std::string path = datafiles_folder + std::to_string(file_ids[i]);
+        file_index.store(file_ids[i]);
+
+        // unreadable, leave it alone rather than lose it
+        if(!headers[i].has_value()) {
+            continue;
+        }
+
+        // every restart opens a fresh active file, don't let the empty ones pile up
+        // (header only, or a batch that never committed was all it held)
+        uint64_t file_size = fs::file_size(path);
+        if(file_size <= DATAFILE_HEADER_SIZE) {
+            fs::remove(path);
+            fs::remove(hintfile_path(file_ids[i]));
+            removed.push_back(file_ids[i]);
+            continue;
+        }
+
+        bool log = std::binary_search(_log_files.begin(), _log_files.end(), file_ids[i]);
+        _datafiles.put(file_ids[i], DataFile{path, headers[i]->crc_kind, headers[i]->version, true, log});
+        total_disk_used += file_size;
+
+        // the older records of a key in one file never matter, the latest
+        // ones are enough for min_timestamp
+        FileUsage& usage = _file_usage[file_ids[i]];
+        usage.total_bytes = file_size;
+        usage.min_timestamp = min_timestamps[i];
+        usage.header_size = record_header_size(headers[i]->version);
+    }
+
+    // the empty files held nothing to replicate, skipping them loses nothing.
+    // Anything before the oldest file still around is gone either way
+    _log_files.erase(std::remove_if(_log_files.begin(), _log_files.end(), [&removed](uint64_t file_id) {
+        return std::find(removed.begin(), removed.end(), file_id) != removed.end();
+    }), _log_files.end());
+    auto first_kept = std::find_if(_log_files.begin(), _log_files.end(), [this](uint64_t file_id) {
+        return _datafiles.contains(file_id);
+    });
+    _log_files.erase(_log_files.begin(), first_kept);
+    save_log_files();
+
+    // leftovers of a merge that never finished
+    for(const auto& dir_entry : fs::directory_iterator(hintfiles_folder)) {
+        if(dir_entry.path().extension() == ".tmp") {
+            fs::remove(dir_entry.path());
+        }
+    }
+
+    // tombstones and expired records were merged so they'd shadow older
+    // values of their key, now they go
+    uint64_t now = get_seconds();
+    std::vector<std::string> dead_keys;
+    _keydir.for_each([&](const std::string& key, const KeyDirEntry& entry) {
+        if(entry.expired(now)) {
+            dead_keys.push_back(key);
+        } else {
+            actual_data_size += RECORD_HEADER_SIZE + key.size() + entry.value_size;
+            account_live(key, entry);
+        }
+    });
+    for(const std::string& key : dead_keys) {
+        _keydir.remove(key);
+    }
+
+    if(_key_index) {
+        std::vector<std::string> keys;
+        keys.reserve(_keydir.size());
+        _keydir.for_each([&keys](const std::string& key, const KeyDirEntry&) {
+            keys.push_back(key);
+        });
+        std::sort(keys.begin(), keys.end());
+        _key_index->assign_sorted(keys);
+    }
+
+    recovery_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start
+    ).count();
+}
+
+// file_ids are the datafiles on disk, sorted
+void Rocask::load_log_files(const std::vector<uint64_t>& file_ids) {
+    std::ifstream fin(datafiles_folder + "log");
+    if(!fin) {
+        // a folder from before replication, whatever has no hint file came
+        // from the writer
+        for(uint64_t file_id : file_ids) {
+            if(!fs::exists(hintfile_path(file_id))) {
+                _log_files.push_back(file_id);
+            }
+        }
+        return;
+    }
+
+    uint64_t file_id;
+    while(fin >> file_id) {
+        _log_files.push_back(file_id);
+    }
+}
+
+// a new writer file, recorded before it's created so the log never has a
+// file it doesn't know about
+void Rocask::add_log_file(uint64_t file_id) {
+    std::string line = std::to_string(file_id) + "\n";
+    int fd = ::open((datafiles_folder + "log").c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if(fd < 0 || ::write(fd, line.data(), line.size()) != static_cast<ssize_t>(line.size()) || ::fdatasync(fd) != 0) {
+        if(fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("Could not add datafile " + std::to_string(file_id) + " to the replication log.");
+    }
+    ::close(fd);
+    _log_files.push_back(file_id);
+}
+
+void Rocask::save_log_files() {
+    std::string path = datafiles_folder + "log";
+    {
+        std::ofstream fout(path + ".tmp", std::ios::trunc);
+        for(uint64_t file_id : _log_files) {
+            fout << file_id << "\n";
+        }
+    }
+    fs::rename(path + ".tmp", path);
+}
+
+// files are loaded in id order, but compaction output gets a newer id than
+// the active file it ran beside, so the timestamp decides
+void Rocask::merge_entry(const std::string& key, const KeyDirEntry& entry) {
+    _keydir.put_if(key, entry, [&entry](const KeyDirEntry& current) {
+        return current.timestamp <= entry.timestamp;
+    });
+}
+
+void Rocask::process_hintfile(const std::string& path, uint8_t version, KeyDirFragment& fragment) {
+    std::unique_ptr<MappedFile> hintfile = MappedFile::open(path);
+    if(!hintfile) {
+        std::cerr << "Error: " << "could not map hint file " << path << std::endl;
+        return;
+    }
+    hintfile->advise_sequential();
+
+    const char *ptr = hintfile->data();
+    const char *end = ptr + hintfile->size();
+
+    // key_size | key | file_id | value_size | value_pos | timestamp | expiry | codec
+    // hints sit next to a datafile of the same version, expiry came with
+    // version 3 and codec with version 4
+    const uint64_t fixed_size = (version >= 3 ? 6 : 5) * sizeof(uint64_t) + (version >= 4 ? sizeof(Codec) : 0);
+    while(static_cast<uint64_t>(end - ptr) >= fixed_size) {
+        uint64_t key_size;
+        std::memcpy(&key_size, ptr, sizeof(key_size));
+        if(key_size > static_cast<uint64_t>(end - ptr) - fixed_size) {
+            break;
+        }
+        std::string key(ptr + sizeof(key_size), key_size);
+        ptr += sizeof(key_size) + key_size;
+
+        KeyDirEntry entry;
+        std::memcpy(&entry.file_id, ptr, sizeof(entry.file_id));
+        ptr += sizeof(entry.file_id);
+        std::memcpy(&entry.value_size, ptr, sizeof(entry.value_size));
+        ptr += sizeof(entry.value_size);
+        std::memcpy(&entry.value_pos, ptr, sizeof(entry.value_pos));
+        ptr += sizeof(entry.value_pos);
+        std::memcpy(&entry.timestamp, ptr, sizeof(entry.timestamp));
+        ptr += sizeof(entry.timestamp);
+        entry.expiry = 0;
+        if(version >= 3) {
+            std::memcpy(&entry.expiry, ptr, sizeof(entry.expiry));
+            ptr += sizeof(entry.expiry);
+        }
+        entry.codec = Codec::None;
+        if(version >= 4) {
+            entry.codec = static_cast<Codec>(*ptr);
+            ptr += sizeof(entry.codec);
+        }
+
+        if(entry.expiry > MAX_EXPIRY) {
+            std::cerr << "Warning: " << "skipping a hint with expiry " << entry.expiry 
+                      << " in " << path << std::endl;
+            continue;
+        }
+        fragment.insert_or_assign(std::move(key), entry);
+    }
+}
+
+std::optional<DataFileHeader> Rocask::datafile_header(const std::string& path) {
+    char header_bytes[DATAFILE_HEADER_SIZE];
+    std::ifstream fin(path, std::ios::binary);
+    fin.read(header_bytes, sizeof(header_bytes));
+
+    DataFileHeader header = read_datafile_header(header_bytes, static_cast<uint64_t>(fin.gcount()));
+    if(header.version > DATAFILE_VERSION || header.crc_kind > CrcKind::Crc32c) {
+        std::cerr << "Error: " << path << " has datafile version " << int(header.version) 
+                  << ", this build reads up to " << int(DATAFILE_VERSION) << std::endl;
+        return std::nullopt;
+    }
+    return header;
+}
+
+std::optional<DataFileHeader> Rocask::process_datafile(const std::string& path, uint64_t file_id, KeyDirFragment& fragment) {
+    uint64_t valid_size = 0;
+    uint64_t file_size = 0;
+    DataFileHeader header;
+    {
+        std::unique_ptr<MappedFile> datafile = MappedFile::open(path);
+        if(!datafile) {
+            std::cerr << "Error: " << "could not map datafile " << path << std::endl;
+            return std::nullopt;
+        }
+        datafile->advise_sequential();
+        file_size = datafile->size();
+        const char *base = datafile->data();
+
+        header = read_datafile_header(base, file_size);
+        if(header.version > DATAFILE_VERSION || header.crc_kind > CrcKind::Crc32c) {
+            std::cerr << "Error: " << path << " has datafile version " << int(header.version) 
+                      << ", this build reads up to " << int(DATAFILE_VERSION) << std::endl;
+            return std::nullopt;
+        }
+        valid_size = header.size;
+        uint64_t header_size = record_header_size(header.version);
+
+        // records of an open batch wait here until its commit marker shows up
+        bool in_batch = false;
+        uint64_t batch_start = 0;
+        uint64_t batch_records = 0;
+        std::vector<std::pair<std::string, KeyDirEntry>> batch;
+
+        while(valid_size < file_size) {
+            const char *record = base + valid_size;
+            uint64_t record_size = validate_record(record, file_size - valid_size, header.crc_kind, header.version);
+            if(record_size == 0) {
+                break;
+            }
+
+            RecordHeader record_header = read_record_header(record, header.version);
+            if(record_header.key_size == BATCH_BEGIN) {
+                if(in_batch) {
+                    break;
+                }
+                in_batch = true;
+                batch_start = valid_size;
+                batch_records = 0;
+                batch.clear();
+                valid_size += record_size;
+                continue;
+            }
+            if(record_header.key_size == BATCH_COMMIT) {
+                if(!in_batch || record_header.value_size != batch_records) {
+                    break;
+                }
+                for(auto& [key, entry] : batch) {
+                    fragment.insert_or_assign(std::move(key), entry);
+                }
+                in_batch = false;
+                valid_size += record_size;
+                continue;
+            }
+
+            // tombstones go in too, they have to win over older values
+            KeyDirEntry entry = {
+                file_id,
+                record_header.value_size,
+                valid_size + header_size + record_header.key_size,
+                record_header.timestamp,
+                record_header.expiry,
+                record_header.codec
+            };
+            std::string key(record + header_size, record_header.key_size);
+            batch_records += in_batch;
+            // the write that appended it failed before the keydir took it,
+            // it never happened
+            if(entry.expiry > MAX_EXPIRY) {
+                std::cerr << "Warning: " << "skipping a record with expiry " << entry.expiry 
+                          << " in " << path << std::endl;
+                valid_size += record_size;
+                continue;
+            }
+            if(in_batch) {
+                batch.emplace_back(std::move(key), entry);
+            } else {
+                // later records in the same file always win
+                fragment.insert_or_assign(std::move(key), entry);
+            }
+
+            valid_size += record_size;
+        }
+
+        // a batch without its commit marker never happened, cut from its start
+        if(in_batch) {
+            valid_size = batch_start;
+        }
     }
+
+    // torn or corrupt tail, drop it so the next scan (and appenders) see clean records
+    if(valid_size < file_size) {
+        std::cerr << "Warning: " << "truncating " << (file_size - valid_size) 
+                  << " bytes of invalid records from " << path << std::endl;
+        std::error_code ec;
+        fs::resize_file(path, valid_size, ec);
+        if(ec) {
+            std::cerr << "Error: " << "could not truncate " << path << ": " << ec.message() << std::endl;
+        }
+    }
+    return header;
 }
 
 void Rocask::build_data_buffer(
     char *buffer_ptr, 
     uint64_t timestamp,
+    uint64_t expiry,
     uint64_t key_size,
     uint64_t value_size,
-    const std::string& key,
-    const std::string& value
+    Codec codec,
+    std::string_view key,
+    std::string_view value
 ) {
     std::memcpy(buffer_ptr, &timestamp, sizeof(timestamp));
     buffer_ptr += sizeof(timestamp);
+
+    std::memcpy(buffer_ptr, &expiry, sizeof(expiry));
+    buffer_ptr += sizeof(expiry);
     
     std::memcpy(buffer_ptr, &key_size, sizeof(key_size));
     buffer_ptr += sizeof(key_size);
@@ -90,6 +523,9 @@ void Rocask::build_data_buffer(
     std::memcpy(buffer_ptr, &value_size, sizeof(value_size));
     buffer_ptr += sizeof(value_size);
 
+    *buffer_ptr = static_cast<char>(codec);
+    buffer_ptr += sizeof(codec);
+
     std::memcpy(buffer_ptr, key.data(), key_size);
     buffer_ptr += key_size;
 
@@ -97,279 +533,1878 @@ void Rocask::build_data_buffer(
     buffer_ptr += value_size;
 }
 
-void Rocask::raw_write(const std::string& key, const std::string& value) {
+void Rocask::raw_write(const std::string& key, const std::string& value, uint64_t ttl_seconds) {
+    check_writable();
+    // reject before anything reaches the log, the keydir couldn't index it
+    if(key.size() > MAX_KEY_SIZE) {
+        throw std::invalid_argument("Key is larger than " + std::to_string(MAX_KEY_SIZE) + " bytes.");
+    }
+
+    PendingWrite pending;
+    pending.timestamp = get_timestamp();
+    encode_record(pending, key, value, expiry_after(ttl_seconds));
+    submit_write(pending);
+}
+
+// 0 for no ttl. Throws invalid_argument for a ttl past MAX_EXPIRY, checked
+// before adding so it can't wrap (a wrap to TOMBSTONE_EXPIRY would be a delete)
+uint64_t Rocask::expiry_after(uint64_t ttl_seconds) {
+    if(ttl_seconds == 0) {
+        return 0;
+    }
+    uint64_t now = get_seconds();
+    if(now >= MAX_EXPIRY || ttl_seconds > MAX_EXPIRY - now) {
+        throw std::invalid_argument("TTL of " + std::to_string(ttl_seconds) + " seconds expires too far in the future.");
+    }
+    return now + ttl_seconds;
+}
+
+bool Rocask::raw_remove(const std::string& key) {
+    check_writable();
+    std::optional<KeyDirEntry> found = _keydir.find(key);
+    if(!found.has_value() || found->expired(get_seconds())) {
+        return false;
+    }
+
+    PendingWrite pending;
+    pending.timestamp = get_timestamp();
+    encode_record(pending, key, std::string(), TOMBSTONE_EXPIRY);
+    submit_write(pending);
+    return true;
+}
+
+void Rocask::raw_write_batch(const std::vector<std::pair<std::string, std::string>>& items) {
+    check_writable();
+    if(items.empty()) {
+        return;
+    }
+    uint64_t batch_size = 2 * RECORD_HEADER_SIZE;
+    for(const auto& [key, value] : items) {
+        if(key.size() > MAX_KEY_SIZE) {
+            throw std::invalid_argument("Key is larger than " + std::to_string(MAX_KEY_SIZE) + " bytes.");
+        }
+        if(value.size() > UINT32_MAX) {
+            throw std::invalid_argument("Value is larger than " + std::to_string(UINT32_MAX) + " bytes.");
+        }
+        batch_size += RECORD_HEADER_SIZE + key.size() + value.size();
+    }
+    // the batch lands in one append, possibly alone in a fresh file. Past
+    // what the keydir's packed value_pos addresses, its later entries could
+    // never be indexed, so it's refused before anything reaches the log
+    if(DATAFILE_HEADER_SIZE + batch_size > (uint64_t(1) << PackedKeyDirEntry::VALUE_POS_BITS)) {
+        throw std::invalid_argument("Batch of " + std::to_string(batch_size) + " bytes is too large for one datafile.");
+    }
+
+    // one timestamp and one buffer for the whole batch
+    PendingWrite pending;
+    pending.timestamp = get_timestamp();
+    pending.atomic = true;
+
+    pending.record.reserve(batch_size);
+    pending.entries.reserve(items.size());
+
+    pending.record.resize(RECORD_HEADER_SIZE);
+    write_batch_marker(pending.record.data(), _options.crc_kind, BATCH_BEGIN, pending.timestamp, items.size());
+
+    for(const auto& [key, value] : items) {
+        encode_record(pending, key, value, 0);
+    }
+
+    size_t commit_pos = pending.record.size();
+    pending.record.resize(commit_pos + RECORD_HEADER_SIZE);
+    write_batch_marker(pending.record.data() + commit_pos, _options.crc_kind, BATCH_COMMIT, pending.timestamp, items.size());
+
+    submit_write(pending);
+}
+
+// appends one record to pending.record
+void Rocask::encode_record(PendingWrite& pending, const std::string& key, const std::string& value, uint64_t expiry) {
+    // compressed here, before the record ever gets near the write lock
+    std::string compressed;
+    Codec codec = compress_value(value, compressed);
+    std::string_view stored = codec == Codec::None ? std::string_view(value) : std::string_view(compressed);
+
+    encode_stored(pending, key, stored, codec, expiry);
+}
+
+// same with the value already in its stored form
+void Rocask::encode_stored(PendingWrite& pending, const std::string& key, std::string_view stored, Codec codec, uint64_t expiry) {
+    // replicated records come here without going through expiry_after
+    if(expiry > MAX_EXPIRY) {
+        throw std::invalid_argument("Expiry " + std::to_string(expiry) + " does not fit in the keydir.");
+    }
+    if(stored.size() > UINT32_MAX) {
+        throw std::invalid_argument("Value is larger than " + std::to_string(UINT32_MAX) + " bytes.");
+    }
+
     // get timestamp, key_size, value_size
-    uint64_t timestamp = get_timestamp();    
+    uint64_t timestamp = pending.timestamp;
     uint64_t key_size = static_cast<uint64_t>(key.size());
-    uint64_t value_size = static_cast<uint64_t>(value.size());
+    uint64_t value_size = static_cast<uint64_t>(stored.size());
 
     // before_value_size
-    uint64_t before_value_size = sizeof(timestamp) + sizeof(key_size) + sizeof(value_size) + key_size;
+    uint64_t before_value_size = sizeof(timestamp) + sizeof(expiry) + sizeof(key_size) + sizeof(value_size) + sizeof(codec) + key_size;
     uint64_t buffer_size = before_value_size + value_size; 
     
-    std::vector<char> buffer(buffer_size);
+    // crc goes in front of the rest so the record is a single iovec
+    uint32_t crc;
+    uint64_t record_pos = pending.record.size();
+    pending.record.resize(record_pos + sizeof(crc) + buffer_size);
+    char *record = pending.record.data() + record_pos;
+
     build_data_buffer(
-        buffer.data(),
+        record + sizeof(crc),
         timestamp, 
+        expiry,
         key_size,
         value_size,
+        codec,
         key,
-        value
+        stored
     );
 
-    uint32_t crc = calculate_crc(buffer.data(), buffer_size);
-    char *crc_ptr = reinterpret_cast<char*>(&crc);
+    crc = calculate_crc(_options.crc_kind, record + sizeof(crc), buffer_size);
+    std::memcpy(record, &crc, sizeof(crc));
 
-    std::string _active_path = datafiles_folder + std::to_string(active_file_id.load());
-    uint64_t file_size = fs::file_size(_active_path);
-    uint64_t new_file_size = file_size + static_cast<uint64_t>(sizeof(crc)) + buffer_size;
-    if(new_file_size > MAX_FILE_SIZE) {
-        _datafiles.put(active_file_id.load(), _active_path);
+    pending.entries.push_back({
+        &key,
+        value_size,
+        record_pos + sizeof(crc) + before_value_size,
+        sizeof(crc) + buffer_size,
+        expiry,
+        codec
+    });
+}
 
-        file_index.fetch_add(1);
-        active_file_id.store(file_index.load());
-        _active_path = datafiles_folder + std::to_string(active_file_id.load());
+Codec Rocask::compress_value(std::string_view value, std::string& output) {
+    if(_options.compression == Codec::None || value.empty() || value.size() < _options.compression_min_size) {
+        return Codec::None;
+    }
 
-        _datafiles.put(active_file_id.load(), _active_path);
+    bool compressed = compress(_options.compression, value, output);
+    compression_input_bytes += value.size();
+    compression_output_bytes += compressed ? output.size() : value.size();
+    return compressed ? _options.compression : Codec::None;
+}
 
-        trigger_compaction();
+std::string Rocask::decode_value(const KeyDirEntry& entry, std::string_view stored) {
+    if(entry.codec == Codec::None) {
+        return std::string(stored);
     }
+    std::string value;
+    decompress(entry.codec, stored, value);
+    return value;
+}
 
-    // binary, at end, append
-    std::ofstream file(_active_path, std::ios::binary | std::ios::ate | std::ios::app);
-    uint64_t value_pos = static_cast<uint64_t>(file.tellp()) + sizeof(crc) + before_value_size;
-    file.write(crc_ptr, sizeof(crc));
-    file.write(buffer.data(), buffer_size);
-    file.flush();
-
-    // update in memory hashmap (keydir)
-    KeyDirEntry entry = {
-        active_file_id.load(),
-        value_size,
-        value_pos,
-        timestamp
-    };
+void Rocask::submit_write(PendingWrite& pending) {
+    std::unique_lock<std::mutex> lock(_commit_mutex);
+    _commit_queue.push_back(&pending);
 
-    std::optional<KeyDirEntry> previous_entry = _keydir.put(key, entry);
-    uint64_t memory_used = sizeof(crc) + buffer_size;
-    total_disk_used += memory_used;
+    while(!pending.done) {
+        if(_commit_leader) {
+            _commit_cv.wait(lock);
+            continue;
+        }
+        lead_commits(lock);
+    }
 
-    if(previous_entry.has_value()) {
-        actual_data_size += (value_size - previous_entry->value_size);
-    } else {
-        actual_data_size += memory_used;
+    if(pending.error) {
+        std::rethrow_exception(pending.error);
     }
 }
 
-std::string Rocask::raw_read(std::string key) {
-    if(!_keydir.contains(key)) {
-        throw std::out_of_range("KeyError: " + key + " not found in map.");
+// queued together, so one leader appends them all and in this order
+void Rocask::submit_writes(std::vector<PendingWrite>& writes) {
+    if(writes.empty()) {
+        return;
     }
-    KeyDirEntry entry = _keydir.get(key);
-    
-    std::shared_lock lock(_file_mutex);
-    
-    std::string output;
-    read_at_offset(
-        _datafiles.get(entry.file_id),
-        entry.value_pos,
-        entry.value_size,
-        output
-    );
-    return output;
-}
 
-void Rocask::compaction() {
-    std::string cur_timestamp = std::to_string(get_timestamp());
+    std::unique_lock<std::mutex> lock(_commit_mutex);
+    for(PendingWrite& pending : writes) {
+        _commit_queue.push_back(&pending);
+    }
 
-    file_index.fetch_add(1);
-    uint64_t new_datafile_file_id = file_index.load();
+    while(!writes.back().done) {
+        if(_commit_leader) {
+            _commit_cv.wait(lock);
+            continue;
+        }
+        lead_commits(lock);
+    }
 
-    std::string new_datafile_path = datafiles_folder + std::to_string(new_datafile_file_id);
-    std::string new_datafile_hint_path = "hintfiles/" + std::to_string(new_datafile_file_id) + ".hint";
+    for(const PendingWrite& pending : writes) {
+        if(pending.error) {
+            std::rethrow_exception(pending.error);
+        }
+    }
+}
 
-    std::vector<std::pair<uint64_t, std::string>> datafiles_in_dir = _datafiles.items();
-    
-    _datafiles.put(new_datafile_file_id, new_datafile_path);
+// nobody waits on an async write, so the caller never leads: the current
+// leader or the commit thread takes it along
+void Rocask::submit_write_async(std::unique_ptr<PendingWrite> pending) {
+    std::lock_guard<std::mutex> lock(_commit_mutex);
+    _commit_queue.push_back(pending.release());
+    _async_writes_queued++;
+    if(!_commit_leader) {
+        _commit_cv.notify_all();
+    }
+}
 
-    std::vector<std::string> hint_datafiles{new_datafile_hint_path};
+// caller holds lock and nobody leads. Leads one round: takes everything
+// queued, including the caller's own record. Whatever comes in meanwhile
+// goes to the next leader, a waiting writer or the commit thread
+void Rocask::lead_commits(std::unique_lock<std::mutex>& lock) {
+    _commit_leader = true;
+    std::vector<PendingWrite*> batch;
+    batch.swap(_commit_queue);
+    _async_writes_queued = 0;
+    lock.unlock();
 
-    std::ofstream fout_new_datafile(new_datafile_path, std::ios::binary);
-    std::ofstream fout_new_hint(new_datafile_hint_path, std::ios::binary);
+    commit_batch(batch);
 
-    uint64_t new_cur_value_pos = 0;
+    // async writers get their callback here and are gone after it
+    std::vector<PendingWrite*> waiting;
+    for(PendingWrite *write : batch) {
+        if(write->on_done) {
+            write->on_done(write->error);
+            delete write;
+        } else {
+            waiting.push_back(write);
+        }
+    }
 
-    uint64_t during_compact_active_id = active_file_id.load();
+    lock.lock();
+    for(PendingWrite *write : waiting) {
+        write->done = true;
+    }
+    _commit_leader = false;
+    _commit_cv.notify_all();
+}
 
-    for(size_t i = 0; i < datafiles_in_dir.size(); i++) {
-        uint64_t datafile_id = datafiles_in_dir[i].first;
-        std::string datafile_path = datafiles_in_dir[i].second;
-        
-        // skip active path, compact/merge only old files
-        if(datafile_id == during_compact_active_id) {
+// leads the rounds async writes need, one at a time so a blocked writer
+// gets its turn in between. Drains the queue before shutting down
+void Rocask::commit_worker() {
+    std::unique_lock<std::mutex> lock(_commit_mutex);
+    while(!_commit_shutdown || _async_writes_queued > 0) {
+        if(_async_writes_queued > 0 && !_commit_leader) {
+            lead_commits(lock);
             continue;
         }
+        _commit_cv.wait(lock);
+    }
+}
 
-        // fin_old reads from old datafiles, fout_new writes to new datafiles
-        std::ifstream fin_old(datafile_path, std::ios::binary);
-        
-        // same as what we did in raw_read
-        uint64_t cur_value_pos = 0;
-
-        // crc - 4 bytes
-        uint32_t crc;
-        while(fin_old.read(reinterpret_cast<char*>(&crc), sizeof(crc))) {
-            // timestamp - 8 bytes
-            uint64_t timestamp;
-            fin_old.read(reinterpret_cast<char*>(&timestamp), sizeof(timestamp));
-
-            // key_size - 8 bytes 
-            uint64_t key_size;
-            fin_old.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
-
-            // value_size - 8 bytes 
-            uint64_t value_size;
-            fin_old.read(reinterpret_cast<char*>(&value_size), sizeof(value_size));             
-
-            // key - key_size bytes 
-            std::vector<char> key_bytes(key_size);
-            fin_old.read(reinterpret_cast<char*>(key_bytes.data()), key_size);
-            std::string key(key_bytes.data(), key_size);
-            
-            // adjust val_pos
-            cur_value_pos += sizeof(crc) + sizeof(timestamp) + sizeof(key_size) + sizeof(value_size) + key_size;
-            
-            std::vector<char> value_bytes(value_size);
-            fin_old.read(reinterpret_cast<char*>(value_bytes.data()), value_size);
-            std::string value(value_bytes.data(), value_size);
-
-            KeyDirEntry old_entry = _keydir.get(key);
-            KeyDirEntry datafile_entry = {
-                datafile_id, 
-                value_size, 
-                cur_value_pos, 
-                timestamp
-            };
-
-            if(old_entry == datafile_entry) {
-                // write to new-{i}
-                size_t buffer_size = sizeof(timestamp) + sizeof(key_size) + sizeof(value_size) + key_size + value_size; 
-
-                std::vector<char> buffer(buffer_size);
-                build_data_buffer(
-                    buffer.data(),
-                    timestamp,
-                    key_size,
-                    value_size,
-                    key,
-                    value
-                );
-
-                // check if new-{j} can append new data (doesn't exceed the memory limit)
-                uint64_t file_size = fs::file_size(new_datafile_path);
-                uint64_t new_file_size = file_size + static_cast<uint64_t>(sizeof(crc)) + buffer_size;
-                if(new_file_size > MAX_FILE_SIZE) {
-                    
-                    file_index.fetch_add(1);
-                    new_datafile_file_id = file_index.load();
-                    
-                    new_datafile_path = datafiles_folder + std::to_string(new_datafile_file_id);
-                    new_datafile_hint_path = "hintfiles/" + std::to_string(new_datafile_file_id);
-                    hint_datafiles.push_back(new_datafile_hint_path);
-
-                    _datafiles.put(new_datafile_file_id, new_datafile_path);
-
-                    fout_new_datafile.close();
-                    fout_new_datafile.clear();
-                    fout_new_datafile.open(new_datafile_path, std::ios::binary);
-
-                    // fout_new_hint.close();
-                    // fout_new_hint.clear();
-                    // fout_new_hint.open(new_datafile_hint_path, std::ios::binary);
-
-                    new_cur_value_pos = 0;
-                }
+void Rocask::commit_batch(std::vector<PendingWrite*>& batch) {
+    std::lock_guard<std::mutex> lock(_write_mutex);
 
-                fout_new_datafile.write(reinterpret_cast<char*>(&crc), sizeof(crc));
-                fout_new_datafile.write(buffer.data(), buffer_size);
-                fout_new_datafile.flush();
-                
-                new_cur_value_pos += sizeof(crc) + sizeof(timestamp) + sizeof(key_size) + sizeof(value_size) + key_size;
+    // recovery lets the newest timestamp win, so it has to agree with the
+    // log order. A write stamped before a racing one got in first, or under
+    // a clock that stepped back, is stamped again just past the log's end
+    for(PendingWrite *write : batch) {
+        if(write->timestamp <= _last_timestamp) {
+            write->timestamp = _last_timestamp + 1;
+            restamp_records(write->record.data(), write->record.size(), _options.crc_kind, write->timestamp);
+        }
+        _last_timestamp = write->timestamp;
+    }
 
-                // locked CAS update of _keydir
-                _keydir.update(key, old_entry, [&](KeyDirEntry& cur_entry) {
-                    cur_entry.file_id = new_datafile_file_id;
-                    cur_entry.value_pos = new_cur_value_pos;
-                });
-                
-                // fout_new_hint.write(reinterpret_cast<char*>(&key_size), sizeof(key_size));
-                // fout_new_hint.write(key.data(), key_size);
-                // fout_new_hint.write(reinterpret_cast<char*>(&new_datafile_file_id), sizeof(new_datafile_file_id));
-                // fout_new_hint.write(reinterpret_cast<char*>(&value_size), sizeof(value_size));
-                // fout_new_hint.write(reinterpret_cast<char*>(&new_cur_value_pos), sizeof(new_cur_value_pos));
-                // fout_new_hint.write(reinterpret_cast<char*>(&timestamp), sizeof(timestamp));
-                // fout_new_hint.flush();
+    // records are appended in runs, a run ends where the active file fills up
+    size_t published = 0;
+    try {
+        std::vector<struct iovec> iov;
+        std::vector<uint64_t> positions(batch.size());
+        size_t run_start = 0;
 
-                new_cur_value_pos += value_size;
+        while(run_start < batch.size()) {
+            if(!_writer.fits(batch[run_start]->record.size())) {
+                roll_active_file();
             }
-            
-            // add remaining value_size bytes to position
-            cur_value_pos += value_size;
-        }
 
-        fin_old.close();
-    }
+            iov.clear();
+            uint64_t run_size = 0;
+            size_t run_end = run_start;
+            while(run_end < batch.size()) {
+                std::vector<char>& record = batch[run_end]->record;
+                if(run_end > run_start && !_writer.fits(record.size(), run_size)) {
+                    break;
+                }
+                positions[run_end] = _writer.offset() + run_size;
+                iov.push_back({record.data(), record.size()});
+                run_size += record.size();
+                run_end++;
+            }
 
-    std::unique_lock lock(_file_mutex);
-    for(size_t i = 0; i < datafiles_in_dir.size(); i++) {
-        uint64_t datafile_id = datafiles_in_dir[i].first;
-        std::string datafile_path = datafiles_in_dir[i].second;
+            _writer.append(iov, _options.sync_policy == SyncPolicy::EveryBatch);
 
-        if(datafile_id == during_compact_active_id) {
-            continue;
-        }
+            // publish in log order, so the last write to a key wins
+            for(size_t i = run_start; i < run_end; i++) {
+                PendingWrite *write = batch[i];
 
-        _datafiles.remove(datafile_id);
-        uint64_t file_size = fs::file_size(datafile_path);
-        fs::remove(datafile_path);
+                // readers look keys up under a shared _file_mutex, so a batch
+                // is seen either whole or not at all
+                std::unique_lock<std::shared_mutex> visible(_file_mutex, std::defer_lock);
+                if(write->atomic) {
+                    visible.lock();
+                }
 
-        total_disk_used -= file_size;
+                total_disk_used += write->record.size();
+                account_append(_writer.file_id(), write->record.size(), write->timestamp);
+                for(const PendingWrite::Entry& written : write->entries) {
+                    if(_cache) {
+                        _cache->erase(*written.key);
+                    }
+
+                    if(written.expiry == TOMBSTONE_EXPIRY) {
+                        // compaction may move the entry under us, retry until it's gone
+                        std::optional<KeyDirEntry> previous_entry;
+                        while((previous_entry = _keydir.find(*written.key)).has_value()) {
+                            if(_keydir.remove_if(*written.key, *previous_entry)) {
+                                actual_data_size -= RECORD_HEADER_SIZE + written.key->size() + previous_entry->value_size;
+                                account_dead(*written.key, *previous_entry);
+                                if(_key_index) {
+                                    _key_index->erase(*written.key);
+                                }
+                                break;
+                            }
+                        }
+                        continue;
+                    }
+
+                    KeyDirEntry entry = {
+                        _writer.file_id(),
+                        written.value_size,
+                        positions[i] + written.value_offset,
+                        write->timestamp,
+                        written.expiry,
+                        written.codec
+                    };
+
+                    std::optional<KeyDirEntry> previous_entry = _keydir.put(*written.key, entry);
+                    account_live(*written.key, entry);
+                    if(previous_entry.has_value()) {
+                        account_dead(*written.key, *previous_entry);
+                        actual_data_size += (written.value_size - previous_entry->value_size);
+                    } else {
+                        actual_data_size += written.record_size;
+                        if(_key_index) {
+                            _key_index->insert(*written.key);
+                        }
+                    }
+                }
+                // only the writes after this one are failed if the next throws
+                published = i + 1;
+            }
+            run_start = run_end;
+        }
+    } catch(...) {
+        std::exception_ptr error = std::current_exception();
+        for(size_t i = published; i < batch.size(); i++) {
+            batch[i]->error = error;
+        }
     }
-}
 
-bool Rocask::compaction_conditions() {
-    if(total_disk_used < CARE_ENOUGH) return false;
-    if(actual_data_size == 0) return true;
-    double ratio = (double) total_disk_used / actual_data_size;
-    return ratio > COMPACTION_THRESHOLD; 
+    if(published > 0) {
+        _log_cv.notify_all();
+    }
 }
 
-void Rocask::trigger_compaction() {
-    if(!compaction_conditions()) {
-        return;
+// caller holds _write_mutex
+void Rocask::roll_active_file() {
+    // a sealed file is never written again, make it durable before moving on
+    if(_options.sync_policy != SyncPolicy::None) {
+        _writer.sync();
     }
 
-    std::unique_lock<std::mutex> lock(_compaction_mutex);
-    _compact = true;
-    lock.unlock();
-    _compaction_cv.notify_one();
-}
+    uint64_t sealed_file_id = _writer.file_id();
+    _datafiles.put(sealed_file_id, DataFile{_writer.path(), _writer.crc_kind(), DATAFILE_VERSION, true, true});
 
-void Rocask::compaction_worker() {
-    while(true) {
-        std::unique_lock<std::mutex> lock(_compaction_mutex);
+    uint64_t new_file_id = file_index.fetch_add(1) + 1;
+    std::string new_path = datafiles_folder + std::to_string(new_file_id);
 
-        _compaction_cv.wait(lock, [this] {
-            return _compact || _shutdown;
-        });
+    add_log_file(new_file_id);
+    _writer.open(new_file_id, new_path, _options.crc_kind);
+    _datafiles.put(new_file_id, DataFile{new_path, _options.crc_kind, DATAFILE_VERSION, false, true});
+    account_append(new_file_id, _writer.offset(), UINT64_MAX);
+    total_disk_used += _writer.offset();
+    active_file_id.store(new_file_id);
 
-        if(_shutdown) break;
+    trigger_compaction();
+}
 
-        _compact = false;
+void Rocask::sync_worker() {
+    auto interval = std::chrono::milliseconds(_options.sync_interval_ms);
+    uint64_t synced_file_id = 0;
+    uint64_t synced_offset = 0;
+
+    while(true) {
+        std::unique_lock<std::mutex> lock(_sync_mutex);
+        _sync_cv.wait_for(lock, interval, [this] {
+            return _sync_shutdown;
+        });
+        if(_sync_shutdown) break;
         lock.unlock();
 
-        if(compaction_conditions()) {
+        // grab the fd under the writer lock, fdatasync without it
+        std::shared_ptr<FileHandle> file;
+        {
+            std::lock_guard<std::mutex> write_lock(_write_mutex);
+            if(_writer.file_id() == synced_file_id && _writer.offset() == synced_offset) {
+                continue;
+            }
+            synced_file_id = _writer.file_id();
+            synced_offset = _writer.offset();
+            file = _writer.handle();
+        }
+
+        int result = 0;
+        if(file) {
+            result = _ring ? _ring->sync(*file) : ::fdatasync(file->fd());
+        }
+        if(result != 0) {
+            std::cerr << "Error: " << "fdatasync failed on datafile " << synced_file_id << std::endl;
+        }
+    }
+}
+
+Rocask::ValueLocation Rocask::locate_value(const std::string& key) {
+    // hold the lock only until the handle or mapping is pinned, compaction
+    // can't unlink the file underneath us after that
+    std::shared_lock lock(_file_mutex);
+    std::optional<KeyDirEntry> found = _keydir.find(key);
+    if(!found.has_value() || expire_entry(key, *found)) {
+        throw std::out_of_range("KeyError: " + key + " not found in map.");
+    }
+
+    ValueLocation location;
+    location.entry = *found;
+
+    // a hit is only taken for this exact entry, so it never outlives a write
+    // or a compaction move
+    if(_cache) {
+        location.cached = _cache->find(key, location.entry);
+        if(location.cached) {
+            return location;
+        }
+    }
+
+    pin_datafile(location);
+    return location;
+}
+
+// TTL keys are dropped lazily, by whichever read or merge finds them expired
+bool Rocask::expire_entry(const std::string& key, const KeyDirEntry& entry) {
+    if(!entry.expired(get_seconds())) {
+        return false;
+    }
+    if(_keydir.remove_if(key, entry)) {
+        actual_data_size -= RECORD_HEADER_SIZE + key.size() + entry.value_size;
+        account_dead(key, entry);
+
+        // keydir changes are published under _write_mutex and this isn't, a
+        // write may have brought the key back and indexed it already
+        if(_key_index) {
+            _key_index->erase(key);
+            if(_keydir.find(key).has_value()) {
+                _key_index->insert(key);
+            }
+        }
+    }
+    return true;
+}
+
+// bytes appended to file_id, timestamp is the record's (UINT64_MAX for headers)
+void Rocask::account_append(uint64_t file_id, uint64_t bytes, uint64_t timestamp) {
+    std::lock_guard<std::mutex> lock(_usage_mutex);
+    FileUsage& usage = _file_usage[file_id];
+    usage.total_bytes += bytes;
+    usage.min_timestamp = std::min(usage.min_timestamp, timestamp);
+}
+
+// entry became what the keydir points at
+void Rocask::account_live(const std::string& key, const KeyDirEntry& entry) {
+    std::lock_guard<std::mutex> lock(_usage_mutex);
+    FileUsage& usage = _file_usage[entry.file_id];
+    uint64_t record_size = usage.header_size + key.size() + entry.value_size;
+    usage.live_bytes += record_size;
+    if(entry.expiry != 0) {
+        usage.expiring_bytes += record_size;
+        usage.max_expiry = std::max(usage.max_expiry, entry.expiry);
+    }
+    if(needs_recode(entry)) {
+        usage.recode_bytes += record_size;
+    }
+}
+
+// compressed with a codec that's no longer configured. Raw values aren't
+// counted, a file full of incompressible ones would be picked forever
+bool Rocask::needs_recode(const KeyDirEntry& entry) const {
+    return _options.compaction_recompress && entry.codec != Codec::None && entry.codec != _options.compression;
+}
+
+// entry was superseded, deleted or expired
+void Rocask::account_dead(const std::string& key, const KeyDirEntry& entry) {
+    std::lock_guard<std::mutex> lock(_usage_mutex);
+    auto it = _file_usage.find(entry.file_id);
+    if(it == _file_usage.end()) {
+        return;
+    }
+    FileUsage& usage = it->second;
+    uint64_t record_size = usage.header_size + key.size() + entry.value_size;
+    usage.live_bytes -= record_size;
+    if(entry.expiry != 0) {
+        usage.expiring_bytes -= record_size;
+    }
+    if(needs_recode(entry)) {
+        usage.recode_bytes -= record_size;
+    }
+}
+
+// caller holds _file_mutex, pins the file location.entry points into
+void Rocask::pin_datafile(ValueLocation& location) {
+    DataFile datafile = _datafiles.get(location.entry.file_id);
+    location.crc_kind = datafile.crc_kind;
+    location.version = datafile.version;
+
+    // sealed files never change again, so a mapping of one stays complete
+    if(_options.mmap_reads && datafile.sealed) {
+        location.mapping = _handles.acquire_mapping(location.entry.file_id, datafile.path);
+        if(location.mapping && 
+           location.entry.value_pos + location.entry.value_size <= location.mapping->size()) {
+            return;
+        }
+        location.mapping.reset();
+    }
+
+    location.handle = _handles.acquire(location.entry.file_id, datafile.path);
+    if(!location.handle) {
+        throw std::runtime_error("Could not open datafile " + std::to_string(location.entry.file_id));
+    }
+}
+
+void Rocask::check_record(
+    const char *record, 
+    const std::string& key, 
+    const KeyDirEntry& entry, 
+    CrcKind crc_kind, 
+    uint8_t version
+) {
+    uint64_t header_size = record_header_size(version);
+    uint64_t record_size = header_size + key.size() + entry.value_size;
+    RecordHeader header = read_record_header(record, version);
+
+    if(validate_record(record, record_size, crc_kind, version) != record_size ||
+       header.key_size != key.size() || header.value_size != entry.value_size ||
+       std::memcmp(record + header_size, key.data(), key.size()) != 0) {
+        throw std::runtime_error(
+            "Checksum mismatch for key " + key + " in datafile " + std::to_string(entry.file_id)
+        );
+    }
+}
+
+std::string Rocask::raw_read(std::string key) {
+    ValueLocation location = locate_value(key);
+    return fetch_value(key, location);
+}
+
+// value at location, through the cache when there is one
+std::string Rocask::fetch_value(const std::string& key, const ValueLocation& location) {
+    if(location.cached) {
+        return *location.cached;
+    }
+    // mapped raw values are already in memory, decoded ones are worth keeping
+    if(!_cache || (location.mapping && location.entry.codec == Codec::None)) {
+        return load_value(key, location);
+    }
+
+    auto value = std::make_shared<const std::string>(load_value(key, location));
+    _cache->insert(key, location.entry, value);
+    return *value;
+}
+
+std::string Rocask::load_value(const std::string& key, const ValueLocation& location) {
+    const KeyDirEntry& entry = location.entry;
+
+    if(location.mapping) {
+        return value_from(key, location, location.mapping->data() + value_read_pos(key, location));
+    }
+
+    std::string output;
+    if(!_options.verify_reads && entry.codec == Codec::None) {
+        output.resize(entry.value_size);
+        if(!read_at(*location.handle, entry.value_pos, entry.value_size, output.data())) {
+            throw std::runtime_error("Short read from datafile " + std::to_string(entry.file_id));
+        }
+        return output;
+    }
+
+    // still one read when verifying, just starting at the record. These
+    // bytes are only checked and decoded, a registered buffer saves the
+    // kernel mapping them in
+    uint64_t read_pos = value_read_pos(key, location);
+    uint64_t read_size = entry.value_pos + entry.value_size - read_pos;
+    IoRing::Buffer buffer = _ring ? _ring->lease_buffer(read_size) : IoRing::Buffer();
+    char *bytes;
+    if(buffer) {
+        bytes = buffer.data();
+    } else {
+        output.resize(read_size);
+        bytes = output.data();
+    }
+    if(!read_at(*location.handle, read_pos, read_size, bytes, buffer.index())) {
+        throw std::runtime_error("Short read from datafile " + std::to_string(entry.file_id));
+    }
+    if(buffer || entry.codec != Codec::None) {
+        return value_from(key, location, bytes);
+    }
+
+    // raw and verified, the value is already in output behind its header
+    check_record(bytes, key, entry, location.crc_kind, location.version);
+    output.erase(0, entry.value_pos - read_pos);
+    return output;
+}
+
+// where a read of location's value starts, at the record when verifying
+uint64_t Rocask::value_read_pos(const std::string& key, const ValueLocation& location) const {
+    const KeyDirEntry& entry = location.entry;
+    if(!_options.verify_reads) {
+        return entry.value_pos;
+    }
+    return entry.value_pos - key.size() - record_header_size(location.version);
+}
+
+// the value out of bytes read from value_read_pos on
+std::string Rocask::value_from(const std::string& key, const ValueLocation& location, const char *bytes) {
+    const KeyDirEntry& entry = location.entry;
+    if(_options.verify_reads) {
+        check_record(bytes, key, entry, location.crc_kind, location.version);
+    }
+    uint64_t value_start = entry.value_pos - value_read_pos(key, location);
+    return decode_value(entry, std::string_view(bytes + value_start, entry.value_size));
+}
+
+bool Rocask::read_at(const FileHandle& file, uint64_t offset, uint64_t size, char *output, int buffer_index) {
+    if(_ring) {
+        return _ring->read(file, offset, size, output, buffer_index);
+    }
+    return read_at_offset(file.fd(), offset, size, output);
+}
+
+void Rocask::read_framed(const std::string& key, std::string_view prefix, std::string_view suffix, std::string& output) {
+    ValueLocation location = locate_value(key);
+    const KeyDirEntry& entry = location.entry;
+
+    auto frame = [&](const char *value, uint64_t value_size) {
+        output.resize(prefix.size() + value_size + suffix.size());
+        std::memcpy(output.data(), prefix.data(), prefix.size());
+        std::memcpy(output.data() + prefix.size(), value, value_size);
+        std::memcpy(output.data() + prefix.size() + value_size, suffix.data(), suffix.size());
+    };
+
+    if(location.cached) {
+        frame(location.cached->data(), location.cached->size());
+        return;
+    }
+
+    // compressed values need decoding and verified ones their header, those
+    // take the usual path and one more copy
+    if(entry.codec != Codec::None || _options.verify_reads) {
+        std::string value = fetch_value(key, location);
+        frame(value.data(), value.size());
+        return;
+    }
+
+    if(location.mapping) {
+        frame(location.mapping->data() + entry.value_pos, entry.value_size);
+        return;
+    }
+
+    // pread right into the frame, this skips the cache on purpose, filling it
+    // would cost the copy this is here to avoid
+    output.resize(prefix.size() + entry.value_size + suffix.size());
+    std::memcpy(output.data(), prefix.data(), prefix.size());
+    if(!read_at(*location.handle, entry.value_pos, entry.value_size, output.data() + prefix.size())) {
+        throw std::runtime_error("Short read from datafile " + std::to_string(entry.file_id));
+    }
+    std::memcpy(output.data() + prefix.size() + entry.value_size, suffix.data(), suffix.size());
+}
+
+ValueView Rocask::read_view(const std::string& key) {
+    ValueLocation location = locate_value(key);
+    const KeyDirEntry& entry = location.entry;
+
+    if(location.cached) {
+        std::string_view data(*location.cached);
+        return ValueView(std::move(location.cached), data);
+    }
+
+    // mapped values are already in memory, they skip the cache. Compressed
+    // ones need a private copy to decode into, they go the way of the rest
+    if(location.mapping && entry.codec == Codec::None) {
+        if(_options.verify_reads) {
+            uint64_t record_pos = entry.value_pos - key.size() - record_header_size(location.version);
+            check_record(location.mapping->data() + record_pos, key, entry, location.crc_kind, location.version);
+        }
+        std::string_view value(location.mapping->data() + entry.value_pos, entry.value_size);
+        return ValueView(std::move(location.mapping), value);
+    }
+
+    auto value = std::make_shared<const std::string>(load_value(key, location));
+    if(_cache) {
+        _cache->insert(key, entry, value);
+    }
+    std::string_view data(*value);
+    return ValueView(std::move(value), data);
+}
+
+uint64_t Rocask::MultiRead::read_start(const FileReads& file, size_t i) const {
+    const std::string& key = (*keys)[file.reads[i].first];
+    uint64_t value_pos = file.reads[i].second.value_pos;
+    return verify ? value_pos - key.size() - record_header_size(file.location.version) : value_pos;
+}
+
+uint64_t Rocask::MultiRead::read_end(const FileReads& file, size_t i) const {
+    return file.reads[i].second.value_pos + file.reads[i].second.value_size;
+}
+
+std::vector<std::optional<std::string>> Rocask::multi_read(const std::vector<std::string>& keys) {
+    MultiRead plan;
+    plan_multi_read(plan, keys);
+
+    // with a ring every span is read in one submission, the device gets
+    // them all at once instead of one pread after another
+    if(_ring) {
+        std::vector<IoRing::Read> ring_reads;
+        for(MultiRead::Span& span : plan.spans) {
+            if(span.base) {
+                continue;
+            }
+            uint64_t size = span.end - span.start;
+            span.buffer = _ring->lease_buffer(size);
+            char *output;
+            if(span.buffer) {
+                output = span.buffer.data();
+            } else {
+                span.storage.resize(size);
+                output = span.storage.data();
+            }
+            ring_reads.push_back({span.file->location.handle.get(), span.start, size, output, span.buffer.index()});
+            span.base = output;
+        }
+        if(!_ring->read_all(ring_reads)) {
+            throw std::runtime_error("Short read from datafile");
+        }
+    }
+
+    finish_multi_read(plan);
+    return std::move(plan.values);
+}
+
+ScanPage Rocask::scan(const std::string& start, const std::optional<std::string>& end, size_t limit) {
+    ScanPage page;
+    if(limit == 0) {
+        return page;
+    }
+    std::vector<std::string> keys = scan_keys(start, end, limit);
+    page.more = keys.size() == limit;
+    if(!keys.empty()) {
+        page.last_key = keys.back();
+    }
+
+    std::vector<std::optional<std::string>> values = multi_read(keys);
+    page.items.reserve(keys.size());
+    for(size_t i = 0; i < keys.size(); i++) {
+        if(values[i].has_value()) {
+            page.items.emplace_back(std::move(keys[i]), std::move(*values[i]));
+        }
+    }
+    return page;
+}
+
+ScanPage Rocask::prefix_scan(const std::string& prefix, size_t limit, const std::string& start) {
+    // every key with the prefix sorts before its last byte plus one, 0xff
+    // bytes carry over
+    std::optional<std::string> end = prefix;
+    while(!end->empty() && static_cast<unsigned char>(end->back()) == 0xff) {
+        end->pop_back();
+    }
+    if(end->empty()) {
+        end.reset();
+    } else {
+        end->back() = static_cast<char>(static_cast<unsigned char>(end->back()) + 1);
+    }
+    return scan(std::max(prefix, start), end, limit);
+}
+
+std::vector<std::string> Rocask::scan_keys(const std::string& start, const std::optional<std::string>& end, size_t limit) {
+    if(_key_index) {
+        return _key_index->range(start, end, limit);
+    }
+
+    std::vector<std::string> keys;
+    _keydir.for_each([&](const std::string& key, const KeyDirEntry&) {
+        if(!(key < start) && (!end.has_value() || key < *end)) {
+            keys.push_back(key);
+        }
+    });
+    if(keys.size() > limit) {
+        std::nth_element(keys.begin(), keys.begin() + limit, keys.end());
+        keys.resize(limit);
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+// lookups and cache hits, then the spans to read. Mapped spans need no read
+void Rocask::plan_multi_read(MultiRead& plan, const std::vector<std::string>& keys) {
+    plan.keys = &keys;
+    plan.verify = _options.verify_reads;
+    plan.values.resize(keys.size());
+
+    // every lookup and pin under one lock, then no lock for the I/O
+    {
+        std::shared_lock lock(_file_mutex);
+        for(size_t i = 0; i < keys.size(); i++) {
+            std::optional<KeyDirEntry> found = _keydir.find(keys[i]);
+            if(!found.has_value() || expire_entry(keys[i], *found)) {
+                continue;
+            }
+            if(_cache) {
+                std::shared_ptr<const std::string> cached = _cache->find(keys[i], *found);
+                if(cached) {
+                    plan.values[i] = *cached;
+                    continue;
+                }
+            }
+            plan.files[found->file_id].reads.emplace_back(i, *found);
+        }
+
+        for(auto& [file_id, file] : plan.files) {
+            std::sort(file.reads.begin(), file.reads.end(), [](const auto& a, const auto& b) {
+                return a.second.value_pos < b.second.value_pos;
+            });
+
+            // pin with the value that ends last, one mapping bounds check covers them all
+            file.location.entry = file.reads.front().second;
+            for(const auto& [index, entry] : file.reads) {
+                if(entry.value_pos + entry.value_size > 
+                   file.location.entry.value_pos + file.location.entry.value_size) {
+                    file.location.entry = entry;
+                }
+            }
+            pin_datafile(file.location);
+        }
+    }
+
+    for(const auto& [file_id, file] : plan.files) {
+        for(size_t run_start = 0; run_start < file.reads.size(); ) {
+            uint64_t span_start = plan.read_start(file, run_start);
+            uint64_t span_end = plan.read_end(file, run_start);
+            size_t run_end = run_start + 1;
+            while(run_end < file.reads.size() &&
+                  plan.read_start(file, run_end) <= span_end + MGET_COALESCE_GAP &&
+                  std::max(span_end, plan.read_end(file, run_end)) - span_start <= MGET_MAX_SPAN) {
+                span_end = std::max(span_end, plan.read_end(file, run_end));
+                run_end++;
+            }
+
+            MultiRead::Span span{file_id, &file, run_start, run_end, span_start, span_end};
+            if(file.location.mapping) {
+                span.base = file.location.mapping->data() + span_start;
+            }
+            plan.spans.push_back(std::move(span));
+            run_start = run_end;
+        }
+    }
+}
+
+// preads whatever wasn't read yet, then decodes every span into values
+void Rocask::finish_multi_read(MultiRead& plan) {
+    const std::vector<std::string>& keys = *plan.keys;
+
+    std::string buffer;
+    for(MultiRead::Span& span : plan.spans) {
+        const MultiRead::FileReads& file = *span.file;
+        const ValueLocation& location = file.location;
+
+        const char *base = span.base;
+        if(!base) {
+            if(!read_at_offset(location.handle->fd(), span.start, span.end - span.start, buffer)) {
+                throw std::runtime_error("Short read from datafile " + std::to_string(span.file_id));
+            }
+            base = buffer.data();
+        }
+
+        for(size_t i = span.run_start; i < span.run_end; i++) {
+            const std::string& key = keys[file.reads[i].first];
+            const KeyDirEntry& entry = file.reads[i].second;
+            if(plan.verify) {
+                check_record(base + (plan.read_start(file, i) - span.start), key, entry, location.crc_kind, location.version);
+            }
+
+            std::string value = decode_value(entry, std::string_view(base + (entry.value_pos - span.start), entry.value_size));
+            if(_cache && (!location.mapping || entry.codec != Codec::None)) {
+                _cache->insert(key, entry, std::make_shared<const std::string>(value));
+            }
+            plan.values[file.reads[i].first] = std::move(value);
+        }
+    }
+}
+
+void Rocask::read_async(const std::string& key, ReadCallback done) {
+    ValueLocation location;
+    try {
+        location = locate_value(key);
+    } catch(...) {
+        done(std::current_exception(), std::string());
+        return;
+    }
+
+    // a cache hit or a mapped value is already in memory, and without a
+    // ring there's nothing to wait on but pread
+    if(!_ring || location.cached || location.mapping) {
+        std::string value;
+        std::exception_ptr error;
+        try {
+            value = fetch_value(key, location);
+        } catch(...) {
+            error = std::current_exception();
+        }
+        done(error, std::move(value));
+        return;
+    }
+
+    struct PendingRead {
+        std::string key;
+        ValueLocation location;
+        std::string bytes;
+        ReadCallback done;
+    };
+    auto pending = std::make_shared<PendingRead>();
+    pending->key = key;
+    pending->location = std::move(location);
+    pending->done = std::move(done);
+
+    const KeyDirEntry& entry = pending->location.entry;
+    uint64_t read_pos = value_read_pos(key, pending->location);
+    pending->bytes.resize(entry.value_pos + entry.value_size - read_pos);
+
+    _ring->read_async(*pending->location.handle, read_pos, pending->bytes.size(), pending->bytes.data(), [this, pending](bool ok) {
+        const KeyDirEntry& entry = pending->location.entry;
+        std::string value;
+        std::exception_ptr error;
+        try {
+            if(!ok) {
+                throw std::runtime_error("Short read from datafile " + std::to_string(entry.file_id));
+            }
+            if(!_options.verify_reads && entry.codec == Codec::None) {
+                value = std::move(pending->bytes);
+            } else {
+                value = value_from(pending->key, pending->location, pending->bytes.data());
+            }
+            if(_cache) {
+                _cache->insert(pending->key, entry, std::make_shared<const std::string>(value));
+            }
+        } catch(...) {
+            error = std::current_exception();
+        }
+        pending->done(error, std::move(value));
+    });
+}
+
+void Rocask::write_async(const std::string& key, const std::string& value, uint64_t ttl_seconds, WriteCallback done) {
+    auto pending = std::make_unique<PendingWrite>();
+    try {
+        check_writable();
+        if(key.size() > MAX_KEY_SIZE) {
+            throw std::invalid_argument("Key is larger than " + std::to_string(MAX_KEY_SIZE) + " bytes.");
+        }
+        // the record points at its key until it's published
+        pending->owned_key = key;
+        pending->timestamp = get_timestamp();
+        encode_record(*pending, pending->owned_key, value, expiry_after(ttl_seconds));
+    } catch(...) {
+        done(std::current_exception());
+        return;
+    }
+    pending->on_done = std::move(done);
+    submit_write_async(std::move(pending));
+}
+
+void Rocask::multi_read_async(const std::vector<std::string>& keys, MultiReadCallback done) {
+    struct PendingMultiRead {
+        std::vector<std::string> keys;
+        MultiRead plan;
+        MultiReadCallback done;
+        std::atomic<size_t> remaining{0};
+        std::atomic<bool> failed{false};
+    };
+    auto pending = std::make_shared<PendingMultiRead>();
+    pending->keys = keys;
+    pending->done = std::move(done);
+
+    auto finish = [this, pending]() {
+        std::exception_ptr error;
+        try {
+            if(pending->failed) {
+                throw std::runtime_error("Short read from datafile");
+            }
+            finish_multi_read(pending->plan);
+        } catch(...) {
+            error = std::current_exception();
+        }
+        pending->done(error, std::move(pending->plan.values));
+    };
+
+    std::vector<MultiRead::Span*> unread;
+    try {
+        plan_multi_read(pending->plan, pending->keys);
+        for(MultiRead::Span& span : pending->plan.spans) {
+            if(!span.base) {
+                unread.push_back(&span);
+            }
+        }
+    } catch(...) {
+        pending->done(std::current_exception(), {});
+        return;
+    }
+
+    // finish preads them itself without a ring
+    if(!_ring || unread.empty()) {
+        finish();
+        return;
+    }
+
+    // the last read in finishes the lot
+    pending->remaining = unread.size();
+    for(MultiRead::Span *span : unread) {
+        span->storage.resize(span->end - span->start);
+        span->base = span->storage.data();
+        _ring->read_async(*span->file->location.handle, span->start, span->storage.size(), span->storage.data(), [pending, finish](bool ok) {
+            if(!ok) {
+                pending->failed = true;
+            }
+            if(pending->remaining.fetch_sub(1) == 1) {
+                finish();
+            }
+        });
+    }
+}
+
+void Rocask::compaction() {
+    // snapshot the files together with the active id so a concurrent
+    // rollover can't slip the new active file into the merge set
+    std::vector<std::pair<uint64_t, DataFile>> datafiles_in_dir;
+    uint64_t during_compact_active_id;
+    {
+        std::lock_guard<std::mutex> lock(_write_mutex);
+        datafiles_in_dir = _datafiles.items();
+        during_compact_active_id = active_file_id.load();
+    }
+
+    std::vector<uint64_t> picked = pick_compaction_files(datafiles_in_dir, during_compact_active_id);
+
+    // another compaction may have claimed some of them in the meantime
+    std::vector<uint64_t> claimed;
+    {
+        std::lock_guard<std::mutex> lock(_usage_mutex);
+        for(uint64_t file_id : picked) {
+            if(_compacting.insert(file_id).second) {
+                claimed.push_back(file_id);
+            }
+        }
+    }
+    if(claimed.empty()) {
+        return;
+    }
+
+    std::unordered_map<uint64_t, DataFile> by_id(datafiles_in_dir.begin(), datafiles_in_dir.end());
+
+    // split into groups of about the same size, biggest file first onto the
+    // lightest group. The groups share _compaction_limiter, so more workers
+    // only go faster while the rate limit leaves room for it
+    size_t num_groups = std::min<size_t>(std::max(_options.compaction_workers, 1u), claimed.size());
+    std::vector<std::vector<std::pair<uint64_t, DataFile>>> groups(num_groups);
+    std::vector<uint64_t> group_bytes(num_groups, 0);
+    {
+        std::lock_guard<std::mutex> lock(_usage_mutex);
+        std::sort(claimed.begin(), claimed.end(), [this](uint64_t a, uint64_t b) {
+            return _file_usage[a].total_bytes > _file_usage[b].total_bytes;
+        });
+        for(uint64_t file_id : claimed) {
+            size_t lightest = std::min_element(group_bytes.begin(), group_bytes.end()) - group_bytes.begin();
+            groups[lightest].emplace_back(file_id, by_id.at(file_id));
+            group_bytes[lightest] += _file_usage[file_id].total_bytes;
+        }
+    }
+
+    // a tombstone or expired record newer than the oldest record left outside
+    // its group may still be shadowing an older value there, those are kept.
+    // Files of the other groups count as outside, they may still be around
+    std::vector<uint64_t> outside_min_timestamps(num_groups, UINT64_MAX);
+    {
+        std::lock_guard<std::mutex> lock(_usage_mutex);
+        for(size_t g = 0; g < num_groups; g++) {
+            for(const auto& [file_id, usage] : _file_usage) {
+                bool in_group = std::any_of(groups[g].begin(), groups[g].end(), [&](const auto& input) {
+                    return input.first == file_id;
+                });
+                if(!in_group) {
+                    outside_min_timestamps[g] = std::min(outside_min_timestamps[g], usage.min_timestamp);
+                }
+            }
+        }
+    }
+
+    // group 0 runs here, the rest on their own threads
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(num_groups);
+    for(size_t g = 1; g < num_groups; g++) {
+        workers.emplace_back([this, &groups, &outside_min_timestamps, &errors, g] {
+            try {
+                merge_files(groups[g], outside_min_timestamps[g]);
+            } catch(...) {
+                errors[g] = std::current_exception();
+            }
+        });
+    }
+    try {
+        merge_files(groups[0], outside_min_timestamps[0]);
+    } catch(...) {
+        errors[0] = std::current_exception();
+    }
+    for(std::thread& worker : workers) {
+        worker.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_usage_mutex);
+        for(uint64_t file_id : claimed) {
+            _compacting.erase(file_id);
+        }
+    }
+    for(const std::exception_ptr& error : errors) {
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void Rocask::set_compaction_rate_limit(uint64_t bytes_per_sec) {
+    _compaction_limiter.set_rate(bytes_per_sec);
+}
+
+// merges inputs into new datafiles and drops them, see compaction()
+void Rocask::merge_files(const std::vector<std::pair<uint64_t, DataFile>>& inputs, uint64_t outside_min_timestamp) {
+    BlockWriter writer(COMPACTION_BLOCK_SIZE, &_compaction_limiter);
+    std::ofstream fout_new_hint;
+
+    uint64_t new_datafile_file_id = 0;
+    std::string new_datafile_path;
+    std::string new_datafile_hint_path;
+
+    char datafile_header[DATAFILE_HEADER_SIZE];
+    write_datafile_header(datafile_header, _options.crc_kind);
+
+    // the keydir may only point into the output once the record is written,
+    // moves wait here until then
+    struct Move {
+        std::string key;
+        KeyDirEntry from;
+        KeyDirEntry to;
+    };
+    std::vector<Move> moves;
+    size_t num_moves = 0;
+    uint64_t unpublished_bytes = 0;
+    uint64_t unpublished_min_timestamp = UINT64_MAX;
+
+    // records of the current input that go out unchanged pile up into one
+    // range and are copied together
+    std::unique_ptr<BlockReader> reader;
+    uint64_t run_start = 0;
+    uint64_t run_size = 0;
+
+    auto flush_run = [&]() {
+        if(run_size > 0) {
+            writer.copy(*reader, run_start, run_size);
+            run_size = 0;
+        }
+    };
+
+    auto publish = [&]() {
+        flush_run();
+        writer.flush();
+
+        if(unpublished_bytes > 0) {
+            account_append(new_datafile_file_id, unpublished_bytes, unpublished_min_timestamp);
+            total_disk_used += unpublished_bytes;
+            unpublished_bytes = 0;
+            unpublished_min_timestamp = UINT64_MAX;
+        }
+
+        // locked CAS update of _keydir, it loses to anything written since
+        for(size_t m = 0; m < num_moves; m++) {
+            const Move& move = moves[m];
+            if(_keydir.update(move.key, move.from, [&](KeyDirEntry& cur_entry) {
+                cur_entry = move.to;
+            })) {
+                // recompressing changes the stored size
+                actual_data_size += move.to.value_size - move.from.value_size;
+                account_live(move.key, move.to);
+            }
+        }
+        num_moves = 0;
+    };
+
+    // hints are written to a .tmp and renamed once their datafile is
+    // complete, a crash mid-merge never leaves a hint for a partial file
+    auto open_output = [&]() {
+        new_datafile_file_id = file_index.fetch_add(1) + 1;
+        new_datafile_path = datafiles_folder + std::to_string(new_datafile_file_id);
+        new_datafile_hint_path = hintfile_path(new_datafile_file_id);
+
+        _datafiles.put(new_datafile_file_id, DataFile{new_datafile_path, _options.crc_kind, DATAFILE_VERSION, false});
+
+        writer.open(new_datafile_path);
+        writer.append(datafile_header, sizeof(datafile_header));
+        unpublished_bytes += DATAFILE_HEADER_SIZE;
+
+        fout_new_hint.clear();
+        fout_new_hint.open(new_datafile_hint_path + ".tmp", std::ios::binary);
+    };
+
+    auto seal_output = [&]() {
+        publish();
+        bool empty = writer.offset() == DATAFILE_HEADER_SIZE;
+        // durable before the inputs it replaces are removed
+        if(!empty) {
+            writer.sync();
+        }
+        writer.close();
+        fout_new_hint.close();
+        if(!fout_new_hint) {
+            throw std::runtime_error("Could not write hint file " + new_datafile_hint_path + ".tmp");
+        }
+
+        // nothing survived, don't leave a header-only file behind
+        if(empty) {
+            _datafiles.remove(new_datafile_file_id);
+            fs::remove(new_datafile_path);
+            fs::remove(new_datafile_hint_path + ".tmp");
+            total_disk_used -= DATAFILE_HEADER_SIZE;
+
+            std::lock_guard<std::mutex> usage_lock(_usage_mutex);
+            _file_usage.erase(new_datafile_file_id);
+            return;
+        }
+
+        sync_path(new_datafile_hint_path + ".tmp");
+        fs::rename(new_datafile_hint_path + ".tmp", new_datafile_hint_path);
+        _datafiles.put(new_datafile_file_id, DataFile{new_datafile_path, _options.crc_kind, DATAFILE_VERSION, true});
+    };
+
+    open_output();
+
+    // reused for every record
+    std::string key;
+    std::string record;
+    std::string decoded;
+    std::string compressed;
+
+    for(const auto& [datafile_id, datafile] : inputs) {
+        reader = std::make_unique<BlockReader>(datafile.path, COMPACTION_BLOCK_SIZE, &_compaction_limiter);
+        uint8_t datafile_version = datafile.version;
+        uint64_t header_size = record_header_size(datafile_version);
+
+        // same checksum and layout as the output, records go out byte for byte
+        bool verbatim = datafile.crc_kind == _options.crc_kind && datafile_version == DATAFILE_VERSION;
+
+        // skip the header, legacy files have none
+        uint64_t cur_pos = 0;
+        if(reader->fill(0, DATAFILE_HEADER_SIZE)) {
+            cur_pos = read_datafile_header(reader->data(0), DATAFILE_HEADER_SIZE).size;
+        }
+
+        while(reader->fill(cur_pos, header_size)) {
+            RecordHeader record_header = read_record_header(reader->data(cur_pos), datafile_version);
+            uint64_t timestamp = record_header.timestamp;
+            uint64_t expiry = record_header.expiry;
+            uint64_t key_size = record_header.key_size;
+            uint64_t value_size = record_header.value_size;
+
+            // batch markers carry no data, the merged output is plain records
+            if(is_batch_marker(record_header)) {
+                cur_pos += header_size;
+                continue;
+            }
+
+            // a torn tail, recovery cuts those off before anything is sealed
+            uint64_t body_size = reader->size() - cur_pos - header_size;
+            if(key_size > body_size || value_size > body_size - key_size) {
+                break;
+            }
+            uint64_t record_size = header_size + key_size + value_size;
+
+            // liveness only needs the key, values of dropped records are never read
+            reader->fill(cur_pos, header_size + key_size);
+            key.assign(reader->data(cur_pos + header_size), key_size);
+
+            std::optional<KeyDirEntry> current_entry = _keydir.find(key);
+            KeyDirEntry datafile_entry = {
+                datafile_id, 
+                value_size, 
+                cur_pos + header_size + key_size, 
+                timestamp,
+                expiry,
+                record_header.codec
+            };
+
+            // tombstones are never in the keydir, so they're dropped here with
+            // everything they shadowed. Expired keys go the same way, unless
+            // they may still shadow something outside this round
+            bool live = current_entry.has_value() && *current_entry == datafile_entry &&
+                        !expire_entry(key, *current_entry);
+            bool shadowing = !live && datafile_entry.expired(get_seconds()) &&
+                             timestamp > outside_min_timestamp;
+
+            if(live || shadowing) {
+                // output files are always in the configured checksum and
+                // layout, and with compaction_recompress in the configured
+                // codec. Tombstones and raw values below the threshold stay as they are
+                Codec codec = record_header.codec;
+                bool recompress = _options.compaction_recompress && codec != _options.compression &&
+                                  !(codec == Codec::None && value_size < _options.compression_min_size);
+                std::string_view value;
+                if(!verbatim || recompress) {
+                    reader->fill(cur_pos, record_size);
+                    value = std::string_view(reader->data(cur_pos + header_size + key_size), value_size);
+                }
+                if(recompress) {
+                    if(codec != Codec::None) {
+                        decompress(codec, value, decoded);
+                        value = decoded;
+                    }
+                    codec = compress_value(value, compressed);
+                    if(codec != Codec::None) {
+                        value = compressed;
+                    }
+                }
+                uint64_t new_value_size = (!verbatim || recompress) ? value.size() : value_size;
+                uint64_t output_size = RECORD_HEADER_SIZE + key_size + new_value_size;
+
+                // start a new output once this one is full, an empty one takes any record
+                uint64_t output_end = writer.offset() + run_size;
+                if(output_end > DATAFILE_HEADER_SIZE && output_end + output_size > MAX_FILE_SIZE) {
+                    seal_output();
+                    open_output();
+                    output_end = writer.offset();
+                }
+                uint64_t new_value_pos = output_end + RECORD_HEADER_SIZE + key_size;
+
+                if(verbatim && !recompress) {
+                    if(run_size > 0 && run_start + run_size != cur_pos) {
+                        flush_run();
+                    }
+                    if(run_size == 0) {
+                        run_start = cur_pos;
+                    }
+                    run_size += record_size;
+                } else {
+                    // after whatever the run holds, it comes first in the output
+                    flush_run();
+                    record.resize(output_size);
+                    build_data_buffer(
+                        record.data() + sizeof(uint32_t),
+                        timestamp,
+                        expiry,
+                        key_size,
+                        new_value_size,
+                        codec,
+                        key,
+                        value
+                    );
+                    uint32_t crc = calculate_crc(_options.crc_kind, record.data() + sizeof(crc), output_size - sizeof(crc));
+                    std::memcpy(record.data(), &crc, sizeof(crc));
+                    writer.append(record.data(), output_size);
+                }
+                unpublished_bytes += output_size;
+                unpublished_min_timestamp = std::min(unpublished_min_timestamp, timestamp);
+
+                KeyDirEntry moved_entry = datafile_entry;
+                moved_entry.file_id = new_datafile_file_id;
+                moved_entry.value_pos = new_value_pos;
+                moved_entry.value_size = new_value_size;
+                moved_entry.codec = codec;
+                if(live) {
+                    if(num_moves == moves.size()) {
+                        moves.emplace_back();
+                    }
+                    Move& move = moves[num_moves++];
+                    move.key.assign(key);
+                    move.from = datafile_entry;
+                    move.to = moved_entry;
+                }
+
+                // the record is in the new file even if the CAS loses to a newer
+                // write, recovery keeps whichever entry has the later timestamp
+                fout_new_hint.write(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+                fout_new_hint.write(key.data(), key_size);
+                fout_new_hint.write(reinterpret_cast<char*>(&new_datafile_file_id), sizeof(new_datafile_file_id));
+                fout_new_hint.write(reinterpret_cast<char*>(&new_value_size), sizeof(new_value_size));
+                fout_new_hint.write(reinterpret_cast<char*>(&new_value_pos), sizeof(new_value_pos));
+                fout_new_hint.write(reinterpret_cast<char*>(&timestamp), sizeof(timestamp));
+                fout_new_hint.write(reinterpret_cast<char*>(&expiry), sizeof(expiry));
+                fout_new_hint.write(reinterpret_cast<char*>(&codec), sizeof(codec));
+
+                if(unpublished_bytes >= COMPACTION_BLOCK_SIZE) {
+                    publish();
+                }
+            }
+
+            cur_pos += record_size;
+        }
+
+        // the run reads from this input, finish it before the next one
+        publish();
+    }
+
+    seal_output();
+
+    // the outputs' names and hint renames, or a crash could leave neither
+    // the inputs nor their replacements
+    sync_path(datafiles_folder);
+    sync_path(hintfiles_folder);
+
+    std::unique_lock lock(_file_mutex);
+    for(const auto& [datafile_id, datafile] : inputs) {
+        std::string datafile_path = datafile.path;
+
+        _datafiles.remove(datafile_id);
+        _handles.invalidate(datafile_id);
+        uint64_t file_size = fs::file_size(datafile_path);
+        fs::remove(datafile_path);
+        fs::remove(hintfile_path(datafile_id));
+
+        total_disk_used -= file_size;
+
+        std::lock_guard<std::mutex> usage_lock(_usage_mutex);
+        _file_usage.erase(datafile_id);
+    }
+}
+
+// sealed files past compaction_garbage_ratio that no compaction is merging
+// yet, the ones with the most garbage (so the fewest live bytes to copy per
+// byte freed) first, within compaction_max_input bytes. Always at least one
+// if any qualifies.
+std::vector<uint64_t> Rocask::pick_compaction_files(
+    const std::vector<std::pair<uint64_t, DataFile>>& datafiles,
+    uint64_t active_id
+) {
+    struct Candidate {
+        double garbage_ratio;
+        uint64_t total_bytes;
+        uint64_t file_id;
+    };
+    std::vector<Candidate> candidates;
+
+    uint64_t now = get_seconds();
+    {
+        std::lock_guard<std::mutex> lock(_usage_mutex);
+        for(const auto& [file_id, datafile] : datafiles) {
+            if(file_id == active_id || !datafile.sealed || _compacting.count(file_id) > 0) {
+                continue;
+            }
+            // a follower still has to read it
+            if(datafile.log && file_id >= _log_retained_from.load()) {
+                continue;
+            }
+            auto it = _file_usage.find(file_id);
+            if(it == _file_usage.end() || it->second.total_bytes == 0) {
+                continue;
+            }
+
+            const FileUsage& usage = it->second;
+            // values to recompress are as good a reason to rewrite a file as garbage
+            double garbage_ratio = static_cast<double>(usage.dead_bytes(now) + usage.recode_bytes) / usage.total_bytes;
+            if(garbage_ratio >= _options.compaction_garbage_ratio) {
+                candidates.push_back({garbage_ratio, usage.total_bytes, file_id});
+            }
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.garbage_ratio > b.garbage_ratio;
+    });
+
+    std::vector<uint64_t> picked;
+    uint64_t input_bytes = 0;
+    for(const Candidate& candidate : candidates) {
+        if(!picked.empty() && input_bytes + candidate.total_bytes > _options.compaction_max_input) {
+            break;
+        }
+        picked.push_back(candidate.file_id);
+        input_bytes += candidate.total_bytes;
+    }
+    return picked;
+}
+
+bool Rocask::compaction_conditions() {
+    if(total_disk_used < CARE_ENOUGH) return false;
+    return !pick_compaction_files(_datafiles.items(), active_file_id.load()).empty();
+}
+
+void Rocask::trigger_compaction() {
+    if(!compaction_conditions()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_compaction_mutex);
+    _compact = true;
+    lock.unlock();
+    _compaction_cv.notify_one();
+}
+
+void Rocask::compaction_worker() {
+    while(true) {
+        std::unique_lock<std::mutex> lock(_compaction_mutex);
+
+        _compaction_cv.wait(lock, [this] {
+            return _compact || _shutdown;
+        });
+
+        if(_shutdown) break;
+
+        _compact = false;
+        lock.unlock();
+
+        if(compaction_conditions()) {
             compaction();
+            num_compactions++;
+        }
+    }
+}
+
+RocaskStats Rocask::stats() {
+    uint64_t num_keys = _keydir.size();
+    uint64_t keydir_memory = _keydir.memory_usage();
+    uint64_t keydir_disk_bytes = 0;
+    _keydir.for_each_table([&keydir_disk_bytes](size_t, const KeyDirTable& table) {
+        if(table.disk() != nullptr) {
+            keydir_disk_bytes += table.disk()->disk_usage();
+        }
+    });
+
+    return RocaskStats{
+        num_keys,
+        _datafiles.size(),
+        total_disk_used.load(),
+        actual_data_size.load(),
+        num_compactions.load(),
+        recovery_ms,
+        recovery_peak_keys,
+        keydir_memory,
+        num_keys == 0 ? 0.0 : static_cast<double>(keydir_memory) / num_keys,
+        _key_index ? _key_index->memory_usage() : 0,
+        keydir_disk_bytes,
+        _cache ? _cache->hits() : 0,
+        _cache ? _cache->misses() : 0,
+        _cache ? _cache->evictions() : 0,
+        _cache ? _cache->bytes() : 0,
+        _compaction_limiter.waited_ms(),
+        compression_input_bytes.load(),
+        compression_output_bytes.load(),
+        compression_output_bytes == 0 ? 1.0 : static_cast<double>(compression_input_bytes) / compression_output_bytes,
+        _ring != nullptr
+    };
+}
+void Rocask::check_writable() const {
+    if(_options.read_only) {
+        throw ReadOnlyError("This node is a read only follower, writes go to its leader.");
+    }
+}
+
+LogPosition Rocask::log_end() {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    return LogPosition{_writer.file_id(), _writer.offset()};
+}
+
+// how much of records, bytes of a datafile from a record on, is whole
+// records and batches
+static uint64_t whole_records(const char *records, uint64_t size, CrcKind crc_kind, uint8_t version) {
+    uint64_t pos = 0;
+    uint64_t whole = 0;
+    bool in_batch = false;
+    while(pos < size) {
+        uint64_t record_size = validate_record(records + pos, size - pos, crc_kind, version);
+        if(record_size == 0) {
+            break;
+        }
+        RecordHeader header = read_record_header(records + pos, version);
+        if(header.key_size == BATCH_BEGIN) {
+            in_batch = true;
+        } else if(header.key_size == BATCH_COMMIT) {
+            in_batch = false;
+        }
+        pos += record_size;
+        if(!in_batch) {
+            whole = pos;
+        }
+    }
+    return whole;
+}
+
+bool Rocask::read_log(LogPosition& position, uint64_t max_bytes, LogChunk& chunk) {
+    chunk.records.clear();
+    while(true) {
+        DataFile datafile;
+        uint64_t end;
+        std::optional<uint64_t> next_file;
+        std::shared_ptr<FileHandle> handle;
+        {
+            std::lock_guard<std::mutex> lock(_write_mutex);
+            auto it = std::lower_bound(_log_files.begin(), _log_files.end(), position.file_id);
+            if(it == _log_files.end() || *it != position.file_id) {
+                return false;
+            }
+            if(std::next(it) != _log_files.end()) {
+                next_file = *std::next(it);
+            }
+
+            // compaction drops files under _file_mutex, the handle keeps this
+            // one readable after that
+            std::shared_lock file_lock(_file_mutex);
+            if(!_datafiles.contains(position.file_id)) {
+                return false;
+            }
+            datafile = _datafiles.get(position.file_id);
+            bool active = position.file_id == _writer.file_id();
+            end = active ? _writer.offset() : fs::file_size(datafile.path);
+
+            position.offset = std::max(position.offset, datafile.version > 0 ? DATAFILE_HEADER_SIZE : 0);
+            // the leader lost a tail the follower already has
+            if(position.offset > end) {
+                return false;
+            }
+            if(position.offset == end) {
+                if(active || !next_file) {
+                    return true;
+                }
+                position = LogPosition{*next_file, 0};
+                continue;
+            }
+
+            handle = _handles.acquire(position.file_id, datafile.path);
+            if(!handle) {
+                throw std::runtime_error("Could not open datafile " + std::to_string(position.file_id));
+            }
+        }
+
+        // max_bytes, or more when the first batch doesn't fit in that
+        uint64_t available = end - position.offset;
+        uint64_t size = std::min(available, std::max(max_bytes, RECORD_HEADER_SIZE));
+        uint64_t whole;
+        while(true) {
+            chunk.records.resize(size);
+            if(!read_at(*handle, position.offset, size, chunk.records.data())) {
+                throw std::runtime_error("Short read from datafile " + std::to_string(position.file_id));
+            }
+            whole = whole_records(chunk.records.data(), size, datafile.crc_kind, datafile.version);
+            if(whole > 0 || size == available) {
+                break;
+            }
+            size = std::min(available, size * 2);
+        }
+        if(whole == 0) {
+            std::cerr << "Error: " << "invalid record at " << position.offset << " in datafile " 
+                      << position.file_id << ", can't replicate past it" << std::endl;
+            chunk.records.clear();
+            return false;
+        }
+
+        chunk.records.resize(whole);
+        chunk.start = position;
+        chunk.crc_kind = datafile.crc_kind;
+        chunk.version = datafile.version;
+        position.offset += whole;
+        return true;
+    }
+}
+
+uint64_t Rocask::log_bytes_after(const LogPosition& position) {
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    auto it = std::lower_bound(_log_files.begin(), _log_files.end(), position.file_id);
+    if(it == _log_files.end() || *it != position.file_id) {
+        return UINT64_MAX;
+    }
+
+    uint64_t bytes = 0;
+    for(; it != _log_files.end(); ++it) {
+        if(!_datafiles.contains(*it)) {
+            return UINT64_MAX;
+        }
+        uint64_t start = _datafiles.get(*it).version > 0 ? DATAFILE_HEADER_SIZE : 0;
+        if(*it == position.file_id) {
+            start = std::max(start, position.offset);
+        }
+
+        std::lock_guard<std::mutex> usage_lock(_usage_mutex);
+        auto usage = _file_usage.find(*it);
+        if(usage != _file_usage.end() && usage->second.total_bytes > start) {
+            bytes += usage->second.total_bytes - start;
+        }
+    }
+    return bytes;
+}
+
+void Rocask::wait_log(const LogPosition& position, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(_write_mutex);
+    _log_cv.wait_for(lock, timeout, [this, &position] {
+        return !(LogPosition{_writer.file_id(), _writer.offset()} == position);
+    });
+}
+
+void Rocask::retain_log(uint64_t file_id) {
+    _log_retained_from.store(file_id);
+}
+
+void Rocask::snapshot(uint64_t max_bytes, const std::function<void(std::vector<LogRecord>&)>& emit) {
+    std::vector<std::string> keys;
+    _keydir.for_each([&keys](const std::string& key, const KeyDirEntry&) {
+        keys.push_back(key);
+    });
+
+    std::vector<LogRecord> records;
+    uint64_t bytes = 0;
+    for(const std::string& key : keys) {
+        std::optional<LogRecord> record = stored_record(key);
+        if(!record) {
+            continue;
+        }
+        bytes += key.size() + record->value.size();
+        records.push_back(std::move(*record));
+        if(bytes >= max_bytes) {
+            emit(records);
+            records.clear();
+            bytes = 0;
+        }
+    }
+    if(!records.empty()) {
+        emit(records);
+    }
+}
+
+// key's value as it's stored, nullopt once it's deleted or expired
+std::optional<LogRecord> Rocask::stored_record(const std::string& key) {
+    ValueLocation location;
+    try {
+        location = locate_value(key);
+    } catch(const std::out_of_range&) {
+        return std::nullopt;
+    }
+    const KeyDirEntry& entry = location.entry;
+    LogRecord record{key, std::string(), entry.timestamp, entry.expiry, entry.codec};
+
+    // the cache holds decoded values
+    if(location.cached) {
+        record.value = *location.cached;
+        record.codec = Codec::None;
+        return record;
+    }
+
+    record.value.resize(entry.value_size);
+    if(location.mapping) {
+        std::memcpy(record.value.data(), location.mapping->data() + entry.value_pos, entry.value_size);
+    } else if(!read_at(*location.handle, entry.value_pos, entry.value_size, record.value.data())) {
+        throw std::runtime_error("Short read from datafile " + std::to_string(entry.file_id));
+    }
+    return record;
+}
+
+void Rocask::apply_log(const LogChunk& chunk) {
+    const char *records = chunk.records.data();
+    uint64_t size = chunk.records.size();
+    uint64_t header_size = record_header_size(chunk.version);
+
+    // a write per record or batch, all pointing at their keys in here
+    std::deque<std::string> keys;
+    std::vector<PendingWrite> writes;
+    bool in_batch = false;
+
+    uint64_t pos = 0;
+    while(pos < size) {
+        const char *record = records + pos;
+        uint64_t record_size = validate_record(record, size - pos, chunk.crc_kind, chunk.version);
+        if(record_size == 0) {
+            throw std::runtime_error("Invalid record in replicated chunk of datafile " + std::to_string(chunk.start.file_id));
+        }
+        pos += record_size;
+
+        RecordHeader header = read_record_header(record, chunk.version);
+        if(header.key_size == BATCH_BEGIN) {
+            PendingWrite& pending = writes.emplace_back();
+            pending.timestamp = header.timestamp;
+            pending.atomic = true;
+            pending.record.resize(RECORD_HEADER_SIZE);
+            write_batch_marker(pending.record.data(), _options.crc_kind, BATCH_BEGIN, header.timestamp, header.value_size);
+            in_batch = true;
+            continue;
         }
+        if(header.key_size == BATCH_COMMIT) {
+            PendingWrite& pending = writes.back();
+            size_t commit_pos = pending.record.size();
+            pending.record.resize(commit_pos + RECORD_HEADER_SIZE);
+            write_batch_marker(pending.record.data() + commit_pos, _options.crc_kind, BATCH_COMMIT, pending.timestamp, pending.entries.size());
+            in_batch = false;
+            continue;
+        }
+
+        if(!codec_available(header.codec)) {
+            throw std::runtime_error(std::string("Replicated value uses codec ") + codec_name(header.codec) + ", which this build lacks.");
+        }
+        if(!in_batch) {
+            writes.emplace_back().timestamp = header.timestamp;
+        }
+        const std::string& key = keys.emplace_back(record + header_size, header.key_size);
+        std::string_view stored(record + header_size + header.key_size, header.value_size);
+        encode_stored(writes.back(), key, stored, header.codec, header.expiry);
     }
-}
\ No newline at end of file
+    if(in_batch) {
+        throw std::runtime_error("Replicated chunk of datafile " + std::to_string(chunk.start.file_id) + " ends inside a batch.");
+    }
+
+    submit_writes(writes);
+}
+
+void Rocask::apply_records(const std::vector<LogRecord>& records) {
+    std::vector<PendingWrite> writes(records.size());
+    for(size_t i = 0; i < records.size(); i++) {
+        if(records[i].key.size() > MAX_KEY_SIZE) {
+            throw std::invalid_argument("Key is larger than " + std::to_string(MAX_KEY_SIZE) + " bytes.");
+        }
+        if(!codec_available(records[i].codec)) {
+            throw std::runtime_error(std::string("Replicated value uses codec ") + codec_name(records[i].codec) + ", which this build lacks.");
+        }
+        writes[i].timestamp = records[i].timestamp;
+        encode_stored(writes[i], records[i].key, records[i].value, records[i].codec, records[i].expiry);
+    }
+    submit_writes(writes);
+}
+
+void Rocask::clear() {
+    std::vector<std::string> keys;
+    _keydir.for_each([&keys](const std::string& key, const KeyDirEntry&) {
+        keys.push_back(key);
+    });
+
+    // tombstones, a few thousand to a write. A snapshot applied next carries
+    // the leader's older timestamps, commit_batch stamps its records past
+    // these so they still win on recovery
+    const size_t keys_per_write = 4096;
+    std::vector<PendingWrite> writes((keys.size() + keys_per_write - 1) / keys_per_write);
+    uint64_t timestamp = get_timestamp();
+    for(size_t i = 0; i < keys.size(); i++) {
+        PendingWrite& pending = writes[i / keys_per_write];
+        pending.timestamp = timestamp;
+        encode_stored(pending, keys[i], std::string_view(), Codec::None, TOMBSTONE_EXPIRY);
+    }
+    submit_writes(writes);
+}
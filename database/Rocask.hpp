@@ -2,64 +2,331 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cctype>
+#include <chrono>
 #include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "BlockIO.hpp"
 #include "crc.hpp"
+#include "DataFileWriter.hpp"
+#include "FileTable.hpp"
+#include "IoRing.hpp"
+#include "KeyDir.hpp"
+#include "MappedFile.hpp"
+#include "RateLimiter.hpp"
+#include "Record.hpp"
+#include "ValueCache.hpp"
 #include "../datastructures/SafeMap.hpp"
+#include "../datastructures/SkipList.hpp"
 #include "utils.hpp"
 
 namespace fs = std::filesystem;
 
 const uint64_t MAX_FILE_SIZE = 8 * 1024 * 1024;
 const uint64_t CARE_ENOUGH = 10 * 1024 * 1024; // couldn't think of a variable name
-const double COMPACTION_THRESHOLD = 1.5;
 
-struct KeyDirEntry {
-    uint64_t file_id;
-    uint64_t value_size;
-    uint64_t value_pos;
-    uint64_t timestamp;
+// multi_read merges values of one file into a single read when they are
+// at most MGET_COALESCE_GAP apart, up to MGET_MAX_SPAN per read
+const uint64_t MGET_COALESCE_GAP = 4 * 1024;
+const uint64_t MGET_MAX_SPAN = 1024 * 1024;
+
+// compaction reads its inputs and writes its output in blocks of this size
+const uint64_t COMPACTION_BLOCK_SIZE = 1024 * 1024;
+
+// the keydir packs file offsets into PackedKeyDirEntry::VALUE_POS_BITS
+static_assert(
+    MAX_FILE_SIZE <= (uint64_t(1) << PackedKeyDirEntry::VALUE_POS_BITS),
+    "MAX_FILE_SIZE must fit in the keydir's packed value_pos"
+);
+
+// when appended records are fdatasync'ed
+enum class SyncPolicy {
+    None,       // leave it to the page cache
+    Interval,   // background fdatasync every sync_interval_ms
+    EveryBatch  // each group commit syncs before acknowledging its writers
+};
+
+struct RocaskOptions {
+    SyncPolicy sync_policy = SyncPolicy::None;
+    uint64_t sync_interval_ms = 100;
+
+    // checksum for new datafiles, CRC32C runs on the SSE4.2 instruction
+    CrcKind crc_kind = CrcKind::Crc32c;
+    // read the whole record on GET and check it against its crc
+    bool verify_reads = false;
+    // serve reads of sealed datafiles from read-only mappings
+    bool mmap_reads = false;
+    // bytes of recently read values kept in memory, 0 disables the cache
+    uint64_t cache_capacity = 0;
+    // reads, appends and fdatasync through one shared io_uring of
+    // io_uring_entries, pread/pwrite where the kernel doesn't allow it
+    bool io_uring = false;
+    unsigned io_uring_entries = 256;
+
+    // a sealed file gets rewritten once this share of it is dead, at most
+    // compaction_max_input bytes of input files per round
+    double compaction_garbage_ratio = 0.5;
+    uint64_t compaction_max_input = 8 * MAX_FILE_SIZE;
+    // bytes/sec compaction may read plus write, 0 for no limit
+    uint64_t compaction_rate_limit = 0;
+    // a round is split into this many groups of files, merged in parallel
+    unsigned compaction_workers = 1;
+
+    // codec for values of at least compression_min_size bytes, a value the
+    // codec can't shrink is stored raw
+    Codec compression = Codec::None;
+    uint64_t compression_min_size = 256;
+    // compaction rewrites copied values into the configured codec
+    bool compaction_recompress = true;
+
+    // a replication follower, only apply_log and friends may write
+    bool read_only = false;
 
-    bool operator==(const KeyDirEntry& other) {
-        return file_id == other.file_id && 
-               value_size == other.value_size && 
-               value_pos == other.value_pos && 
-               timestamp == other.timestamp; 
+    // keys also kept in order, so scan doesn't sort the whole keyspace.
+    // Another copy of every key plus ~40 bytes of skip list node
+    bool ordered_index = false;
+
+    // the keydir in memory-mapped files under keydir/<id>/ rather than in
+    // memory, for more keys than fit in RAM. A lookup in a bucket the page
+    // cache dropped costs one more read. Rebuilt on every open like the
+    // in-memory one, and pointless with ordered_index
+    bool disk_keydir = false;
+};
+
+struct DataFile {
+    std::string path;
+    CrcKind crc_kind;
+    uint8_t version; // record layout, see Record.hpp
+    bool sealed;     // never appended to again
+    bool log = false; // written by the writer, not compaction (see read_log)
+};
+
+// A value and whatever keeps its bytes valid: the mapping of a sealed
+// datafile (even after compaction drops the file) or a private copy.
+class ValueView {
+    public:
+    ValueView() = default;
+    ValueView(std::shared_ptr<const void> pin, std::string_view data) : pin_(std::move(pin)), data_(data) {}
+
+    std::string_view data() const { return data_; }
+    size_t size() const { return data_.size(); }
+
+    private:
+    std::shared_ptr<const void> pin_;
+    std::string_view data_;
+};
+
+struct RocaskStats {
+    uint64_t num_keys;
+    uint64_t num_datafiles;
+    uint64_t total_disk_used;
+    uint64_t actual_data_size;
+    uint64_t num_compactions;
+    uint64_t recovery_ms;
+    // most entries recovery held in per-file maps at once, before they went
+    // into the keydir
+    uint64_t recovery_peak_keys;
+
+    // for sizing nodes, what the in-memory index costs
+    uint64_t keydir_memory;
+    double keydir_bytes_per_key;
+    // the ordered index, 0 without options.ordered_index
+    uint64_t key_index_memory;
+    // files of options.disk_keydir, keydir_memory is then just what's left in memory
+    uint64_t keydir_disk_bytes;
+
+    // value cache, all zero when it is disabled
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t cache_evictions;
+    uint64_t cache_bytes;
+
+    // time compaction spent waiting on compaction_rate_limit
+    uint64_t compaction_throttled_ms;
+
+    // bytes given to the codec and what came out, from writes and compaction
+    uint64_t compression_input_bytes;
+    uint64_t compression_output_bytes;
+    double compression_ratio;
+
+    // options.io_uring was asked for and the kernel went along
+    bool io_uring;
+};
+
+// one page of Rocask::scan
+struct ScanPage {
+    std::vector<std::pair<std::string, std::string>> items; // in key order
+    // the range may go on, the next page starts right after last_key
+    bool more = false;
+    std::string last_key;
+};
+
+// A place in the replication log, see Rocask::read_log
+struct LogPosition {
+    uint64_t file_id = 0;
+    uint64_t offset = 0; // 0 for the first record of the file
+
+    bool operator==(const LogPosition& other) const {
+        return file_id == other.file_id && offset == other.offset;
+    }
+    bool operator<(const LogPosition& other) const {
+        return file_id != other.file_id ? file_id < other.file_id : offset < other.offset;
     }
 };
 
+// records as they sit in a datafile of that crc_kind and version
+struct LogChunk {
+    LogPosition start;
+    CrcKind crc_kind = CrcKind::Crc32c;
+    uint8_t version = DATAFILE_VERSION;
+    std::string records; // whole records and batches
+};
+
+// one live key of a snapshot, its value as stored (compressed with codec)
+struct LogRecord {
+    std::string key;
+    std::string value;
+    uint64_t timestamp;
+    uint64_t expiry;
+    Codec codec;
+};
+
+// a write to a read only follower (RocaskOptions::read_only)
+class ReadOnlyError : public std::runtime_error {
+    public:
+    using std::runtime_error::runtime_error;
+};
+
 class Rocask {
     public:
-    Rocask(int id);
+    Rocask(int id, RocaskOptions options = RocaskOptions());
     ~Rocask();
 
+    // a key written with a ttl reads as missing once ttl_seconds have passed
     template<typename K, typename V>
-    void write(const K& key, const V& value);
+    void write(const K& key, const V& value, uint64_t ttl_seconds = 0);
+
+    // writes a tombstone, false if there was no such key
+    template<typename K>
+    bool remove(const K& key);
+
+    // all or nothing, in one append that never spans two datafiles
+    template<typename K, typename V>
+    void write_batch(const std::vector<std::pair<K, V>>& items);
 
     // write, read and compaction/merge
     template<typename K, typename V>
     V read(const K& key);
     void compaction();
 
+    // takes effect immediately, also for a compaction that is running
+    void set_compaction_rate_limit(uint64_t bytes_per_sec);
+
+    // no copy when the value lives in a mapped, sealed datafile
+    ValueView read_view(const std::string& key);
+
+    // output becomes prefix | value | suffix, a raw value is read (or copied
+    // from its mapping or the cache) straight into place, so a response body
+    // can be built without an intermediate copy
+    void read_framed(const std::string& key, std::string_view prefix, std::string_view suffix, std::string& output);
+
+    // one slot per key, nullopt where the key doesn't exist
+    std::vector<std::optional<std::string>> multi_read(const std::vector<std::string>& keys);
+
+    // Up to limit keys from start (inclusive) to end (exclusive, none for no
+    // bound) with their values, read like multi_read: per file, in offset
+    // order. A key deleted or expired meanwhile is left out of items but
+    // still counts toward limit. Sorts every key in memory unless
+    // options.ordered_index is set
+    ScanPage scan(const std::string& start, const std::optional<std::string>& end, size_t limit);
+    // the keys starting with prefix, from start on if it's past prefix
+    ScanPage prefix_scan(const std::string& prefix, size_t limit, const std::string& start = "");
+
+    // Callback versions of read, write and multi_read, for callers that
+    // can't park a thread per request (api/AsyncRocask.hpp turns them into
+    // asio operations). done gets the exception the blocking call would
+    // have thrown, or null. With io_uring a read's done runs on the thread
+    // that reaped it; cache hits, mapped values and reads without a ring
+    // complete inline. A write returns right away, its done runs on the group
+    // commit leader, usually the commit thread. Either way it should hand off
+    // anything slow
+    using ReadCallback = std::function<void(std::exception_ptr, std::string)>;
+    using WriteCallback = std::function<void(std::exception_ptr)>;
+    using MultiReadCallback = std::function<void(std::exception_ptr, std::vector<std::optional<std::string>>)>;
+    void read_async(const std::string& key, ReadCallback done);
+    void write_async(const std::string& key, const std::string& value, uint64_t ttl_seconds, WriteCallback done);
+    void multi_read_async(const std::vector<std::string>& keys, MultiReadCallback done);
+
+    // Replication (see replication/). The log is what the writer appended,
+    // its datafiles in the order they were written, compaction output isn't
+    // part of it. A follower tails it from a position and applies records as
+    // they were written: same timestamps, expiry and stored bytes.
+    LogPosition log_end();
+    // about max_bytes of records from position on (a batch is never split)
+    // and position moved past them, chunk.records is empty at the end of the
+    // log. false when position isn't in the log (any more), the follower has
+    // to start over from a snapshot
+    bool read_log(LogPosition& position, uint64_t max_bytes, LogChunk& chunk);
+    // log bytes from position to the end, UINT64_MAX when it isn't in the log
+    uint64_t log_bytes_after(const LogPosition& position);
+    // returns once something is appended past position, or after timeout
+    void wait_log(const LogPosition& position, std::chrono::milliseconds timeout);
+    // compaction leaves log files from file_id on alone, UINT64_MAX for none
+    void retain_log(uint64_t file_id);
+    // every live key in runs of about max_bytes, for a follower starting over.
+    // Writes go on meanwhile, a key may come with a newer value than the
+    // log_end taken before it
+    void snapshot(uint64_t max_bytes, const std::function<void(std::vector<LogRecord>&)>& emit);
+
+    // follower side, these write even when options.read_only is set
+    void apply_log(const LogChunk& chunk);
+    void apply_records(const std::vector<LogRecord>& records);
+    // deletes every key
+    void clear();
+
+    RocaskStats stats();
+
     private:
     // datafiles folder
     int db_id;
+    RocaskOptions _options;
     std::string datafiles_folder;
+    std::string hintfiles_folder;
+    std::string keydir_folder; // options.disk_keydir
 
     // KeyDir datastructures
-    SafeMap<std::string, KeyDirEntry> _keydir;
-    SafeMap<uint64_t, std::string> _datafiles;
+    KeyDir _keydir;
+    // the keydir's keys in order, null unless options.ordered_index. Keys
+    // join it when the keydir gains them and leave when they're removed
+    std::unique_ptr<SkipList<std::string>> _key_index;
+    SafeMap<uint64_t, DataFile> _datafiles;
+
+    // cached read handles, keyed like _datafiles
+    FileTable _handles;
+
+    // null unless options.io_uring is set and available
+    std::shared_ptr<IoRing> _ring;
+
+    // null unless options.cache_capacity is set
+    std::unique_ptr<ValueCache> _cache;
     
     // compaction
     std::thread _compaction_thread;
@@ -67,40 +334,218 @@ class Rocask {
     std::condition_variable _compaction_cv;
     bool _compact = false; 
     bool _shutdown = false;
+    RateLimiter _compaction_limiter;
 
     // file_id
     std::atomic<uint64_t> file_index{0};
     std::atomic<uint64_t> active_file_id{0};
 
+    // active datafile, appends and rollover happen under _write_mutex
+    DataFileWriter _writer{MAX_FILE_SIZE};
+    std::mutex _write_mutex;
+    // newest timestamp in the log, timestamps only go up down the log
+    uint64_t _last_timestamp = 0;
+
+    // group commit: writers queue encoded records, whoever finds no leader
+    // becomes one and appends everything queued so far in one writev
+    struct PendingWrite {
+        struct Entry {
+            const std::string *key;
+            uint64_t value_size;
+            uint64_t value_offset; // from the start of record
+            uint64_t record_size;
+            uint64_t expiry;       // TOMBSTONE_EXPIRY for a delete
+            Codec codec;
+        };
+        std::vector<char> record; // one record, or a whole batch with its markers
+        std::vector<Entry> entries;
+        uint64_t timestamp;
+        bool atomic = false;      // a batch, published to readers all at once
+        bool done = false;
+        std::exception_ptr error;
+
+        // write_async: nobody waits, the leader calls on_done and deletes it
+        std::string owned_key;
+        std::function<void(std::exception_ptr)> on_done;
+    };
+    std::vector<PendingWrite*> _commit_queue;
+    std::mutex _commit_mutex;
+    std::condition_variable _commit_cv;
+    bool _commit_leader = false;
+    unsigned _async_writes_queued = 0;
+    // leads whenever async writes wait and no writer is leading
+    std::thread _commit_thread;
+    bool _commit_shutdown = false;
+
+    // SyncPolicy::Interval
+    std::thread _sync_thread;
+    std::mutex _sync_mutex;
+    std::condition_variable _sync_cv;
+    bool _sync_shutdown = false;
+
     // file I/O RW lock
     std::shared_mutex _file_mutex;
 
+    // per datafile byte counts, what compaction picks its inputs from
+    struct FileUsage {
+        uint64_t total_bytes = 0;     // everything appended, markers and tombstones too
+        uint64_t live_bytes = 0;      // records the keydir points at
+        uint64_t expiring_bytes = 0;  // the part of live_bytes with a ttl
+        uint64_t max_expiry = 0;      // all expiring_bytes are dead after this
+        uint64_t recode_bytes = 0;    // the part of live_bytes compaction would recompress
+        uint64_t min_timestamp = UINT64_MAX;
+        uint64_t header_size = RECORD_HEADER_SIZE;
+
+        uint64_t dead_bytes(uint64_t now_seconds) const {
+            uint64_t dead = total_bytes - live_bytes;
+            if(expiring_bytes > 0 && max_expiry <= now_seconds) {
+                dead += expiring_bytes;
+            }
+            return dead;
+        }
+    };
+    std::unordered_map<uint64_t, FileUsage> _file_usage;
+    // files some compaction is merging right now, nobody else may pick them
+    std::unordered_set<uint64_t> _compacting;
+    std::mutex _usage_mutex;
+
     // memory size 
-    uint64_t total_disk_used = 0;
-    uint64_t actual_data_size = 0;
+    std::atomic<uint64_t> total_disk_used{0};
+    std::atomic<uint64_t> actual_data_size{0};
+    std::atomic<uint64_t> compression_input_bytes{0};
+    std::atomic<uint64_t> compression_output_bytes{0};
 
     //helper
-    void process_datafile(const std::string &path, const uint64_t& file_id);
+    void load_datafiles();
+    void merge_entry(const std::string& key, const KeyDirEntry& entry);
+    using KeyDirFragment = std::unordered_map<std::string, KeyDirEntry>;
+    std::optional<DataFileHeader> process_datafile(const std::string &path, uint64_t file_id, KeyDirFragment& fragment);
+    std::optional<DataFileHeader> datafile_header(const std::string& path);
+    void process_hintfile(const std::string &path, uint8_t version, KeyDirFragment& fragment);
+    std::string hintfile_path(uint64_t file_id) const;
     void build_data_buffer(
         char *buffer_ptr, 
         uint64_t timestamp,
+        uint64_t expiry,
         uint64_t key_size,
         uint64_t value_size,
-        const std::string& key,
-        const std::string& value
+        Codec codec,
+        std::string_view key,
+        std::string_view value
     );
 
     // helper as well, but write/read
-    void raw_write(const std::string& key, const std::string& value);
+    void raw_write(const std::string& key, const std::string& value, uint64_t ttl_seconds);
+    static uint64_t expiry_after(uint64_t ttl_seconds);
+    bool raw_remove(const std::string& key);
+    void raw_write_batch(const std::vector<std::pair<std::string, std::string>>& items);
+    void encode_record(PendingWrite& pending, const std::string& key, const std::string& value, uint64_t expiry);
+    void encode_stored(PendingWrite& pending, const std::string& key, std::string_view stored, Codec codec, uint64_t expiry);
+
+    // Codec::None when the value is stored raw, otherwise output holds it
+    Codec compress_value(std::string_view value, std::string& output);
+    std::string decode_value(const KeyDirEntry& entry, std::string_view stored);
+    void submit_write(PendingWrite& pending);
+    void submit_writes(std::vector<PendingWrite>& writes);
+    void submit_write_async(std::unique_ptr<PendingWrite> pending);
+    void lead_commits(std::unique_lock<std::mutex>& lock);
+    void commit_worker();
     std::string raw_read(std::string key);
 
+    // what a read needs to get at a value without holding any lock
+    struct ValueLocation {
+        KeyDirEntry entry;
+        CrcKind crc_kind;
+        uint8_t version;
+        std::shared_ptr<const MappedFile> mapping; // sealed file in mmap mode
+        std::shared_ptr<FileHandle> handle;        // otherwise
+        std::shared_ptr<const std::string> cached; // value cache hit, nothing pinned
+    };
+    ValueLocation locate_value(const std::string& key);
+    void pin_datafile(ValueLocation& location);
+    std::string load_value(const std::string& key, const ValueLocation& location);
+    uint64_t value_read_pos(const std::string& key, const ValueLocation& location) const;
+    std::string value_from(const std::string& key, const ValueLocation& location, const char *bytes);
+    // pread or the ring, false on a short read
+    bool read_at(const FileHandle& file, uint64_t offset, uint64_t size, char *output, int buffer_index = -1);
+    std::string fetch_value(const std::string& key, const ValueLocation& location);
+    bool expire_entry(const std::string& key, const KeyDirEntry& entry);
+    std::vector<std::string> scan_keys(const std::string& start, const std::optional<std::string>& end, size_t limit);
+
+    // multi_read in steps, so the reads in between can be async
+    struct MultiRead {
+        struct FileReads {
+            ValueLocation location;
+            std::vector<std::pair<size_t, KeyDirEntry>> reads; // index into keys, entry
+        };
+        // runs of nearby values, one read each
+        struct Span {
+            uint64_t file_id;
+            const FileReads *file;
+            size_t run_start;
+            size_t run_end;
+            uint64_t start;
+            uint64_t end;
+            const char *base = nullptr; // null until it's read
+            std::string storage;
+            IoRing::Buffer buffer;
+        };
+
+        const std::vector<std::string> *keys = nullptr;
+        bool verify = false;
+        std::unordered_map<uint64_t, FileReads> files;
+        std::vector<Span> spans;
+        std::vector<std::optional<std::string>> values;
+
+        // verifying reads need the header and key in front of each value too
+        uint64_t read_start(const FileReads& file, size_t i) const;
+        uint64_t read_end(const FileReads& file, size_t i) const;
+    };
+    void plan_multi_read(MultiRead& plan, const std::vector<std::string>& keys);
+    void finish_multi_read(MultiRead& plan);
+    void check_record(
+        const char *record, 
+        const std::string& key, 
+        const KeyDirEntry& entry, 
+        CrcKind crc_kind, 
+        uint8_t version
+    );
+    void commit_batch(std::vector<PendingWrite*>& batch);
+    void roll_active_file();
+    void sync_worker();
+
+    // usage accounting
+    void account_append(uint64_t file_id, uint64_t bytes, uint64_t timestamp);
+    void account_live(const std::string& key, const KeyDirEntry& entry);
+    void account_dead(const std::string& key, const KeyDirEntry& entry);
+    bool needs_recode(const KeyDirEntry& entry) const;
+
+    // replication log, the ids of the writer's files in order. Under
+    // _write_mutex, and in datafiles_folder/log so a file compaction dropped
+    // still leaves its gap after a restart
+    std::vector<uint64_t> _log_files;
+    std::condition_variable _log_cv; // appends, waited on with _write_mutex
+    std::atomic<uint64_t> _log_retained_from{UINT64_MAX};
+    void load_log_files(const std::vector<uint64_t>& file_ids);
+    void add_log_file(uint64_t file_id);
+    void save_log_files();
+    std::optional<LogRecord> stored_record(const std::string& key);
+    void check_writable() const;
+
     // compaction helper
+    std::vector<uint64_t> pick_compaction_files(
+        const std::vector<std::pair<uint64_t, DataFile>>& datafiles,
+        uint64_t active_id
+    );
+    void merge_files(const std::vector<std::pair<uint64_t, DataFile>>& inputs, uint64_t outside_min_timestamp);
     bool compaction_conditions();
     void trigger_compaction(); 
     void compaction_worker();
 
     // statistics
-    uint64_t num_compactions = 0;
+    std::atomic<uint64_t> num_compactions{0};
+    uint64_t recovery_ms = 0;
+    uint64_t recovery_peak_keys = 0;
 };
 
 template<typename K, typename V>
@@ -112,8 +557,24 @@ V Rocask::read(const K& key) {
 }
 
 template<typename K, typename V>
-void Rocask::write(const K& key, const V& value) {
+void Rocask::write(const K& key, const V& value, uint64_t ttl_seconds) {
     std::string raw_key = serialize<K>(key);
     std::string raw_value = serialize<V>(value);
-    raw_write(raw_key, raw_value);
+    raw_write(raw_key, raw_value, ttl_seconds);
+}
+
+template<typename K>
+bool Rocask::remove(const K& key) {
+    std::string raw_key = serialize<K>(key);
+    return raw_remove(raw_key);
+}
+
+template<typename K, typename V>
+void Rocask::write_batch(const std::vector<std::pair<K, V>>& items) {
+    std::vector<std::pair<std::string, std::string>> raw_items;
+    raw_items.reserve(items.size());
+    for(const auto& [key, value] : items) {
+        raw_items.emplace_back(serialize<K>(key), serialize<V>(value));
+    }
+    raw_write_batch(raw_items);
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "KeyDir.hpp"
+
+// Byte-bounded value cache in front of the datafiles, split into NumShards
+// independently locked CLOCK rings. Every entry remembers the KeyDirEntry it
+// was read through, a lookup with a different entry (the key was rewritten
+// or compaction moved it) is a miss, so the cache can never serve stale data.
+class ValueCache {
+    public:
+    static const size_t NumShards = 16;
+
+    explicit ValueCache(uint64_t capacity_bytes) : shard_capacity_(capacity_bytes / NumShards) {}
+
+    ValueCache(const ValueCache&) = delete;
+    ValueCache& operator=(const ValueCache&) = delete;
+
+    std::shared_ptr<const std::string> find(const std::string& key, const KeyDirEntry& version) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.index.find(key);
+        if(it == shard.index.end()) {
+            misses_++;
+            return nullptr;
+        }
+
+        Slot& slot = shard.slots[it->second];
+        if(!(slot.version == version)) {
+            shard.release(it->second);
+            shard.index.erase(it);
+            misses_++;
+            return nullptr;
+        }
+
+        slot.referenced = true;
+        hits_++;
+        return slot.value;
+    }
+
+    void insert(const std::string& key, const KeyDirEntry& version, std::shared_ptr<const std::string> value) {
+        uint64_t charge = charge_of(key, *value);
+        // one huge value shouldn't flush a whole shard
+        if(charge > shard_capacity_ / 4) {
+            return;
+        }
+
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.index.find(key);
+        if(it != shard.index.end()) {
+            shard.release(it->second);
+            shard.index.erase(it);
+        }
+
+        while(shard.bytes + charge > shard_capacity_) {
+            evict_one(shard);
+        }
+
+        size_t pos = shard.acquire();
+        Slot& slot = shard.slots[pos];
+        slot.key = key;
+        slot.version = version;
+        slot.value = std::move(value);
+        slot.charge = charge;
+        slot.referenced = false;
+        slot.used = true;
+
+        shard.bytes += charge;
+        shard.index.emplace(key, pos);
+    }
+
+    // writes drop the old value right away instead of waiting for a miss
+    void erase(const std::string& key) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.index.find(key);
+        if(it != shard.index.end()) {
+            shard.release(it->second);
+            shard.index.erase(it);
+        }
+    }
+
+    uint64_t hits() const { return hits_.load(); }
+    uint64_t misses() const { return misses_.load(); }
+    uint64_t evictions() const { return evictions_.load(); }
+
+    uint64_t bytes() {
+        uint64_t total = 0;
+        for(Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.bytes;
+        }
+        return total;
+    }
+
+    private:
+    struct Slot {
+        std::string key;
+        KeyDirEntry version;
+        std::shared_ptr<const std::string> value;
+        uint64_t charge = 0;
+        bool referenced = false;
+        bool used = false;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, size_t> index;
+        std::vector<Slot> slots;
+        std::vector<size_t> free_slots;
+        size_t hand = 0;
+        uint64_t bytes = 0;
+
+        size_t acquire() {
+            if(!free_slots.empty()) {
+                size_t pos = free_slots.back();
+                free_slots.pop_back();
+                return pos;
+            }
+            slots.emplace_back();
+            return slots.size() - 1;
+        }
+
+        // frees the slot, the caller removes it from index
+        void release(size_t pos) {
+            Slot& slot = slots[pos];
+            bytes -= slot.charge;
+            slot.key.clear();
+            slot.value.reset();
+            slot.charge = 0;
+            slot.used = false;
+            free_slots.push_back(pos);
+        }
+    };
+
+    uint64_t shard_capacity_;
+    std::array<Shard, NumShards> shards_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+
+    // value plus key plus a rough per-entry overhead
+    static uint64_t charge_of(const std::string& key, const std::string& value) {
+        return value.size() + key.size() + sizeof(Slot) + 32;
+    }
+
+    Shard& shard_for(const std::string& key) {
+        uint64_t h = static_cast<uint64_t>(std::hash<std::string>{}(key)) * 0x9E3779B97F4A7C15ull;
+        return shards_[(h >> 32) % NumShards];
+    }
+
+    // second chance: referenced slots lose their bit and survive one more sweep
+    void evict_one(Shard& shard) {
+        while(true) {
+            if(shard.hand >= shard.slots.size()) {
+                shard.hand = 0;
+            }
+            Slot& slot = shard.slots[shard.hand];
+            size_t pos = shard.hand++;
+
+            if(!slot.used) {
+                continue;
+            }
+            if(slot.referenced) {
+                slot.referenced = false;
+                continue;
+            }
+
+            shard.index.erase(slot.key);
+            shard.release(pos);
+            evictions_++;
+            return;
+        }
+    }
+};
@@ -0,0 +1,238 @@
+#include "crc.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ROCASK_X86_CRC 1
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+using SliceTables = std::array<std::array<uint32_t, 256>, 8>;
+
+SliceTables make_slice_tables(uint32_t polynomial) {
+    SliceTables t{};
+    for(uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for(int j = 0; j < 8; j++) {
+            c = (c & 1) ? polynomial ^ (c >> 1) : c >> 1;
+        }
+        t[0][i] = c;
+    }
+    // t[k][i] is the crc of byte i followed by k zero bytes
+    for(size_t k = 1; k < 8; k++) {
+        for(uint32_t i = 0; i < 256; i++) {
+            t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+        }
+    }
+    return t;
+}
+
+uint32_t load32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t load64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// little endian only, like the rest of the on-disk format
+uint32_t slicing8(const SliceTables& t, const void* data, size_t length) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    uint32_t crc = 0xFFFFFFFFu;
+    while(length >= 8) {
+        uint32_t one = load32(bytes) ^ crc;
+        uint32_t two = load32(bytes + 4);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+              t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+              t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        bytes += 8;
+        length -= 8;
+    }
+    while(length--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *bytes++) & 0xFF];
+    }
+    return ~crc;
+}
+
+const uint32_t CRC32_POLY = 0xEDB88320u;
+const uint32_t CRC32C_POLY = 0x82F63B78u;
+
+#ifdef ROCASK_X86_CRC
+
+// Three streams hide the 3 cycle latency of the crc32 instruction. Their
+// crcs are joined by shifting one over the length of the next, which is a
+// linear map on the crc and so is tabulated once per block size (Adler's
+// construction from zlib's crc32_combine).
+const size_t LONG_BLOCK = 8192;
+const size_t SHORT_BLOCK = 256;
+
+using ShiftTable = std::array<std::array<uint32_t, 256>, 4>;
+
+uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while(vec) {
+        if(vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+void gf2_matrix_square(uint32_t* square, const uint32_t* mat) {
+    for(int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+// operator that appends len zero bytes to a crc
+void zeros_operator(uint32_t* even, size_t len) {
+    uint32_t odd[32];
+    odd[0] = CRC32C_POLY;
+    uint32_t row = 1;
+    for(int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2_matrix_square(even, odd);   // 2 zero bits
+    gf2_matrix_square(odd, even);   // 4 zero bits
+
+    // odd is one zero byte now, square up to len bytes
+    do {
+        gf2_matrix_square(even, odd);
+        len >>= 1;
+        if(len == 0) {
+            return;
+        }
+        gf2_matrix_square(odd, even);
+        len >>= 1;
+    } while(len);
+
+    for(int n = 0; n < 32; n++) {
+        even[n] = odd[n];
+    }
+}
+
+ShiftTable make_shift_table(size_t len) {
+    uint32_t op[32];
+    zeros_operator(op, len);
+
+    ShiftTable t{};
+    for(uint32_t n = 0; n < 256; n++) {
+        t[0][n] = gf2_matrix_times(op, n);
+        t[1][n] = gf2_matrix_times(op, n << 8);
+        t[2][n] = gf2_matrix_times(op, n << 16);
+        t[3][n] = gf2_matrix_times(op, n << 24);
+    }
+    return t;
+}
+
+uint32_t shift(const ShiftTable& t, uint32_t crc) {
+    return t[0][crc & 0xFF] ^ t[1][(crc >> 8) & 0xFF] ^ t[2][(crc >> 16) & 0xFF] ^ t[3][crc >> 24];
+}
+
+// crc0 continues the running crc, the other two streams start from zero
+__attribute__((target("sse4.2")))
+uint64_t crc32c_interleaved(
+    uint64_t crc0, 
+    const unsigned char*& next, 
+    size_t& length, 
+    size_t block, 
+    const ShiftTable& table
+) {
+    while(length >= 3 * block) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const unsigned char* end = next + block;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(next));
+            crc1 = _mm_crc32_u64(crc1, load64(next + block));
+            crc2 = _mm_crc32_u64(crc2, load64(next + 2 * block));
+            next += 8;
+        } while(next < end);
+        crc0 = shift(table, static_cast<uint32_t>(crc0)) ^ crc1;
+        crc0 = shift(table, static_cast<uint32_t>(crc0)) ^ crc2;
+        next += 2 * block;
+        length -= 3 * block;
+    }
+    return crc0;
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(const void* data, size_t length) {
+    static const ShiftTable long_shift = make_shift_table(LONG_BLOCK);
+    static const ShiftTable short_shift = make_shift_table(SHORT_BLOCK);
+
+    const unsigned char* next = static_cast<const unsigned char*>(data);
+    uint64_t crc0 = 0xFFFFFFFFu;
+
+    while(length > 0 && (reinterpret_cast<uintptr_t>(next) & 7) != 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+        length--;
+    }
+
+    crc0 = crc32c_interleaved(crc0, next, length, LONG_BLOCK, long_shift);
+    crc0 = crc32c_interleaved(crc0, next, length, SHORT_BLOCK, short_shift);
+
+    while(length >= 8) {
+        crc0 = _mm_crc32_u64(crc0, load64(next));
+        next += 8;
+        length -= 8;
+    }
+    while(length > 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *next++);
+        length--;
+    }
+    return ~static_cast<uint32_t>(crc0);
+}
+
+#endif
+
+} // namespace
+
+uint32_t crc32_slicing8(const void* data, size_t length) {
+    static const SliceTables tables = make_slice_tables(CRC32_POLY);
+    return slicing8(tables, data, length);
+}
+
+uint32_t crc32c_slicing8(const void* data, size_t length) {
+    static const SliceTables tables = make_slice_tables(CRC32C_POLY);
+    return slicing8(tables, data, length);
+}
+
+bool crc32c_hardware_available() {
+#ifdef ROCASK_X86_CRC
+    static const bool available = __builtin_cpu_supports("sse4.2");
+    return available;
+#else
+    return false;
+#endif
+}
+
+uint32_t crc32c_hardware(const void* data, size_t length) {
+#ifdef ROCASK_X86_CRC
+    return crc32c_sse42(data, length);
+#else
+    return crc32c_slicing8(data, length);
+#endif
+}
+
+uint32_t calculate_crc(CrcKind kind, const void* data, size_t length) {
+    if(kind == CrcKind::Crc32) {
+        return crc32_slicing8(data, length);
+    }
+
+    static const auto crc32c = crc32c_hardware_available() ? crc32c_hardware : crc32c_slicing8;
+    return crc32c(data, length);
+}
@@ -1,32 +1,27 @@
 #pragma once 
 
-#include <array>
+#include <cstddef>
 #include <cstdint>
 
-inline uint32_t calculate_crc(const void* data, size_t length) {
-    static std::array<uint32_t, 256> table = [] {
-        std::array<uint32_t, 256> t{};
-        const uint32_t polynomial = 0xEDB88320u;
-        for(uint32_t i = 0; i < 256; i++) {
-            uint32_t c = i;
-            for(int j = 0; j < 8; j++) {
-                if(c & 1) {
-                    c = polynomial ^ (c >> 1);
-                } else {
-                    c = c >> 1;
-                }
-            }
-            t[i] = c;
-        }
-        return t;
-    }();
+// Which checksum a datafile's records carry. Stored in the datafile header,
+// files from before the header existed are Crc32.
+enum class CrcKind : uint8_t {
+    Crc32 = 0,  // IEEE 802.3, 0xEDB88320 reflected
+    Crc32c = 1  // Castagnoli, 0x82F63B78 reflected, has an SSE4.2 instruction
+};
+
+// portable kernels, table driven 8 bytes per step
+uint32_t crc32_slicing8(const void* data, size_t length);
+uint32_t crc32c_slicing8(const void* data, size_t length);
 
-    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+// SSE4.2 crc32 instruction over three interleaved streams, only valid when
+// crc32c_hardware_available()
+uint32_t crc32c_hardware(const void* data, size_t length);
+bool crc32c_hardware_available();
 
-    uint32_t crc = 0xFFFFFFFFu;
-    for (size_t i = 0; i < length; i++) {
-        uint32_t lookup_index = (crc ^ bytes[i]) & 0xFF;
-        crc = (crc >> 8) ^ table[lookup_index];
-    }
-    return ~crc;
-}
\ No newline at end of file
+// best kernel for the kind, picked once from the CPU features
+uint32_t calculate_crc(CrcKind kind, const void* data, size_t length);
+
+inline uint32_t calculate_crc(const void* data, size_t length) {
+    return calculate_crc(CrcKind::Crc32, data, length);
+}
@@ -1,5 +1,10 @@
 #include "utils.hpp"
 
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
 uint64_t get_timestamp() {
     auto now = std::chrono::system_clock::now();
     auto duration = now.time_since_epoch();
@@ -7,28 +12,59 @@ uint64_t get_timestamp() {
     return static_cast<uint64_t>(seconds);
 }
 
+uint64_t get_seconds() {
+    auto now = std::chrono::system_clock::now();
+    auto duration = now.time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(duration).count());
+}
+
 bool read_at_offset(
-    const std::string& filename,
+    int fd,
     uint64_t offset, 
     uint64_t size, 
     std::string& output
 ) {
-    std::ifstream file(filename, std::ios::binary);
-    if(!file.is_open()) {
-        return false;
-    }
-    
-    file.seekg(offset, std::ios::beg);
-    if(!file) {
+    output.resize(size);
+    if(!read_at_offset(fd, offset, size, output.data())) {
+        output.clear();
         return false;
     }
+    return true;
+}
 
-    std::vector<char> output_ptr(size);
-    file.read(output_ptr.data(), size);
-    output.assign(output_ptr.data(), size);
+bool read_at_offset(
+    int fd,
+    uint64_t offset, 
+    uint64_t size, 
+    char *output
+) {
+    uint64_t done = 0;
+    while(done < size) {
+        ssize_t n = ::pread(fd, output + done, size - done, static_cast<off_t>(offset + done));
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        done += static_cast<uint64_t>(n);
+    }
     return true;
 }
 
+void sync_path(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        throw std::runtime_error("Could not open " + path + " to sync it: " + std::strerror(errno));
+    }
+    if(::fsync(fd) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::runtime_error("fsync on " + path + " failed: " + std::strerror(error));
+    }
+    ::close(fd);
+}
+
 uint32_t num_data_files() {
     const fs::path datafiles_dir{"datafiles"};
     uint32_t count = 0;
@@ -14,14 +14,29 @@
 namespace fs = std::filesystem;
 
 uint64_t get_timestamp();
+// wall clock in seconds, what key expiry is measured in
+uint64_t get_seconds();
 
+// positional read straight into output, no seek and no temporary buffer
 bool read_at_offset(
-    const std::string& filename,
+    int fd,
     uint64_t offset, 
     uint64_t size, 
     std::string& output
 );
 
+// same, into memory the caller owns
+bool read_at_offset(
+    int fd,
+    uint64_t offset, 
+    uint64_t size, 
+    char *output
+);
+
+// fsync of a file or directory by path, throws runtime_error. A directory
+// has to be synced for a file created or renamed in it to survive a crash
+void sync_path(const std::string& path);
+
 uint32_t num_data_files();
 
 std::vector<std::string> get_datafiles();
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Default stripe storage, a plain unordered_map. Tables get the hash the
+// stripe was chosen with, this one just lets the map recompute it.
+template<typename K, typename V, typename Hash>
+class UnorderedTable {
+    public:
+    std::optional<V> find(const K& key, size_t) const {
+        auto it = map_.find(key);
+        if(it == map_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    std::optional<V> put(const K& key, const V& value, size_t) {
+        auto [it, inserted] = map_.try_emplace(key, value);
+        if(inserted) {
+            return std::nullopt;
+        }
+        std::optional<V> ret = it->second;
+        it->second = value;
+        return ret;
+    }
+
+    template<typename Func>
+    bool put_if(const K& key, const V& value, size_t, Func replace) {
+        auto [it, inserted] = map_.try_emplace(key, value);
+        if(inserted) {
+            return true;
+        }
+        if(!replace(static_cast<const V&>(it->second))) {
+            return false;
+        }
+        it->second = value;
+        return true;
+    }
+
+    bool remove(const K& key, size_t) {
+        return map_.erase(key) > 0;
+    }
+
+    bool remove_if(const K& key, const V& expected, size_t) {
+        auto it = map_.find(key);
+        if(it != map_.end() && it->second == expected) {
+            map_.erase(it);
+            return true;
+        }
+        return false;
+    }
+
+    template<typename Func>
+    bool update(const K& key, const V& expected, size_t, Func updater) {
+        auto it = map_.find(key);
+        if(it != map_.end() && it->second == expected) {
+            updater(it->second);
+            return true;
+        }
+        return false;
+    }
+
+    template<typename Func>
+    void for_each(Func func) const {
+        for(const auto& [k, v] : map_) {
+            func(k, v);
+        }
+    }
+
+    size_t size() const { return map_.size(); }
+    void clear() { map_.clear(); }
+
+    // rough: bucket array plus one node per entry, not counting what K and V own
+    size_t memory_usage() const {
+        return map_.bucket_count() * sizeof(void*) + 
+               map_.size() * (sizeof(std::pair<const K, V>) + 2 * sizeof(void*));
+    }
+
+    private:
+    std::unordered_map<K, V, Hash> map_;
+};
+
+// SafeMap split into NumStripes independently locked tables. A key's stripe
+// is picked from its hash, so operations on different keys rarely share a
+// lock (or a cache line) and whole-map walks lock one stripe at a time.
+template<
+    typename K, 
+    typename V, 
+    size_t NumStripes = 64, 
+    typename Hash = std::hash<K>, 
+    typename Table = UnorderedTable<K, V, Hash>
+>
+class ShardedMap {
+    static_assert(NumStripes > 0 && (NumStripes & (NumStripes - 1)) == 0, "NumStripes must be a power of two.");
+
+    public:
+    ShardedMap() = default;
+
+    // single lookup, one shared lock
+    std::optional<V> find(const K& key) const {
+        size_t hash = Hash{}(key);
+        const Stripe& stripe = stripe_for(hash);
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+        return stripe.table.find(key, hash);
+    }
+
+    V get(const K& key) const {
+        std::optional<V> value = find(key);
+        if(!value.has_value()) {
+            throw std::out_of_range("ShardedMap: Key not found.");
+        }
+        return *value;
+    }
+
+    bool contains(const K& key) const {
+        return find(key).has_value();
+    }
+
+    bool remove(const K& key) {
+        size_t hash = Hash{}(key);
+        Stripe& stripe = stripe_for(hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        return stripe.table.remove(key, hash);
+    }
+
+    // CAS: removes the key only if it still maps to expected
+    bool remove_if(const K& key, const V& expected) {
+        size_t hash = Hash{}(key);
+        Stripe& stripe = stripe_for(hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        return stripe.table.remove_if(key, expected, hash);
+    }
+
+    // returns the value it replaced
+    std::optional<V> put(const K& key, const V& value) {
+        size_t hash = Hash{}(key);
+        Stripe& stripe = stripe_for(hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        return stripe.table.put(key, value, hash);
+    }
+
+    // inserts, or replaces the current value only if replace(current) is true
+    template<typename Func>
+    bool put_if(const K& key, const V& value, Func replace) {
+        size_t hash = Hash{}(key);
+        Stripe& stripe = stripe_for(hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        return stripe.table.put_if(key, value, hash, replace);
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for(const Stripe& stripe : stripes_) {
+            std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+            total += stripe.table.size();
+        }
+        return total;
+    }
+
+    // bytes held by the tables themselves
+    size_t memory_usage() const {
+        size_t total = sizeof(*this);
+        for(const Stripe& stripe : stripes_) {
+            std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+            total += stripe.table.memory_usage();
+        }
+        return total;
+    }
+
+    // CAS: runs updater only if the key still maps to expected
+    template<typename Func>
+    bool update(const K& key, const V& expected, Func updater) {
+        size_t hash = Hash{}(key);
+        Stripe& stripe = stripe_for(hash);
+        std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+        return stripe.table.update(key, expected, hash, updater);
+    }
+
+    // visits every entry, holding only the lock of the stripe being walked
+    template<typename Func>
+    void for_each(Func func) const {
+        for(const Stripe& stripe : stripes_) {
+            std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+            stripe.table.for_each(func);
+        }
+    }
+
+    std::vector<std::pair<K, V>> items() const {
+        std::vector<std::pair<K, V>> ret;
+        for_each([&ret](const K& k, const V& v) {
+            ret.emplace_back(k, v);
+        });
+        return ret;
+    }
+
+    void clear() {
+        for(Stripe& stripe : stripes_) {
+            std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+            stripe.table.clear();
+        }
+    }
+
+    // func(stripe index, table) for every stripe under its own lock, for
+    // setting tables up and asking them what maps can't
+    template<typename Func>
+    void for_each_table(Func func) {
+        for(size_t i = 0; i < NumStripes; i++) {
+            std::unique_lock<std::shared_mutex> lock(stripes_[i].mutex);
+            func(i, stripes_[i].table);
+        }
+    }
+
+    template<typename Func>
+    void for_each_table(Func func) const {
+        for(size_t i = 0; i < NumStripes; i++) {
+            std::shared_lock<std::shared_mutex> lock(stripes_[i].mutex);
+            func(i, static_cast<const Table&>(stripes_[i].table));
+        }
+    }
+
+    static constexpr size_t num_stripes() { return NumStripes; }
+
+    private:
+    // a cache line each, so neighbouring stripe locks don't false share
+    struct alignas(64) Stripe {
+        mutable std::shared_mutex mutex;
+        Table table;
+    };
+    std::array<Stripe, NumStripes> stripes_;
+
+    // tables bucket on the low bits of the same hash, so take the stripe
+    // from the high bits of a fibonacci mix instead
+    static size_t stripe_index(size_t hash) {
+        uint64_t h = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(h >> 32) & (NumStripes - 1);
+    }
+
+    Stripe& stripe_for(size_t hash) { return stripes_[stripe_index(hash)]; }
+    const Stripe& stripe_for(size_t hash) const { return stripes_[stripe_index(hash)]; }
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Ordered set behind one shared_mutex: range reads share it, insert and
+// erase take it alone. A node is one allocation holding the key and as many
+// next pointers as its height, on average 1.33 of them (p = 1/4).
+template<typename K, typename Compare = std::less<K>>
+class SkipList {
+    public:
+    static constexpr int MAX_HEIGHT = 24;
+
+    SkipList() : head_(make_node(K(), MAX_HEIGHT)) {}
+
+    ~SkipList() {
+        free_nodes();
+        destroy_node(head_);
+    }
+
+    SkipList(const SkipList&) = delete;
+    SkipList& operator=(const SkipList&) = delete;
+
+    // false if it was already there
+    bool insert(const K& key) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        Node *preds[MAX_HEIGHT];
+        Node *found = find_preds(key, preds);
+        if(found != nullptr) {
+            return false;
+        }
+
+        int height = random_height();
+        for(int level = height_; level < height; level++) {
+            preds[level] = head_;
+        }
+        if(height > height_) {
+            height_ = height;
+        }
+
+        Node *node = make_node(key, height);
+        for(int level = 0; level < height; level++) {
+            node->next[level] = preds[level]->next[level];
+            preds[level]->next[level] = node;
+        }
+        size_++;
+        memory_ += node_bytes(height) + heap_bytes(key);
+        return true;
+    }
+
+    // false if it wasn't there
+    bool erase(const K& key) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        Node *preds[MAX_HEIGHT];
+        Node *found = find_preds(key, preds);
+        if(found == nullptr) {
+            return false;
+        }
+
+        for(int level = 0; level < found->height; level++) {
+            preds[level]->next[level] = found->next[level];
+        }
+        while(height_ > 1 && head_->next[height_ - 1] == nullptr) {
+            height_--;
+        }
+        size_--;
+        memory_ -= node_bytes(found->height) + heap_bytes(found->key);
+        destroy_node(found);
+        return true;
+    }
+
+    bool contains(const K& key) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        Node *node = lower_bound(key);
+        return node != nullptr && !less_(key, node->key);
+    }
+
+    // up to limit keys from start (inclusive) to end (exclusive), in order.
+    // No end runs to the last key
+    std::vector<K> range(const K& start, const std::optional<K>& end, size_t limit) const {
+        std::vector<K> keys;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for(Node *node = lower_bound(start); node != nullptr && keys.size() < limit; node = node->next[0]) {
+            if(end.has_value() && !less_(node->key, *end)) {
+                break;
+            }
+            keys.push_back(node->key);
+        }
+        return keys;
+    }
+
+    // replaces everything with keys, which must be sorted and unique. Linear,
+    // for filling the list after recovery
+    void assign_sorted(const std::vector<K>& keys) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        free_nodes();
+
+        Node *tails[MAX_HEIGHT];
+        std::fill(tails, tails + MAX_HEIGHT, head_);
+        for(const K& key : keys) {
+            int height = random_height();
+            Node *node = make_node(key, height);
+            for(int level = 0; level < height; level++) {
+                tails[level]->next[level] = node;
+                tails[level] = node;
+            }
+            height_ = std::max(height_, height);
+            size_++;
+            memory_ += node_bytes(height) + heap_bytes(key);
+        }
+    }
+
+    void clear() {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        free_nodes();
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return size_;
+    }
+
+    size_t memory_usage() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return memory_ + node_bytes(MAX_HEIGHT);
+    }
+
+    private:
+    struct Node {
+        K key;
+        int height;
+        Node *next[1]; // really height of them, allocated past the end
+    };
+
+    static size_t node_bytes(int height) {
+        return sizeof(Node) + (height - 1) * sizeof(Node*);
+    }
+
+    // what a key owns outside its node, for strings past the small buffer
+    template<typename T>
+    static size_t heap_bytes(const T&) { return 0; }
+    static size_t heap_bytes(const std::string& key) {
+        return key.capacity() > std::string().capacity() ? key.capacity() + 1 : 0;
+    }
+
+    static Node *make_node(const K& key, int height) {
+        void *memory = ::operator new(node_bytes(height));
+        Node *node = new(memory) Node{key, height, {nullptr}};
+        for(int level = 0; level < height; level++) {
+            node->next[level] = nullptr;
+        }
+        return node;
+    }
+
+    static void destroy_node(Node *node) {
+        node->~Node();
+        ::operator delete(node);
+    }
+
+    void free_nodes() {
+        Node *node = head_->next[0];
+        while(node != nullptr) {
+            Node *next = node->next[0];
+            destroy_node(node);
+            node = next;
+        }
+        for(int level = 0; level < MAX_HEIGHT; level++) {
+            head_->next[level] = nullptr;
+        }
+        height_ = 1;
+        size_ = 0;
+        memory_ = 0;
+    }
+
+    int random_height() {
+        int height = 1;
+        while(height < MAX_HEIGHT && ((rng_() >> 16) & 3) == 0) {
+            height++;
+        }
+        return height;
+    }
+
+    // first node not less than key
+    Node *lower_bound(const K& key) const {
+        Node *node = head_;
+        for(int level = height_ - 1; level >= 0; level--) {
+            while(node->next[level] != nullptr && less_(node->next[level]->key, key)) {
+                node = node->next[level];
+            }
+        }
+        return node->next[0];
+    }
+
+    // the last node before key on every level, and key's node if it's there
+    Node *find_preds(const K& key, Node **preds) const {
+        Node *node = head_;
+        for(int level = height_ - 1; level >= 0; level--) {
+            while(node->next[level] != nullptr && less_(node->next[level]->key, key)) {
+                node = node->next[level];
+            }
+            preds[level] = node;
+        }
+        Node *found = node->next[0];
+        return found != nullptr && !less_(key, found->key) ? found : nullptr;
+    }
+
+    mutable std::shared_mutex mutex_;
+    Node *head_;
+    int height_ = 1;
+    size_t size_ = 0;
+    size_t memory_ = 0; // nodes and the key bytes they own, head aside
+    std::minstd_rand rng_{0x5eed};
+    Compare less_;
+};
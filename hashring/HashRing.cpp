@@ -0,0 +1,84 @@
+#include "HashRing.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+static uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+uint32_t murmur3_32(std::string_view data, uint32_t seed) {
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+
+    uint32_t h = seed;
+    size_t blocks = data.size() / 4;
+    for(size_t i = 0; i < blocks; i++) {
+        // little endian blocks, like the reference implementation on x86
+        uint32_t k;
+        std::memcpy(&k, data.data() + i * 4, sizeof(k));
+        k *= c1;
+        k = rotl32(k, 15);
+        k *= c2;
+
+        h ^= k;
+        h = rotl32(h, 13);
+        h = h * 5 + 0xe6546b64;
+    }
+
+    const unsigned char *tail = reinterpret_cast<const unsigned char*>(data.data()) + blocks * 4;
+    uint32_t k = 0;
+    switch(data.size() & 3) {
+        case 3: k ^= static_cast<uint32_t>(tail[2]) << 16; [[fallthrough]];
+        case 2: k ^= static_cast<uint32_t>(tail[1]) << 8; [[fallthrough]];
+        case 1:
+            k ^= tail[0];
+            k *= c1;
+            k = rotl32(k, 15);
+            k *= c2;
+            h ^= k;
+    }
+
+    h ^= static_cast<uint32_t>(data.size());
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+const std::string& HashRing::get_index(std::string_view key) const {
+    if(ring_.empty()) {
+        throw std::out_of_range("Hash ring has no nodes.");
+    }
+    auto it = ring_.lower_bound(murmur3_32(key));
+    if(it == ring_.end()) {
+        it = ring_.begin();
+    }
+    return it->second;
+}
+
+void HashRing::add_node(const std::string& node) {
+    for(unsigned i = 0; i < v_count_; i++) {
+        ring_[murmur3_32(node + "-" + std::to_string(i))] = node;
+    }
+}
+
+void HashRing::del_node(const std::string& node) {
+    for(unsigned i = 0; i < v_count_; i++) {
+        ring_.erase(murmur3_32(node + "-" + std::to_string(i)));
+    }
+}
+
+std::unordered_map<std::string, uint64_t> HashRing::coverage() const {
+    std::unordered_map<std::string, uint64_t> node_coverage;
+    uint32_t prev = ring_.empty() ? 0 : ring_.rbegin()->first;
+    for(const auto& [hash, node] : ring_) {
+        // the first one wraps around from the last
+        uint64_t distance = hash > prev ? hash - prev : (uint64_t(1) << 32) - prev + hash;
+        node_coverage[node] += distance;
+        prev = hash;
+    }
+    return node_coverage;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// MurmurHash3 x86_32, what mmh3.hash(key, signed=False) computes over the
+// key's UTF-8 bytes
+uint32_t murmur3_32(std::string_view data, uint32_t seed = 0);
+
+// Port of HashRing.py, placing keys exactly where it does so a cluster can
+// switch between them without moving data: v_count virtual nodes per node at
+// murmur3("<node>-<i>"), a key goes to the first one at or after its hash.
+class HashRing {
+    public:
+    explicit HashRing(unsigned v_count = 100) : v_count_(v_count) {}
+
+    // throws std::out_of_range when the ring is empty
+    const std::string& get_index(std::string_view key) const;
+
+    void add_node(const std::string& node);
+    void del_node(const std::string& node);
+
+    // how much of the hash space each node owns, they should be about equal
+    std::unordered_map<std::string, uint64_t> coverage() const;
+
+    bool empty() const { return ring_.empty(); }
+
+    private:
+    unsigned v_count_;
+    std::map<uint32_t, std::string> ring_;
+};
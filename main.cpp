@@ -1,11 +1,18 @@
 #include "crow.h"
 
 #include "api/routes.hpp"
+#include "api/BinaryServer.hpp"
 #include "api/FileLogHandler.hpp"
 #include "database/Rocask.hpp"
+#include "replication/ReplicationFollower.hpp"
+#include "replication/ReplicationLeader.hpp"
+
+#include <memory>
 
 int main(int argc, char* argv[])
 {
+    // api <port> [binary port] [--replication-port <port>]
+    //     [--follow <host:port> [--max-staleness-ms <ms>]] [--keydir memory|disk]
     if(argc < 2) {
         std::cerr << "Need Port" << std::endl;
         return 1;
@@ -13,16 +20,96 @@ int main(int argc, char* argv[])
 
     std::string str_port = argv[1];
     int port = std::stoi(str_port);
+    int first = 2;
+    // binary protocol, defaults to the HTTP port + 1000
+    int binary_port = port + 1000;
+    if(argc > first && std::string(argv[first]).rfind("--", 0) != 0) {
+        binary_port = std::stoi(argv[first++]);
+    }
+    // a leader ships its log to followers on the HTTP port + 2000
+    int replication_port = port + 2000;
+    std::string follow;
+    uint64_t max_staleness_ms = 1000;
+    std::string keydir = "memory";
+    for(int i = first; i < argc; i += 2) {
+        std::string flag = argv[i];
+        if(i + 1 >= argc) {
+            std::cerr << "Need a value for " << flag << std::endl;
+            return 1;
+        }
+        if(flag == "--replication-port") {
+            replication_port = std::stoi(argv[i + 1]);
+        } else if(flag == "--follow") {
+            follow = argv[i + 1];
+        } else if(flag == "--max-staleness-ms") {
+            max_staleness_ms = std::stoull(argv[i + 1]);
+        } else if(flag == "--keydir") {
+            keydir = argv[i + 1];
+            if(keydir != "memory" && keydir != "disk") {
+                std::cerr << "--keydir is memory or disk" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Unknown option " << flag << std::endl;
+            return 1;
+        }
+    }
 
     crow::SimpleApp app;
-    Rocask db(port);
+    RocaskOptions options;
+    options.cache_capacity = 64 * 1024 * 1024;
+    // values are JSON documents, they shrink a lot for very little CPU
+    options.compression = Codec::Lz4;
+    // falls back to pread/pwrite by itself where io_uring isn't there
+    options.io_uring = true;
+    // more keys than fit in memory, scans then sort what they match instead
+    options.disk_keydir = keydir == "disk";
+    // for /api/scan, costs another copy of every key
+    options.ordered_index = !options.disk_keydir;
+    // a follower only takes what its leader sends
+    options.read_only = !follow.empty();
+    Rocask db(port, options);
+
+    std::unique_ptr<ReplicationLeader> leader;
+    std::unique_ptr<ReplicationFollower> follower;
+    if(follow.empty()) {
+        leader = std::make_unique<ReplicationLeader>(db, static_cast<uint16_t>(replication_port));
+        leader->start();
+    } else {
+        size_t colon = follow.rfind(':');
+        if(colon == std::string::npos) {
+            std::cerr << "Need --follow <host:port>" << std::endl;
+            return 1;
+        }
+        follower = std::make_unique<ReplicationFollower>(
+            db, follow.substr(0, colon), static_cast<uint16_t>(std::stoi(follow.substr(colon + 1))), max_staleness_ms
+        );
+        follower->start();
+    }
 
     std::string logname = "./logs/api_" + str_port + ".log";
     crow::logger::setHandler(new FileLogHandler(logname));
 
     handle_ping(app);
     handle_insert(app, db);
-    handle_get(app, db);
+    handle_batch(app, db);
+    handle_get(app, db, follower.get());
+    handle_mget(app, db, follower.get());
+    handle_scan(app, db, follower.get());
+    handle_delete(app, db);
+    handle_stats(app, db);
+    handle_compaction_rate(app, db);
+    handle_replication(app, db, leader.get(), follower.get());
+
+    BinaryServer binary_server(db, static_cast<uint16_t>(binary_port), follower.get());
+    binary_server.start();
 
     app.port(port).multithreaded().run();
+    binary_server.stop();
+    if(leader) {
+        leader->stop();
+    }
+    if(follower) {
+        follower->stop();
+    }
 }
\ No newline at end of file
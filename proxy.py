@@ -65,7 +65,7 @@ def entry(path):
         
         downstream_response = requests.request(
             method='GET',
-            url=f'{host_cache}/api/get/{key}'
+            url=f'{host_cache}/api/get/{key}?raw=1'
         )
         
         return Response(
@@ -0,0 +1,184 @@
+#include "ReplicationFollower.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#include "ReplicationProtocol.hpp"
+
+ReplicationFollower::ReplicationFollower(Rocask& db, std::string leader_host, uint16_t leader_port, uint64_t max_staleness_ms)
+    : db_(db), leader_host_(std::move(leader_host)), leader_port_(leader_port), max_staleness_ms_(max_staleness_ms) {}
+
+ReplicationFollower::~ReplicationFollower() {
+    stop();
+}
+
+void ReplicationFollower::start() {
+    thread_ = std::thread(&ReplicationFollower::run, this);
+}
+
+void ReplicationFollower::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        if(socket_ != nullptr) {
+            asio::error_code ec;
+            socket_->shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+        }
+    }
+    cv_.notify_all();
+    if(thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+uint64_t ReplicationFollower::staleness_ms() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!fresh_at_) {
+        return UINT64_MAX;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - *fresh_at_).count();
+}
+
+bool ReplicationFollower::connected() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return socket_ != nullptr;
+}
+
+std::optional<LogPosition> ReplicationFollower::applied() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return applied_;
+}
+
+void ReplicationFollower::run() {
+    while(true) {
+        try {
+            follow();
+        } catch(const std::exception& e) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!stopping_) {
+                std::cerr << "Warning: " << "replication from " << leader_host_ << ":" << leader_port_
+                          << " stopped: " << e.what() << std::endl;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, std::chrono::milliseconds(REPLICATION_RECONNECT_MS), [this] {
+            return stopping_;
+        });
+        if(stopping_) {
+            break;
+        }
+    }
+}
+
+void ReplicationFollower::follow() {
+    asio::ip::tcp::resolver resolver(io_);
+    asio::ip::tcp::socket socket(io_);
+    asio::connect(socket, resolver.resolve(leader_host_, std::to_string(leader_port_)));
+    socket.set_option(asio::ip::tcp::no_delay(true));
+
+    std::optional<LogPosition> position;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(stopping_) {
+            return;
+        }
+        socket_ = &socket;
+        position = applied_;
+    }
+    // stop() may shut it down for as long as it's registered
+    struct Registration {
+        ReplicationFollower& follower;
+        ~Registration() {
+            std::lock_guard<std::mutex> lock(follower.mutex_);
+            follower.socket_ = nullptr;
+        }
+    } registration{*this};
+    std::string hello = hello_frame(position ? &*position : nullptr);
+    asio::write(socket, asio::buffer(hello));
+
+    // where the log goes on once the snapshot being received is in
+    LogPosition snapshot_end;
+    std::string frame;
+    while(true) {
+        read_frame(socket, frame);
+        Clock::time_point seen = Clock::now();
+        std::string_view payload = std::string_view(frame).substr(1);
+
+        switch(static_cast<ReplicationMessage>(frame[0])) {
+            case ReplicationMessage::Records: {
+                LogPosition log_end;
+                LogChunk chunk = decode_records(payload, log_end);
+                db_.apply_log(chunk);
+
+                LogPosition end{chunk.start.file_id, chunk.start.offset + chunk.records.size()};
+                leader_end(log_end, seen);
+                applied_to(end);
+                send_ack(socket, end);
+                break;
+            }
+            case ReplicationMessage::Heartbeat: {
+                // nothing was written since, it has all there is
+                LogPosition end = decode_position(payload);
+                leader_end(end, seen);
+                applied_to(end);
+                send_ack(socket, end);
+                break;
+            }
+            case ReplicationMessage::SnapshotBegin: {
+                snapshot_end = decode_position(payload);
+                {
+                    // whatever is in db now may be gone on the leader
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    applied_.reset();
+                    behind_.clear();
+                    fresh_at_.reset();
+                }
+                db_.clear();
+                break;
+            }
+            case ReplicationMessage::SnapshotRecords:
+                db_.apply_records(decode_snapshot_records(payload));
+                break;
+            case ReplicationMessage::SnapshotEnd:
+                applied_to(snapshot_end);
+                send_ack(socket, snapshot_end);
+                break;
+            default:
+                throw std::runtime_error("unexpected message " + std::to_string(int(frame[0])));
+        }
+    }
+}
+
+void ReplicationFollower::read_frame(asio::ip::tcp::socket& socket, std::string& frame) {
+    uint32_t length;
+    asio::read(socket, asio::buffer(&length, sizeof(length)));
+    if(length == 0 || length > MAX_REPLICATION_FRAME_SIZE) {
+        throw std::runtime_error("bad frame length " + std::to_string(length));
+    }
+    frame.resize(length);
+    asio::read(socket, asio::buffer(frame));
+}
+
+void ReplicationFollower::send_ack(asio::ip::tcp::socket& socket, const LogPosition& position) {
+    std::string ack = position_frame(ReplicationMessage::Ack, position);
+    asio::write(socket, asio::buffer(ack));
+}
+
+void ReplicationFollower::leader_end(const LogPosition& log_end, Clock::time_point seen) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(behind_.empty() || behind_.back().first < log_end) {
+        behind_.emplace_back(log_end, seen);
+    }
+}
+
+// once it has applied up to a log end the leader had, it's as fresh as the
+// leader was when it sent that
+void ReplicationFollower::applied_to(const LogPosition& position) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    applied_ = position;
+    while(!behind_.empty() && !(position < behind_.front().first)) {
+        fresh_at_ = behind_.front().second;
+        behind_.pop_front();
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <asio.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "../database/Rocask.hpp"
+
+// how long a follower waits before it tries a lost leader again
+const uint64_t REPLICATION_RECONNECT_MS = 1000;
+
+// Follows a ReplicationLeader: applies what it sends to db, acks it and
+// reconnects whenever the connection drops. db should be read_only so
+// nothing else writes to it. The position isn't kept across restarts, a
+// restarted follower starts over from a snapshot.
+class ReplicationFollower {
+    public:
+    // host and port of the leader's replication listener
+    ReplicationFollower(Rocask& db, std::string leader_host, uint16_t leader_port, uint64_t max_staleness_ms);
+    ~ReplicationFollower();
+
+    ReplicationFollower(const ReplicationFollower&) = delete;
+    ReplicationFollower& operator=(const ReplicationFollower&) = delete;
+
+    // connects and applies in the background
+    void start();
+    void stop();
+
+    // time since db last had everything the leader had, which a read may be
+    // behind by. UINT64_MAX before it ever caught up
+    uint64_t staleness_ms() const;
+    // reads are served while staleness is within max_staleness_ms
+    bool fresh() const { return staleness_ms() <= max_staleness_ms_; }
+    uint64_t max_staleness_ms() const { return max_staleness_ms_; }
+
+    const std::string& leader_host() const { return leader_host_; }
+    uint16_t leader_port() const { return leader_port_; }
+    bool connected() const;
+    // nullopt until a snapshot is in
+    std::optional<LogPosition> applied() const;
+
+    private:
+    using Clock = std::chrono::steady_clock;
+
+    void run();
+    // one connection, until it drops
+    void follow();
+    void read_frame(asio::ip::tcp::socket& socket, std::string& frame);
+    void send_ack(asio::ip::tcp::socket& socket, const LogPosition& position);
+    // the leader's log ended at log_end when it sent what came in at seen
+    void leader_end(const LogPosition& log_end, Clock::time_point seen);
+    void applied_to(const LogPosition& position);
+
+    Rocask& db_;
+    std::string leader_host_;
+    uint16_t leader_port_;
+    uint64_t max_staleness_ms_;
+
+    asio::io_context io_;
+    std::thread thread_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    asio::ip::tcp::socket *socket_ = nullptr; // the live connection, stop shuts it down
+    std::optional<LogPosition> applied_;
+    // log ends the follower hasn't caught up with yet and when each was seen
+    std::deque<std::pair<LogPosition, Clock::time_point>> behind_;
+    std::optional<Clock::time_point> fresh_at_;
+};
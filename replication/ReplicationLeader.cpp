@@ -0,0 +1,323 @@
+#include "ReplicationLeader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include "ReplicationProtocol.hpp"
+
+// all a follower ever sends is a Hello and Acks
+static const uint32_t MAX_FOLLOWER_FRAME_SIZE = 64;
+
+// One follower. Its thread owns the socket; the leader only shuts it down to
+// stop it, and reads the acked position under mutex_.
+class ReplicationLeader::Session {
+    public:
+    Session(ReplicationLeader& leader, asio::ip::tcp::socket socket)
+        : leader_(leader), socket_(std::move(socket)) {
+        asio::error_code ec;
+        asio::ip::tcp::endpoint remote = socket_.remote_endpoint(ec);
+        address_ = ec ? "unknown" : remote.address().to_string() + ":" + std::to_string(remote.port());
+    }
+
+    void start() {
+        thread_ = std::thread(&Session::run, this);
+    }
+
+    // unblocks whatever run is doing, from any thread
+    void shutdown() {
+        asio::error_code ec;
+        socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    }
+
+    void join() {
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    bool finished() const { return finished_; }
+
+    // the first log file this follower may still read, UINT64_MAX for none
+    uint64_t retain_from() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return retain_from_;
+    }
+
+    FollowerStatus status() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t since_ack = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - last_ack_
+        ).count();
+        return FollowerStatus{address_, streaming_, acked_, UINT64_MAX, since_ack};
+    }
+
+    private:
+    void run() {
+        try {
+            asio::error_code ec;
+            socket_.set_option(asio::ip::tcp::no_delay(true), ec);
+
+            LogPosition position;
+            bool has_position = read_hello(position);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                acked_ = position;
+                streaming_ = has_position;
+                retain_from_ = has_position ? position.file_id : UINT64_MAX;
+                last_ack_ = std::chrono::steady_clock::now();
+            }
+            leader_.update_retention();
+
+            auto heartbeat = std::chrono::milliseconds(REPLICATION_HEARTBEAT_MS);
+            auto last_sent = std::chrono::steady_clock::now() - heartbeat;
+            bool need_snapshot = !has_position;
+            LogChunk chunk;
+            while(!leader_.stopping_) {
+                if(need_snapshot) {
+                    send_snapshot(position);
+                    need_snapshot = false;
+                    last_sent = std::chrono::steady_clock::now();
+                }
+                read_acks();
+
+                if(!leader_.db_.read_log(position, REPLICATION_CHUNK_SIZE, chunk)) {
+                    std::cerr << "Warning: " << address_ << " is past what's left of the log, sending a snapshot" << std::endl;
+                    need_snapshot = true;
+                    continue;
+                }
+                if(!chunk.records.empty()) {
+                    send(records_frame(leader_.db_.log_end(), chunk));
+                    last_sent = std::chrono::steady_clock::now();
+                    continue;
+                }
+
+                // at the end of the log, it has all there is
+                if(std::chrono::steady_clock::now() - last_sent >= heartbeat) {
+                    send(position_frame(ReplicationMessage::Heartbeat, position));
+                    last_sent = std::chrono::steady_clock::now();
+                }
+                leader_.db_.wait_log(position, heartbeat);
+            }
+        } catch(const std::exception& e) {
+            if(!leader_.stopping_) {
+                std::cerr << "Warning: " << "replication to " << address_ << " stopped: " << e.what() << std::endl;
+            }
+        }
+
+        finished_ = true;
+        leader_.update_retention();
+    }
+
+    bool read_hello(LogPosition& position) {
+        uint32_t length;
+        asio::read(socket_, asio::buffer(&length, sizeof(length)));
+        if(length == 0 || length > MAX_FOLLOWER_FRAME_SIZE) {
+            throw std::runtime_error("bad frame length " + std::to_string(length));
+        }
+        std::string frame(length, '\0');
+        asio::read(socket_, asio::buffer(frame));
+        if(static_cast<ReplicationMessage>(frame[0]) != ReplicationMessage::Hello) {
+            throw std::runtime_error("expected a Hello");
+        }
+        return decode_hello(std::string_view(frame).substr(1), position);
+    }
+
+    // everything live, then the log from where it was when the snapshot started
+    void send_snapshot(LogPosition& position) {
+        LogPosition start = leader_.db_.log_end();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            streaming_ = false;
+            retain_from_ = start.file_id;
+        }
+        leader_.update_retention();
+
+        send(position_frame(ReplicationMessage::SnapshotBegin, start));
+        leader_.db_.snapshot(REPLICATION_CHUNK_SIZE, [this](std::vector<LogRecord>& records) {
+            send(snapshot_records_frame(records));
+        });
+        send(replication_frame(ReplicationMessage::SnapshotEnd));
+
+        position = start;
+        std::lock_guard<std::mutex> lock(mutex_);
+        streaming_ = true;
+    }
+
+    void send(const std::string& frame) {
+        asio::write(socket_, asio::buffer(frame));
+    }
+
+    // takes whatever acks arrived, without waiting for more
+    void read_acks() {
+        asio::error_code ec;
+        size_t available = socket_.available(ec);
+        if(ec) {
+            throw asio::system_error(ec);
+        }
+        if(available == 0) {
+            return;
+        }
+        size_t end = in_.size();
+        in_.resize(end + available);
+        in_.resize(end + socket_.read_some(asio::buffer(in_.data() + end, available)));
+
+        size_t pos = 0;
+        bool acked = false;
+        while(in_.size() - pos >= sizeof(uint32_t)) {
+            uint32_t length;
+            std::memcpy(&length, in_.data() + pos, sizeof(length));
+            if(length == 0 || length > MAX_FOLLOWER_FRAME_SIZE) {
+                throw std::runtime_error("bad frame length " + std::to_string(length));
+            }
+            if(in_.size() - pos - sizeof(uint32_t) < length) {
+                break;
+            }
+            std::string_view frame(in_.data() + pos + sizeof(uint32_t), length);
+            if(static_cast<ReplicationMessage>(frame[0]) != ReplicationMessage::Ack) {
+                throw std::runtime_error("expected an Ack");
+            }
+            LogPosition position = decode_position(frame.substr(1));
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                acked_ = position;
+                last_ack_ = std::chrono::steady_clock::now();
+                if(streaming_) {
+                    retain_from_ = position.file_id;
+                }
+            }
+            acked = true;
+            pos += sizeof(uint32_t) + length;
+        }
+        in_.erase(0, pos);
+
+        if(acked) {
+            leader_.update_retention();
+        }
+    }
+
+    ReplicationLeader& leader_;
+    asio::ip::tcp::socket socket_;
+    std::string address_;
+    std::thread thread_;
+    std::atomic<bool> finished_{false};
+    std::string in_; // acks read but not parsed yet
+
+    std::mutex mutex_;
+    LogPosition acked_;
+    bool streaming_ = false;
+    uint64_t retain_from_ = UINT64_MAX;
+    std::chrono::steady_clock::time_point last_ack_ = std::chrono::steady_clock::now();
+};
+
+ReplicationLeader::ReplicationLeader(Rocask& db, uint16_t port)
+    : db_(db), port_(port), acceptor_(io_) {}
+
+ReplicationLeader::~ReplicationLeader() {
+    stop();
+}
+
+void ReplicationLeader::start() {
+    asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), port_);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    accept();
+
+    thread_ = std::thread([this]() {
+        io_.run();
+    });
+}
+
+void ReplicationLeader::stop() {
+    stopping_ = true;
+    io_.stop();
+    if(thread_.joinable()) {
+        thread_.join();
+    }
+    asio::error_code ec;
+    acceptor_.close(ec);
+
+    // nothing accepts any more, so sessions_ only shrinks from here
+    std::vector<std::shared_ptr<Session>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions = sessions_;
+    }
+    for(const std::shared_ptr<Session>& session : sessions) {
+        session->shutdown();
+        session->join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.clear();
+    db_.retain_log(UINT64_MAX);
+}
+
+void ReplicationLeader::accept() {
+    acceptor_.async_accept([this](const asio::error_code& ec, asio::ip::tcp::socket socket) {
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+        if(!ec) {
+            reap_sessions();
+            auto session = std::make_shared<Session>(*this, std::move(socket));
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                sessions_.push_back(session);
+            }
+            session->start();
+        }
+        accept();
+    });
+}
+
+void ReplicationLeader::reap_sessions() {
+    std::vector<std::shared_ptr<Session>> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::partition(sessions_.begin(), sessions_.end(), [](const std::shared_ptr<Session>& session) {
+            return !session->finished();
+        });
+        finished.assign(it, sessions_.end());
+        sessions_.erase(it, sessions_.end());
+    }
+    // their threads are on the way out, but may still be in update_retention
+    for(const std::shared_ptr<Session>& session : finished) {
+        session->join();
+    }
+}
+
+void ReplicationLeader::update_retention() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t retain_from = UINT64_MAX;
+    for(const std::shared_ptr<Session>& session : sessions_) {
+        if(!session->finished()) {
+            retain_from = std::min(retain_from, session->retain_from());
+        }
+    }
+    db_.retain_log(retain_from);
+}
+
+std::vector<ReplicationLeader::FollowerStatus> ReplicationLeader::followers() {
+    std::vector<std::shared_ptr<Session>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions = sessions_;
+    }
+
+    std::vector<FollowerStatus> statuses;
+    for(const std::shared_ptr<Session>& session : sessions) {
+        if(session->finished()) {
+            continue;
+        }
+        FollowerStatus status = session->status();
+        if(status.streaming) {
+            status.lag_bytes = db_.log_bytes_after(status.acked);
+        }
+        statuses.push_back(std::move(status));
+    }
+    return statuses;
+}
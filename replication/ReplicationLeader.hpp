@@ -0,0 +1,62 @@
+#pragma once
+
+#include <asio.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../database/Rocask.hpp"
+
+// an idle leader tells its followers they're caught up this often
+const uint64_t REPLICATION_HEARTBEAT_MS = 100;
+
+// Ships the log to followers (see ReplicationProtocol.hpp). Accepts on its
+// own io_context, every follower then gets a thread that reads the log and
+// sends it with blocking writes, so a slow follower only holds up itself.
+// Compaction leaves alone the log files a connected follower still needs.
+class ReplicationLeader {
+    public:
+    ReplicationLeader(Rocask& db, uint16_t port);
+    ~ReplicationLeader();
+
+    ReplicationLeader(const ReplicationLeader&) = delete;
+    ReplicationLeader& operator=(const ReplicationLeader&) = delete;
+
+    // binds and returns, followers are served in the background
+    void start();
+    void stop();
+
+    struct FollowerStatus {
+        std::string address;
+        bool streaming;       // false while it waits for or gets a snapshot
+        LogPosition acked;
+        uint64_t lag_bytes;   // log it hasn't acked yet, UINT64_MAX unless streaming
+        uint64_t last_ack_ms; // since it last acked
+    };
+    std::vector<FollowerStatus> followers();
+
+    private:
+    class Session;
+
+    void accept();
+    // the log files the sessions need, passed on to the db
+    void update_retention();
+    // joins the sessions whose follower went away
+    void reap_sessions();
+
+    Rocask& db_;
+    uint16_t port_;
+
+    asio::io_context io_;
+    asio::ip::tcp::acceptor acceptor_;
+    std::thread thread_;
+
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<Session>> sessions_;
+    std::atomic<bool> stopping_{false};
+};
@@ -0,0 +1,166 @@
+#include "ReplicationProtocol.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+// reads fields off a payload, throws std::invalid_argument when it ends first
+class FrameReader {
+    public:
+    explicit FrameReader(std::string_view payload) : payload_(payload) {}
+
+    template<typename T>
+    T integer() {
+        T value;
+        std::memcpy(&value, take(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+
+    LogPosition position() {
+        LogPosition position;
+        position.file_id = integer<uint64_t>();
+        position.offset = integer<uint64_t>();
+        return position;
+    }
+
+    std::string_view string() {
+        uint32_t size = integer<uint32_t>();
+        return take(size);
+    }
+
+    std::string_view rest() {
+        return take(payload_.size() - offset_);
+    }
+
+    private:
+    std::string_view take(uint64_t size) {
+        if(size > payload_.size() - offset_) {
+            throw std::invalid_argument("Replication frame is truncated.");
+        }
+        std::string_view field = payload_.substr(offset_, size);
+        offset_ += size;
+        return field;
+    }
+
+    std::string_view payload_;
+    uint64_t offset_ = 0;
+};
+
+template<typename T>
+static void append_integer(std::string& output, T value) {
+    output.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void append_position(std::string& output, const LogPosition& position) {
+    append_integer<uint64_t>(output, position.file_id);
+    append_integer<uint64_t>(output, position.offset);
+}
+
+static void append_string(std::string& output, std::string_view value) {
+    append_integer<uint32_t>(output, static_cast<uint32_t>(value.size()));
+    output.append(value);
+}
+
+// length | type, the length is patched in by finish_frame
+static std::string frame_header(ReplicationMessage type, uint64_t payload_size = 0) {
+    std::string frame;
+    frame.reserve(sizeof(uint32_t) + 1 + payload_size);
+    append_integer<uint32_t>(frame, 0);
+    frame.push_back(static_cast<char>(type));
+    return frame;
+}
+
+static std::string finish_frame(std::string frame) {
+    uint32_t length = static_cast<uint32_t>(frame.size() - sizeof(uint32_t));
+    std::memcpy(frame.data(), &length, sizeof(length));
+    return frame;
+}
+
+std::string replication_frame(ReplicationMessage type) {
+    return finish_frame(frame_header(type));
+}
+
+std::string position_frame(ReplicationMessage type, const LogPosition& position) {
+    std::string frame = frame_header(type, 2 * sizeof(uint64_t));
+    append_position(frame, position);
+    return finish_frame(std::move(frame));
+}
+
+std::string hello_frame(const LogPosition *position) {
+    std::string frame = frame_header(ReplicationMessage::Hello, 1 + 2 * sizeof(uint64_t));
+    frame.push_back(position != nullptr ? 1 : 0);
+    append_position(frame, position != nullptr ? *position : LogPosition());
+    return finish_frame(std::move(frame));
+}
+
+std::string records_frame(const LogPosition& log_end, const LogChunk& chunk) {
+    std::string frame = frame_header(ReplicationMessage::Records, 4 * sizeof(uint64_t) + 2 + chunk.records.size());
+    append_position(frame, log_end);
+    append_position(frame, chunk.start);
+    frame.push_back(static_cast<char>(chunk.crc_kind));
+    frame.push_back(static_cast<char>(chunk.version));
+    frame.append(chunk.records);
+    return finish_frame(std::move(frame));
+}
+
+std::string snapshot_records_frame(const std::vector<LogRecord>& records) {
+    uint64_t size = sizeof(uint32_t);
+    for(const LogRecord& record : records) {
+        size += 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t) + 1 + record.key.size() + record.value.size();
+    }
+
+    std::string frame = frame_header(ReplicationMessage::SnapshotRecords, size);
+    append_integer<uint32_t>(frame, static_cast<uint32_t>(records.size()));
+    for(const LogRecord& record : records) {
+        append_string(frame, record.key);
+        append_integer<uint64_t>(frame, record.timestamp);
+        append_integer<uint64_t>(frame, record.expiry);
+        frame.push_back(static_cast<char>(record.codec));
+        append_string(frame, record.value);
+    }
+    return finish_frame(std::move(frame));
+}
+
+LogPosition decode_position(std::string_view payload) {
+    FrameReader reader(payload);
+    return reader.position();
+}
+
+bool decode_hello(std::string_view payload, LogPosition& position) {
+    FrameReader reader(payload);
+    bool has_position = reader.integer<uint8_t>() != 0;
+    position = reader.position();
+    return has_position;
+}
+
+LogChunk decode_records(std::string_view payload, LogPosition& log_end) {
+    FrameReader reader(payload);
+    log_end = reader.position();
+
+    LogChunk chunk;
+    chunk.start = reader.position();
+    chunk.crc_kind = static_cast<CrcKind>(reader.integer<uint8_t>());
+    chunk.version = reader.integer<uint8_t>();
+    if(chunk.crc_kind > CrcKind::Crc32c || chunk.version > DATAFILE_VERSION) {
+        throw std::invalid_argument("Replicated records are in a datafile version this build can't read.");
+    }
+    chunk.records = reader.rest();
+    return chunk;
+}
+
+std::vector<LogRecord> decode_snapshot_records(std::string_view payload) {
+    FrameReader reader(payload);
+    uint32_t count = reader.integer<uint32_t>();
+
+    std::vector<LogRecord> records;
+    records.reserve(std::min<uint64_t>(count, payload.size()));
+    for(uint32_t i = 0; i < count; i++) {
+        LogRecord record;
+        record.key = reader.string();
+        record.timestamp = reader.integer<uint64_t>();
+        record.expiry = reader.integer<uint64_t>();
+        record.codec = static_cast<Codec>(reader.integer<uint8_t>());
+        record.value = reader.string();
+        records.push_back(std::move(record));
+    }
+    return records;
+}
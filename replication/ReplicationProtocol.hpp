@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../database/Rocask.hpp"
+
+// Leader to follower log shipping, over its own TCP port. Little endian like
+// the binary protocol, a position is u64 file_id | u64 offset and a string
+// a u32 length and its bytes.
+//
+// frame: u32 length | u8 type | payload, length counts everything after itself
+//
+// The follower says where it is once (Hello) and acks what it applied. The
+// leader streams the log from there, or a snapshot first when the follower
+// has nothing or its position was compacted away. Records carry the end of
+// the leader's log when they were sent, so the follower can tell how far
+// behind it is; an idle leader sends Heartbeats instead.
+enum class ReplicationMessage : uint8_t {
+    Hello = 0,           // u8 has_position | position
+    Ack = 1,             // position everything before was applied
+    Records = 2,         // log end | start position | u8 crc_kind | u8 version | records (rest)
+    SnapshotBegin = 3,   // position the log goes on from once it's done
+    SnapshotRecords = 4, // u32 count | (key | u64 timestamp | u64 expiry | u8 codec | value)...
+    SnapshotEnd = 5,     // nothing
+    Heartbeat = 6        // position the follower is caught up to
+};
+
+// anything larger is a broken peer, the connection gets dropped. A single
+// batch can't be split, so this is far above REPLICATION_CHUNK_SIZE
+const uint32_t MAX_REPLICATION_FRAME_SIZE = 1024 * 1024 * 1024;
+// log bytes per Records frame and snapshot bytes per SnapshotRecords
+const uint64_t REPLICATION_CHUNK_SIZE = 1024 * 1024;
+
+// whole frames, length prefix included
+std::string replication_frame(ReplicationMessage type);
+// Ack, SnapshotBegin and Heartbeat
+std::string position_frame(ReplicationMessage type, const LogPosition& position);
+// position is null for a follower that has nothing yet
+std::string hello_frame(const LogPosition *position);
+std::string records_frame(const LogPosition& log_end, const LogChunk& chunk);
+std::string snapshot_records_frame(const std::vector<LogRecord>& records);
+
+// the decoders take a frame's payload and throw std::invalid_argument when
+// it's cut short
+LogPosition decode_position(std::string_view payload);
+bool decode_hello(std::string_view payload, LogPosition& position);
+LogChunk decode_records(std::string_view payload, LogPosition& log_end);
+std::vector<LogRecord> decode_snapshot_records(std::string_view payload);
@@ -0,0 +1,366 @@
+#include "Http.hpp"
+
+#include <cctype>
+#include <charconv>
+
+static bool iequals(std::string_view a, std::string_view b) {
+    if(a.size() != b.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); i++) {
+        if(std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string_view trim(std::string_view s) {
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+// whether the comma separated header value lists token
+static bool has_token(std::string_view value, std::string_view token) {
+    while(!value.empty()) {
+        size_t comma = value.find(',');
+        if(iequals(trim(value.substr(0, comma)), token)) {
+            return true;
+        }
+        if(comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+bool parse_http_head(std::string_view head, HttpHead& output) {
+    size_t line_end = head.find("\r\n");
+    std::string_view line = head.substr(0, line_end);
+
+    // three parts, the last one (a reason phrase) may have spaces of its own
+    for(int i = 0; i < 2; i++) {
+        size_t space = line.find(' ');
+        if(space == std::string_view::npos) {
+            return false;
+        }
+        output.start[i] = line.substr(0, space);
+        line.remove_prefix(space + 1);
+    }
+    output.start[2] = line;
+
+    std::string_view version = output.start[0].substr(0, 5) == "HTTP/" ? output.start[0] : output.start[2];
+    if(version == "HTTP/1.1") {
+        output.keep_alive = true;
+    } else if(version == "HTTP/1.0") {
+        output.keep_alive = false;
+    } else {
+        return false;
+    }
+
+    std::string_view rest = line_end == std::string_view::npos ? std::string_view() : head.substr(line_end + 2);
+    while(!rest.empty()) {
+        line_end = rest.find("\r\n");
+        line = rest.substr(0, line_end);
+        rest = line_end == std::string_view::npos ? std::string_view() : rest.substr(line_end + 2);
+
+        size_t colon = line.find(':');
+        if(colon == std::string_view::npos) {
+            return false;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = trim(line.substr(colon + 1));
+
+        if(iequals(name, "Content-Length")) {
+            uint64_t length;
+            auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), length);
+            if(error != std::errc() || end != value.data() + value.size()) {
+                return false;
+            }
+            // two that disagree is how requests get smuggled
+            if(output.content_length && *output.content_length != length) {
+                return false;
+            }
+            output.content_length = length;
+        } else if(iequals(name, "Transfer-Encoding")) {
+            output.chunked = has_token(value, "chunked");
+        } else if(iequals(name, "Connection")) {
+            if(has_token(value, "close")) {
+                output.keep_alive = false;
+            } else if(has_token(value, "keep-alive")) {
+                output.keep_alive = true;
+            }
+        } else if(iequals(name, "Content-Type")) {
+            output.content_type = value;
+        }
+    }
+    return true;
+}
+
+static int hex_value(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+std::optional<std::string> percent_decode(std::string_view input) {
+    std::string output;
+    output.reserve(input.size());
+    for(size_t i = 0; i < input.size(); i++) {
+        if(input[i] != '%') {
+            output.push_back(input[i]);
+            continue;
+        }
+        if(i + 2 >= input.size()) {
+            return std::nullopt;
+        }
+        int high = hex_value(input[i + 1]);
+        int low = hex_value(input[i + 2]);
+        if(high < 0 || low < 0) {
+            return std::nullopt;
+        }
+        output.push_back(static_cast<char>(high * 16 + low));
+        i += 2;
+    }
+    return output;
+}
+
+// walks one JSON document, decoding the strings it's asked for and only
+// skipping the rest. Not a validator, the backend parses it for real
+class JsonScanner {
+    public:
+    explicit JsonScanner(std::string_view json) : json_(json) {}
+
+    void skip_space() {
+        while(pos_ < json_.size() && (json_[pos_] == ' ' || json_[pos_] == '\t' || json_[pos_] == '\n' || json_[pos_] == '\r')) {
+            pos_++;
+        }
+    }
+
+    bool consume(char c) {
+        skip_space();
+        if(pos_ < json_.size() && json_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool at(char c) {
+        skip_space();
+        return pos_ < json_.size() && json_[pos_] == c;
+    }
+
+    // at the opening quote
+    std::optional<std::string> string() {
+        if(!consume('"')) {
+            return std::nullopt;
+        }
+        std::string output;
+        while(pos_ < json_.size()) {
+            char c = json_[pos_++];
+            if(c == '"') {
+                return output;
+            }
+            if(c != '\\') {
+                output.push_back(c);
+                continue;
+            }
+            if(pos_ >= json_.size()) {
+                break;
+            }
+            switch(json_[pos_++]) {
+                case '"': output.push_back('"'); break;
+                case '\\': output.push_back('\\'); break;
+                case '/': output.push_back('/'); break;
+                case 'b': output.push_back('\b'); break;
+                case 'f': output.push_back('\f'); break;
+                case 'n': output.push_back('\n'); break;
+                case 'r': output.push_back('\r'); break;
+                case 't': output.push_back('\t'); break;
+                case 'u': {
+                    std::optional<uint32_t> code = hex4();
+                    if(!code) {
+                        return std::nullopt;
+                    }
+                    // a surrogate pair is one code point
+                    if(*code >= 0xd800 && *code < 0xdc00 && json_.substr(pos_, 2) == "\\u") {
+                        size_t saved = pos_;
+                        pos_ += 2;
+                        std::optional<uint32_t> low = hex4();
+                        if(low && *low >= 0xdc00 && *low < 0xe000) {
+                            *code = 0x10000 + ((*code - 0xd800) << 10) + (*low - 0xdc00);
+                        } else {
+                            pos_ = saved;
+                        }
+                    }
+                    append_utf8(output, *code);
+                    break;
+                }
+                default:
+                    return std::nullopt;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // any value, false if the document ends first
+    bool skip_value() {
+        skip_space();
+        if(pos_ >= json_.size()) {
+            return false;
+        }
+        char c = json_[pos_];
+        if(c == '"') {
+            return skip_string();
+        }
+        if(c != '{' && c != '[') {
+            // number, true, false or null
+            while(pos_ < json_.size() && json_[pos_] != ',' && json_[pos_] != '}' && json_[pos_] != ']' &&
+                  json_[pos_] != ' ' && json_[pos_] != '\t' && json_[pos_] != '\n' && json_[pos_] != '\r') {
+                pos_++;
+            }
+            return true;
+        }
+
+        // nested containers, counting brackets outside of strings
+        uint64_t depth = 0;
+        while(pos_ < json_.size()) {
+            c = json_[pos_];
+            if(c == '"') {
+                if(!skip_string()) {
+                    return false;
+                }
+                continue;
+            }
+            pos_++;
+            if(c == '{' || c == '[') {
+                depth++;
+            } else if(c == '}' || c == ']') {
+                if(--depth == 0) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    private:
+    bool skip_string() {
+        pos_++;
+        while(pos_ < json_.size()) {
+            char c = json_[pos_++];
+            if(c == '\\') {
+                pos_++;
+            } else if(c == '"') {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::optional<uint32_t> hex4() {
+        if(pos_ + 4 > json_.size()) {
+            return std::nullopt;
+        }
+        uint32_t code = 0;
+        for(int i = 0; i < 4; i++) {
+            int digit = hex_value(json_[pos_++]);
+            if(digit < 0) {
+                return std::nullopt;
+            }
+            code = code * 16 + digit;
+        }
+        return code;
+    }
+
+    static void append_utf8(std::string& output, uint32_t code) {
+        if(code < 0x80) {
+            output.push_back(static_cast<char>(code));
+        } else if(code < 0x800) {
+            output.push_back(static_cast<char>(0xc0 | (code >> 6)));
+            output.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+        } else if(code < 0x10000) {
+            output.push_back(static_cast<char>(0xe0 | (code >> 12)));
+            output.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+            output.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+        } else {
+            output.push_back(static_cast<char>(0xf0 | (code >> 18)));
+            output.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+            output.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+            output.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+        }
+    }
+
+    std::string_view json_;
+    size_t pos_ = 0;
+};
+
+std::optional<std::string> json_string_member(std::string_view json, std::string_view name) {
+    JsonScanner scanner(json);
+    if(!scanner.consume('{')) {
+        return std::nullopt;
+    }
+    if(scanner.consume('}')) {
+        return std::nullopt;
+    }
+
+    // the last one wins on duplicates, like a parse into a dict
+    std::optional<std::string> found;
+    do {
+        std::optional<std::string> member = scanner.string();
+        if(!member || !scanner.consume(':')) {
+            return std::nullopt;
+        }
+        if(*member == name && scanner.at('"')) {
+            found = scanner.string();
+            if(!found) {
+                return std::nullopt;
+            }
+        } else if(*member == name) {
+            // there, but not a string
+            found.reset();
+            if(!scanner.skip_value()) {
+                return std::nullopt;
+            }
+        } else if(!scanner.skip_value()) {
+            return std::nullopt;
+        }
+    } while(scanner.consume(','));
+
+    if(!scanner.consume('}')) {
+        return std::nullopt;
+    }
+    return found;
+}
+
+const char* http_reason(int status) {
+    switch(status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// the largest request or response head the router takes
+const uint64_t MAX_HTTP_HEAD_SIZE = 64 * 1024;
+// and body, same as a binary protocol frame
+const uint64_t MAX_HTTP_BODY_SIZE = 64 * 1024 * 1024;
+
+// What the router needs out of a request or response head, no more. The
+// views point into the head passed to parse_http_head.
+struct HttpHead {
+    // request: method, target, version. Response: version, status, reason
+    std::string_view start[3];
+    std::optional<uint64_t> content_length;
+    bool chunked = false;
+    bool keep_alive = true;
+    std::string_view content_type;
+};
+
+// head is everything up to and without the blank line, false if it's malformed
+bool parse_http_head(std::string_view head, HttpHead& output);
+
+// %XX and nothing else, nullopt on a broken escape
+std::optional<std::string> percent_decode(std::string_view input);
+
+// the string member called name of the top level object in json, decoded.
+// nullopt when json isn't an object, has no such member or it isn't a
+// string. Whatever else is in the document is only skipped over
+std::optional<std::string> json_string_member(std::string_view json, std::string_view name);
+
+const char* http_reason(int status);
@@ -0,0 +1,469 @@
+#include "Router.hpp"
+
+#include <array>
+#include <charconv>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+#include "Http.hpp"
+
+// socket reads from clients go into at least this much free space
+static const uint64_t READ_CHUNK = 16 * 1024;
+// idle keep-alive connections kept per backend, more are closed
+static const size_t MAX_IDLE_PER_BACKEND = 256;
+
+// one keep-alive connection to an api instance, used by one exchange at a time
+struct BackendSocket {
+    explicit BackendSocket(asio::io_context& io) : socket(io) {}
+
+    asio::ip::tcp::socket socket;
+    std::string buffer;
+    bool reused = false;
+};
+
+class Router::Backend {
+    public:
+    Backend(asio::io_context& io, std::string host, asio::ip::tcp::endpoint endpoint)
+        : io_(io), host_(std::move(host)), endpoint_(endpoint) {}
+
+    // an idle connection, or a new one that isn't connected yet
+    std::unique_ptr<BackendSocket> acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!idle_.empty()) {
+                std::unique_ptr<BackendSocket> socket = std::move(idle_.back());
+                idle_.pop_back();
+                socket->reused = true;
+                return socket;
+            }
+        }
+        return fresh();
+    }
+
+    std::unique_ptr<BackendSocket> fresh() {
+        return std::make_unique<BackendSocket>(io_);
+    }
+
+    void release(std::unique_ptr<BackendSocket> socket) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(idle_.size() < MAX_IDLE_PER_BACKEND) {
+            idle_.push_back(std::move(socket));
+        }
+    }
+
+    const std::string& host() const { return host_; }
+    const asio::ip::tcp::endpoint& endpoint() const { return endpoint_; }
+
+    private:
+    asio::io_context& io_;
+    std::string host_;
+    asio::ip::tcp::endpoint endpoint_;
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<BackendSocket>> idle_;
+};
+
+// what came back from a backend, the body is data[body_offset, +body_size)
+struct BackendResponse {
+    int status = 502;
+    std::string content_type = "application/json";
+    std::string data = "{\"error\": \"Backend unavailable.\"}";
+    uint64_t body_offset = 0;
+    uint64_t body_size = data.size();
+};
+
+// One request to a backend and its response. Handlers run on the client
+// connection's strand, so done does too.
+class Router::Exchange : public std::enable_shared_from_this<Exchange> {
+    public:
+    using Done = std::function<void(BackendResponse)>;
+
+    Exchange(Backend& backend, std::string request, asio::strand<asio::io_context::executor_type> strand, Done done)
+        : backend_(backend), request_(std::move(request)), strand_(strand), done_(std::move(done)) {}
+
+    void start() {
+        socket_ = backend_.acquire();
+        if(socket_->reused) {
+            send();
+        } else {
+            connect();
+        }
+    }
+
+    private:
+    void connect() {
+        auto self = shared_from_this();
+        socket_->socket.async_connect(backend_.endpoint(), asio::bind_executor(strand_, [self](const asio::error_code& ec) {
+            if(ec) {
+                self->fail(ec);
+                return;
+            }
+            asio::error_code ignored;
+            self->socket_->socket.set_option(asio::ip::tcp::no_delay(true), ignored);
+            self->send();
+        }));
+    }
+
+    void send() {
+        auto self = shared_from_this();
+        asio::async_write(socket_->socket, asio::buffer(request_), asio::bind_executor(strand_, [self](const asio::error_code& ec, size_t) {
+            if(ec) {
+                self->retry_or_fail(ec);
+                return;
+            }
+            self->read_head();
+        }));
+    }
+
+    void read_head() {
+        auto self = shared_from_this();
+        asio::async_read_until(socket_->socket, asio::dynamic_buffer(socket_->buffer, MAX_HTTP_HEAD_SIZE + MAX_HTTP_BODY_SIZE), "\r\n\r\n",
+            asio::bind_executor(strand_, [self](const asio::error_code& ec, size_t head_size) {
+                if(ec) {
+                    self->retry_or_fail(ec);
+                    return;
+                }
+                self->read_body(head_size);
+            })
+        );
+    }
+
+    void read_body(uint64_t head_size) {
+        HttpHead head;
+        int status = 0;
+        if(!parse_http_head(std::string_view(socket_->buffer.data(), head_size - 4), head) ||
+           !(std::from_chars(head.start[1].data(), head.start[1].data() + head.start[1].size(), status).ec == std::errc()) ||
+           head.chunked) {
+            fail(asio::error::invalid_argument);
+            return;
+        }
+
+        response_.status = status;
+        response_.content_type = std::string(head.content_type);
+        response_.body_offset = head_size;
+        // without a length the body ends with the connection
+        until_eof_ = !head.content_length.has_value();
+        keep_alive_ = head.keep_alive && !until_eof_;
+
+        auto self = shared_from_this();
+        auto on_read = asio::bind_executor(strand_, [self](const asio::error_code& ec, size_t) {
+            if(ec && !(ec == asio::error::eof && self->until_eof_)) {
+                self->fail(ec);
+                return;
+            }
+            self->finish();
+        });
+
+        if(until_eof_) {
+            asio::async_read(socket_->socket, asio::dynamic_buffer(socket_->buffer, MAX_HTTP_HEAD_SIZE + MAX_HTTP_BODY_SIZE), on_read);
+            return;
+        }
+        if(*head.content_length > MAX_HTTP_BODY_SIZE) {
+            fail(asio::error::message_size);
+            return;
+        }
+        response_.body_size = *head.content_length;
+        uint64_t total = head_size + *head.content_length;
+        if(socket_->buffer.size() >= total) {
+            finish();
+            return;
+        }
+        asio::async_read(socket_->socket, asio::dynamic_buffer(socket_->buffer), asio::transfer_exactly(total - socket_->buffer.size()), on_read);
+    }
+
+    void finish() {
+        if(until_eof_) {
+            response_.body_size = socket_->buffer.size() - response_.body_offset;
+        }
+        // anything past the response means the connection is out of step
+        bool reusable = keep_alive_ && socket_->buffer.size() == response_.body_offset + response_.body_size;
+
+        response_.data = std::move(socket_->buffer);
+        socket_->buffer.clear();
+        if(reusable) {
+            backend_.release(std::move(socket_));
+        }
+        done_(std::move(response_));
+    }
+
+    // a pooled connection the backend already closed fails at once, that
+    // one gets another go on a new connection
+    void retry_or_fail(const asio::error_code& ec) {
+        if(socket_->reused && socket_->buffer.empty() && !retried_) {
+            retried_ = true;
+            socket_ = backend_.fresh();
+            connect();
+            return;
+        }
+        fail(ec);
+    }
+
+    void fail(const asio::error_code& ec) {
+        std::cerr << "Warning: Request to " << backend_.host() << " failed, " << ec.message() << std::endl;
+        done_(BackendResponse());
+    }
+
+    Backend& backend_;
+    std::string request_;
+    asio::strand<asio::io_context::executor_type> strand_;
+    Done done_;
+
+    std::unique_ptr<BackendSocket> socket_;
+    BackendResponse response_;
+    bool keep_alive_ = false;
+    bool until_eof_ = false;
+    bool retried_ = false;
+};
+
+// A client connection. Requests are handled one after another, a pipelined
+// one waits in the buffer until the response before it is written.
+class Router::Connection : public std::enable_shared_from_this<Connection> {
+    public:
+    Connection(asio::ip::tcp::socket socket, asio::strand<asio::io_context::executor_type> strand, Router& router)
+        : socket_(std::move(socket)), strand_(strand), router_(router) {}
+
+    void start() {
+        asio::error_code ec;
+        socket_.set_option(asio::ip::tcp::no_delay(true), ec);
+        read();
+    }
+
+    private:
+    void read() {
+        uint64_t old_size = in_.size();
+        in_.resize(old_size + READ_CHUNK);
+
+        auto self = shared_from_this();
+        socket_.async_read_some(asio::buffer(in_.data() + old_size, READ_CHUNK), [self, old_size](const asio::error_code& ec, size_t n) {
+            self->in_.resize(old_size + n);
+            if(ec) {
+                self->close();
+                return;
+            }
+            self->process_input();
+        });
+    }
+
+    void process_input() {
+        size_t head_end = in_.find("\r\n\r\n");
+        if(head_end == std::string::npos) {
+            if(in_.size() > MAX_HTTP_HEAD_SIZE) {
+                respond_error(431, "Request head too large.", false);
+                return;
+            }
+            read();
+            return;
+        }
+
+        HttpHead head;
+        if(!parse_http_head(std::string_view(in_.data(), head_end), head)) {
+            respond_error(400, "Malformed request.", false);
+            return;
+        }
+        if(head.chunked) {
+            respond_error(411, "Chunked bodies are not supported.", false);
+            return;
+        }
+        uint64_t body_size = head.content_length.value_or(0);
+        if(body_size > MAX_HTTP_BODY_SIZE) {
+            respond_error(413, "Request body too large.", false);
+            return;
+        }
+        uint64_t request_size = head_end + 4 + body_size;
+        if(in_.size() < request_size) {
+            read();
+            return;
+        }
+
+        consumed_ = request_size;
+        keep_alive_ = head.keep_alive;
+        route(head, std::string_view(in_.data() + head_end + 4, body_size));
+    }
+
+    void route(const HttpHead& head, std::string_view body) {
+        std::string_view method = head.start[0];
+        std::string_view path = head.start[1].substr(0, head.start[1].find('?'));
+
+        if(method == "GET" && path == "/ping") {
+            respond(200, "application/json", "{\"message\": \"Pinged!\"}");
+            return;
+        }
+
+        if(method == "PUT" && path == "/insert") {
+            std::optional<std::string> key = json_string_member(body, "key");
+            if(!key) {
+                respond_error(400, "Missing key.", keep_alive_);
+                return;
+            }
+            Backend& backend = router_.backend_for(*key);
+            std::string request;
+            request.reserve(160 + body.size());
+            request.append("PUT /api/insert HTTP/1.1\r\nHost: ").append(backend.host());
+            request.append("\r\nContent-Type: application/json\r\nContent-Length: ").append(std::to_string(body.size()));
+            request.append("\r\n\r\n").append(body);
+            forward(backend, std::move(request));
+            return;
+        }
+
+        if(method == "GET" && path.substr(0, 5) == "/get/") {
+            std::string_view segment = path.substr(5);
+            std::optional<std::string> key = percent_decode(segment);
+            if(segment.empty() || segment.find('/') != std::string_view::npos || !key) {
+                respond_error(404, "Invalid path.", keep_alive_);
+                return;
+            }
+            Backend& backend = router_.backend_for(*key);
+            std::string request;
+            request.reserve(96 + segment.size());
+            request.append("GET /api/get/").append(segment).append("?raw=1 HTTP/1.1\r\nHost: ").append(backend.host()).append("\r\n\r\n");
+            forward(backend, std::move(request));
+            return;
+        }
+
+        respond_error(404, "Invalid path.", keep_alive_);
+    }
+
+    void forward(Backend& backend, std::string request) {
+        auto self = shared_from_this();
+        std::make_shared<Exchange>(backend, std::move(request), strand_, [self](BackendResponse response) {
+            self->out_body_ = std::move(response.data);
+            self->write(response.status, response.content_type, response.body_offset, response.body_size);
+        })->start();
+    }
+
+    void respond_error(int status, std::string_view message, bool keep_alive) {
+        keep_alive_ = keep_alive;
+        respond(status, "application/json", "{\"error\": \"" + std::string(message) + "\"}");
+    }
+
+    void respond(int status, std::string_view content_type, std::string body) {
+        out_body_ = std::move(body);
+        write(status, content_type, 0, out_body_.size());
+    }
+
+    // head, then out_body_[body_offset, +body_size) in one gathered write
+    void write(int status, std::string_view content_type, uint64_t body_offset, uint64_t body_size) {
+        out_head_.clear();
+        out_head_.append("HTTP/1.1 ").append(std::to_string(status)).append(" ").append(http_reason(status));
+        if(!content_type.empty()) {
+            out_head_.append("\r\nContent-Type: ").append(content_type);
+        }
+        out_head_.append("\r\nContent-Length: ").append(std::to_string(body_size));
+        out_head_.append(keep_alive_ ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+
+        std::array<asio::const_buffer, 2> buffers = {
+            asio::buffer(out_head_),
+            asio::buffer(out_body_.data() + body_offset, body_size)
+        };
+        auto self = shared_from_this();
+        asio::async_write(socket_, buffers, [self](const asio::error_code& ec, size_t) {
+            self->write_done(ec);
+        });
+    }
+
+    void write_done(const asio::error_code& ec) {
+        out_body_.clear();
+        if(ec || !keep_alive_) {
+            close();
+            return;
+        }
+        in_.erase(0, consumed_);
+        consumed_ = 0;
+        process_input();
+    }
+
+    void close() {
+        asio::error_code ec;
+        socket_.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+        socket_.close(ec);
+    }
+
+    asio::ip::tcp::socket socket_;
+    asio::strand<asio::io_context::executor_type> strand_;
+    Router& router_;
+
+    std::string in_;
+    uint64_t consumed_ = 0;
+    bool keep_alive_ = true;
+
+    std::string out_head_;
+    std::string out_body_;
+};
+
+Router::Router(uint16_t port, const std::vector<std::string>& nodes, unsigned threads)
+    : port_(port), thread_count_(threads), acceptor_(io_) {
+    if(thread_count_ == 0) {
+        thread_count_ = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    asio::ip::tcp::resolver resolver(io_);
+    for(const std::string& node : nodes) {
+        // http://<host>:<port>
+        std::string_view address(node);
+        if(address.substr(0, 7) == "http://") {
+            address.remove_prefix(7);
+        }
+        size_t colon = address.rfind(':');
+        if(colon == std::string_view::npos) {
+            throw std::invalid_argument("Backend " + node + " has no port.");
+        }
+        std::string host(address.substr(0, colon));
+        std::string service(address.substr(colon + 1));
+        asio::ip::tcp::endpoint endpoint = *resolver.resolve(host, service).begin();
+
+        ring_.add_node(node);
+        backends_[node] = std::make_unique<Backend>(io_, std::string(address), endpoint);
+    }
+}
+
+Router::~Router() {
+    stop();
+}
+
+Router::Backend& Router::backend_for(const std::string& key) {
+    return *backends_.at(ring_.get_index(key));
+}
+
+void Router::start() {
+    asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), port_);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    accept();
+
+    for(unsigned i = 0; i < thread_count_; i++) {
+        threads_.emplace_back([this]() {
+            io_.run();
+        });
+    }
+}
+
+void Router::stop() {
+    io_.stop();
+    for(std::thread& thread : threads_) {
+        thread.join();
+    }
+    threads_.clear();
+
+    asio::error_code ec;
+    acceptor_.close(ec);
+}
+
+void Router::accept() {
+    // each connection gets a strand of its own, its exchanges run on it too
+    auto strand = asio::make_strand(io_);
+    acceptor_.async_accept(strand, [this, strand](const asio::error_code& ec, asio::ip::tcp::socket socket) {
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+        if(!ec) {
+            std::make_shared<Connection>(std::move(socket), strand, *this)->start();
+        }
+        accept();
+    });
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <asio.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../hashring/HashRing.hpp"
+
+// virtual nodes per backend, what proxy.py used
+const unsigned ROUTER_VIRTUAL_NODES = 100;
+
+// The cluster front door, in place of proxy.py and with the same routes:
+// PUT /insert and GET /get/<key> go to the api instance the hash ring picks
+// for the key, GET /ping is answered here. Backend connections are kept
+// alive and pooled, everything is async on one io_context over a few
+// threads (like BinaryServer).
+class Router {
+    public:
+    // nodes as proxy.py named them, "http://<host>:<port>", so keys land on
+    // the same instances. threads = 0 for one per core
+    Router(uint16_t port, const std::vector<std::string>& nodes, unsigned threads = 0);
+    ~Router();
+
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    // binds and returns, requests are served in the background
+    void start();
+    void stop();
+
+    private:
+    class Connection;
+    class Backend;
+    class Exchange;
+
+    void accept();
+    Backend& backend_for(const std::string& key);
+
+    uint16_t port_;
+    unsigned thread_count_;
+
+    asio::io_context io_;
+    asio::ip::tcp::acceptor acceptor_;
+    std::vector<std::thread> threads_;
+
+    HashRing ring_{ROUTER_VIRTUAL_NODES};
+    std::unordered_map<std::string, std::unique_ptr<Backend>> backends_;
+};
@@ -0,0 +1,40 @@
+#include <asio.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Router.hpp"
+
+int main(int argc, char* argv[]) {
+    // router [--port <port>] <api ports...>, like proxy.py it listens on 8080
+    int port = 8080;
+    int first = 1;
+    if(argc >= 3 && std::string(argv[1]) == "--port") {
+        port = std::stoi(argv[2]);
+        first = 3;
+    }
+    if(argc <= first) {
+        std::cerr << "Need ports of cache instances" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> nodes;
+    for(int i = first; i < argc; i++) {
+        nodes.push_back("http://127.0.0.1:" + std::string(argv[i]));
+    }
+
+    Router router(static_cast<uint16_t>(port), nodes);
+    router.start();
+    for(const std::string& node : nodes) {
+        std::cout << "Linked to " << node << std::endl;
+    }
+
+    // until ctrl-c or a kill
+    asio::io_context signals_io;
+    asio::signal_set signals(signals_io, SIGINT, SIGTERM);
+    signals.async_wait([](const asio::error_code&, int) {});
+    signals_io.run();
+
+    router.stop();
+}
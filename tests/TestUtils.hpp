@@ -1,6 +1,8 @@
 #include <algorithm>
+#include <iostream>
 #include <random> 
 #include <string>
+#include <vector>
 
 const std::string letters = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
@@ -46,4 +48,24 @@ size_t get_random_index(size_t length) {
     static std::mt19937 gen(dev());
     std::uniform_int_distribution<size_t> dist(0, length);
     return dist(gen);
-}
\ No newline at end of file
+}
+
+// checks that count failures and carry on, main returns finish(...)
+int failures = 0;
+
+void expect(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "Failed: " << what << "\n";
+        failures++;
+    }
+}
+
+// main's exit code, passed is printed when no check failed
+int finish(const std::string& passed) {
+    if(failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << passed << std::endl;
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Drives handle_binary_request with hand built frames, the way a client
+// over the binary listener would, and checks what comes back
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../api/BinaryProtocol.hpp"
+#include "../database/Rocask.hpp"
+#include "../replication/ReplicationFollower.hpp"
+#include "TestUtils.hpp"
+
+const int db_id = 9001;
+const int read_only_id = 9002;
+
+template<typename T>
+void put_integer(std::string& frame, T value) {
+    frame.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void put_string(std::string& frame, const std::string& value) {
+    put_integer<uint32_t>(frame, static_cast<uint32_t>(value.size()));
+    frame.append(value);
+}
+
+std::string request(uint32_t request_id, BinaryOp op) {
+    std::string frame;
+    put_integer<uint32_t>(frame, request_id);
+    frame.push_back(static_cast<char>(op));
+    return frame;
+}
+
+struct Response {
+    uint32_t request_id;
+    BinaryStatus status;
+    std::string payload;
+};
+
+Response run(Rocask& db, const std::string& frame, const ReplicationFollower *follower = nullptr) {
+    std::string raw = handle_binary_request(db, frame, follower);
+
+    Response response;
+    uint32_t length;
+    std::memcpy(&length, raw.data(), sizeof(length));
+    if(length != raw.size() - sizeof(length)) {
+        std::cerr << "Bad response length " << length << "\n";
+        failures++;
+    }
+    std::memcpy(&response.request_id, raw.data() + 4, sizeof(uint32_t));
+    response.status = static_cast<BinaryStatus>(raw[8]);
+    response.payload = raw.substr(9);
+    return response;
+}
+
+int main() {
+    fs::remove_all("datafiles/" + std::to_string(db_id));
+    fs::remove_all("hintfiles/" + std::to_string(db_id));
+
+    RocaskOptions options;
+    options.compression = Codec::Lz4;
+    Rocask db(db_id, options);
+
+    std::string small = gen_random_string(10);
+    std::string large(5000, 'x');
+
+    std::string put = request(1, BinaryOp::Put);
+    put_string(put, "small");
+    put_integer<uint64_t>(put, 0);
+    put.append(small);
+    Response response = run(db, put);
+    expect(response.request_id == 1 && response.status == BinaryStatus::Ok, "put");
+
+    std::string batch = request(2, BinaryOp::Batch);
+    put_integer<uint32_t>(batch, 2);
+    put_string(batch, "large");
+    put_string(batch, large);
+    put_string(batch, "gone");
+    put_string(batch, "soon");
+    response = run(db, batch);
+    expect(response.request_id == 2 && response.status == BinaryStatus::Ok, "batch");
+
+    std::string get = request(3, BinaryOp::Get);
+    put_string(get, "large");
+    response = run(db, get);
+    expect(response.request_id == 3 && response.payload == large, "get of a compressed value");
+
+    std::string remove = request(4, BinaryOp::Delete);
+    put_string(remove, "gone");
+    expect(run(db, remove).status == BinaryStatus::Ok, "delete");
+    expect(run(db, remove).status == BinaryStatus::NotFound, "second delete");
+
+    std::string mget = request(5, BinaryOp::MultiGet);
+    put_integer<uint32_t>(mget, 3);
+    put_string(mget, "small");
+    put_string(mget, "gone");
+    put_string(mget, "large");
+    response = run(db, mget);
+    std::string expected;
+    put_integer<uint32_t>(expected, 3);
+    expected.push_back(1);
+    put_string(expected, small);
+    expected.push_back(0);
+    expected.push_back(1);
+    put_string(expected, large);
+    expect(response.status == BinaryStatus::Ok && response.payload == expected, "mget");
+
+    std::string missing = request(6, BinaryOp::Get);
+    put_string(missing, "gone");
+    expect(run(db, missing).status == BinaryStatus::NotFound, "get of a deleted key");
+
+    // key length past the end of the frame
+    std::string truncated = request(7, BinaryOp::Get);
+    put_integer<uint32_t>(truncated, 100);
+    truncated.append("abc");
+    response = run(db, truncated);
+    expect(response.request_id == 7 && response.status == BinaryStatus::BadRequest, "truncated request");
+
+    // ttls the keydir's 32 bit expiry can't hold, one that would wrap around
+    // to a tombstone among them, leave the old value alone
+    for(uint64_t ttl : {uint64_t(1) << 40, UINT64_MAX - get_seconds() + 2}) {
+        std::string far = request(10, BinaryOp::Put);
+        put_string(far, "small");
+        put_integer<uint64_t>(far, ttl);
+        far.append("far");
+        expect(run(db, far).status == BinaryStatus::BadRequest, "put with a ttl of " + std::to_string(ttl));
+    }
+    std::string get_small = request(11, BinaryOp::Get);
+    put_string(get_small, "small");
+    expect(run(db, get_small).payload == small, "value kept after bad ttls");
+
+    expect(run(db, request(8, static_cast<BinaryOp>(42))).status == BinaryStatus::BadRequest, "unknown op");
+    expect(run(db, request(9, BinaryOp::Ping)).status == BinaryStatus::Ok, "ping");
+
+    // a follower that never caught up with its leader doesn't serve reads
+    {
+        ReplicationFollower follower(db, "127.0.0.1", 1, 1000);
+        expect(run(db, get_small, &follower).status == BinaryStatus::Stale, "get on a stale follower");
+        expect(run(db, mget, &follower).status == BinaryStatus::Stale, "mget on a stale follower");
+        expect(run(db, request(12, BinaryOp::Ping), &follower).status == BinaryStatus::Ok, "ping on a stale follower");
+    }
+
+    // and takes no writes
+    {
+        fs::remove_all("datafiles/" + std::to_string(read_only_id));
+        fs::remove_all("hintfiles/" + std::to_string(read_only_id));
+        RocaskOptions read_only_options;
+        read_only_options.read_only = true;
+        Rocask read_only(read_only_id, read_only_options);
+        expect(run(read_only, put).status == BinaryStatus::ReadOnly, "put on a read only follower");
+    }
+
+    return finish("Binary protocol ok");
+}
@@ -0,0 +1,88 @@
+// Throughput of the CRC kernels over value sized buffers
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../database/crc.hpp"
+#include "TestUtils.hpp"
+
+// the original table loop, one byte per step
+uint32_t crc32_bytewise(const void* data, size_t length) {
+    static std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for(int j = 0; j < 8; j++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for(size_t i = 0; i < length; i++) {
+        crc = (crc >> 8) ^ table[(crc ^ bytes[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+struct Kernel {
+    const char* name;
+    uint32_t (*fn)(const void*, size_t);
+};
+
+int main() {
+    std::vector<Kernel> kernels = {
+        {"crc32 bytewise", crc32_bytewise},
+        {"crc32 slicing-by-8", crc32_slicing8},
+        {"crc32c slicing-by-8", crc32c_slicing8},
+    };
+    if(crc32c_hardware_available()) {
+        kernels.push_back({"crc32c sse4.2", crc32c_hardware});
+    } else {
+        std::printf("no SSE4.2, skipping the hardware kernel\n");
+    }
+
+    const std::vector<size_t> sizes = {100, 1024, 4096, 64 * 1024, 1024 * 1024};
+    const size_t bytes_per_run = 256 * 1024 * 1024;
+
+    std::string data = gen_random_string(sizes.back());
+
+    // kernels of the same polynomial have to agree before their speed matters
+    for(size_t size : sizes) {
+        if(crc32_bytewise(data.data(), size) != crc32_slicing8(data.data(), size) ||
+           (crc32c_hardware_available() && crc32c_hardware(data.data(), size) != crc32c_slicing8(data.data(), size))) {
+            std::fprintf(stderr, "kernels disagree at %zu bytes\n", size);
+            return 1;
+        }
+    }
+
+    std::printf("%-22s", "kernel");
+    for(size_t size : sizes) {
+        std::printf("%12zuB", size);
+    }
+    std::printf("   (GB/s)\n");
+
+    for(const Kernel& kernel : kernels) {
+        std::printf("%-22s", kernel.name);
+        for(size_t size : sizes) {
+            size_t iterations = bytes_per_run / size;
+            volatile uint32_t sink = 0;
+
+            auto start = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < iterations; i++) {
+                sink = sink ^ kernel.fn(data.data(), size);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::printf("%13.2f", (double)(iterations * size) / elapsed.count() / 1e9);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Checks the disk-resident keydir: the table on its own against an
+// unordered_map, then a database on it through writes, deletes,
+// compaction and a restart
+
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../database/Rocask.hpp"
+#include "TestUtils.hpp"
+
+const int db_id = 9401;
+const int many_files_id = 9402;
+
+void check(Rocask& db, const std::map<std::string, std::string>& real_map, const std::vector<std::string>& deleted) {
+    for(const auto& [key, value] : real_map) {
+        try {
+            expect(db.read<std::string, std::string>(key) == value, "value of " + key);
+        } catch(const std::out_of_range&) {
+            expect(false, "has " + key);
+        }
+    }
+    for(const std::string& key : deleted) {
+        bool found = true;
+        try {
+            db.read<std::string, std::string>(key);
+        } catch(const std::out_of_range&) {
+            found = false;
+        }
+        expect(!found, "deleted " + key);
+    }
+    expect(db.stats().num_keys == real_map.size(), "key count");
+}
+
+int main() {
+    fs::remove_all("datafiles/" + std::to_string(db_id));
+    fs::remove_all("hintfiles/" + std::to_string(db_id));
+
+    // enough keys for overflow pages and several rounds of growing, some too
+    // long for a page
+    {
+        fs::create_directories("keydir");
+        DiskKeyDirTable table("keydir/table_test");
+        std::unordered_map<std::string, KeyDirEntry> real_map;
+        std::hash<std::string> hasher;
+        std::mt19937_64 rng(3);
+        for(int i = 0; i < 300000; i++) {
+            std::string key = "key:" + std::to_string(rng() % 50000);
+            if(i % 5000 == 0) {
+                key = std::string(5000, 'k') + std::to_string(i % 7);
+            }
+            KeyDirEntry entry{rng() % 1000, rng() % 100000, rng() % (1u << 27), rng(), 0, Codec::None};
+
+            switch(rng() % 4) {
+                case 0: {
+                    bool removed = table.remove(key, hasher(key));
+                    expect(removed == (real_map.erase(key) > 0), "remove");
+                    break;
+                }
+                case 1: {
+                    std::optional<KeyDirEntry> found = table.find(key, hasher(key));
+                    auto it = real_map.find(key);
+                    expect(found.has_value() == (it != real_map.end()), "find");
+                    if(found.has_value() && it != real_map.end()) {
+                        expect(*found == it->second, "found entry");
+                        bool updated = table.update(key, *found, hasher(key), [](KeyDirEntry& current) {
+                            current.file_id++;
+                        });
+                        expect(updated, "update in place");
+                        it->second.file_id++;
+                    }
+                    break;
+                }
+                default: {
+                    std::optional<KeyDirEntry> previous = table.put(key, entry, hasher(key));
+                    auto it = real_map.find(key);
+                    expect(previous.has_value() == (it != real_map.end()), "put returns what it replaced");
+                    real_map[key] = entry;
+                }
+            }
+        }
+
+        size_t walked = 0;
+        table.for_each([&](const std::string& key, const KeyDirEntry& entry) {
+            auto it = real_map.find(key);
+            expect(it != real_map.end() && it->second == entry, "walked entry " + key.substr(0, 20));
+            walked++;
+        });
+        expect(walked == real_map.size() && table.size() == real_map.size(), "table size");
+        expect(table.disk_usage() > DiskKeyDirTable::PAGE_SIZE * 64, "grew past its first buckets");
+    }
+
+    RocaskOptions options;
+    options.disk_keydir = true;
+    options.compression = Codec::Lz4;
+
+    std::map<std::string, std::string> real_map;
+    std::vector<std::string> deleted;
+    {
+        Rocask db(db_id, options);
+        std::vector<std::string> keys;
+        for(int i = 0; i < 20000; i++) {
+            std::string key = gen_random_string(16);
+            std::string value = gen_random_string(200);
+            db.write<std::string, std::string>(key, value);
+            real_map[key] = value;
+            keys.push_back(key);
+        }
+        for(size_t i = 0; i < keys.size(); i += 4) {
+            deleted.push_back(keys[i]);
+            real_map.erase(keys[i]);
+            db.remove<std::string>(keys[i]);
+        }
+        // overwrites leave most of the old files dead, compaction moves the
+        // live entries in place
+        for(int round = 0; round < 3; round++) {
+            for(size_t i = 1; i < keys.size(); i += 2) {
+                std::string value = gen_random_string(300);
+                db.write<std::string, std::string>(keys[i], value);
+                real_map[keys[i]] = value;
+            }
+        }
+        db.compaction();
+        check(db, real_map, deleted);
+
+        RocaskStats stats = db.stats();
+        expect(stats.keydir_disk_bytes > 0, "keydir is on disk");
+        expect(stats.keydir_memory < stats.keydir_disk_bytes, "keydir isn't in memory");
+    }
+
+    // rebuilt on open
+    {
+        Rocask db(db_id, options);
+        check(db, real_map, deleted);
+    }
+
+    // recovery merges a few files at a time rather than holding every file's
+    // entries at once
+    {
+        fs::remove_all("datafiles/" + std::to_string(many_files_id));
+        fs::remove_all("hintfiles/" + std::to_string(many_files_id));
+        uint64_t workers = std::max(1u, std::thread::hardware_concurrency());
+        uint64_t sessions = 2 * workers + 2;
+        uint64_t per_session = 200;
+        // every open starts a new datafile
+        for(uint64_t session = 0; session < sessions; session++) {
+            Rocask db(many_files_id, options);
+            for(uint64_t i = 0; i < per_session; i++) {
+                db.write<std::string, std::string>(std::to_string(session) + ":" + std::to_string(i), "v");
+            }
+        }
+
+        Rocask db(many_files_id, options);
+        RocaskStats stats = db.stats();
+        expect(stats.num_keys == sessions * per_session, "keys of every file");
+        expect(stats.recovery_peak_keys <= workers * per_session, "recovery holds one group of files at a time");
+    }
+
+    return finish("Disk keydir checks passed");
+}
@@ -0,0 +1,49 @@
+// The C++ HashRing has to place keys exactly where hashring/HashRing.py
+// does. The expected values below come from mmh3 and the Python ring
+
+#include <iostream>
+#include <string>
+
+#include "../hashring/HashRing.hpp"
+#include "../router/Http.hpp"
+#include "TestUtils.hpp"
+
+int main() {
+    // mmh3.hash(s, signed=False), every tail length
+    expect(murmur3_32("") == 0u, "murmur3 of nothing");
+    expect(murmur3_32("a") == 1009084850u, "murmur3 a");
+    expect(murmur3_32("ab") == 2613040991u, "murmur3 ab");
+    expect(murmur3_32("abc") == 3017643002u, "murmur3 abc");
+    expect(murmur3_32("abcd") == 1139631978u, "murmur3 abcd");
+    expect(murmur3_32("hello") == 613153351u, "murmur3 hello");
+    expect(murmur3_32("h\xc3\xa9llo\xe2\x9c\x93") == 3067776380u, "murmur3 utf-8");
+
+    HashRing ring(100);
+    ring.add_node("http://127.0.0.1:5000");
+    ring.add_node("http://127.0.0.1:5001");
+    ring.add_node("http://127.0.0.1:5002");
+    expect(ring.get_index("user:1") == "http://127.0.0.1:5001", "user:1");
+    expect(ring.get_index("user:2") == "http://127.0.0.1:5002", "user:2");
+    expect(ring.get_index("alpha") == "http://127.0.0.1:5002", "alpha");
+    expect(ring.get_index("beta") == "http://127.0.0.1:5000", "beta");
+    expect(ring.get_index("h\xc3\xa9llo\xe2\x9c\x93") == "http://127.0.0.1:5000", "utf-8 key");
+    expect(ring.get_index("k42") == "http://127.0.0.1:5001", "k42");
+
+    uint64_t covered = 0;
+    for(const auto& [node, distance] : ring.coverage()) {
+        covered += distance;
+    }
+    expect(covered == (uint64_t(1) << 32), "coverage adds up to the hash space");
+
+    ring.del_node("http://127.0.0.1:5001");
+    expect(ring.get_index("user:1") != "http://127.0.0.1:5001", "deleted node gets no keys");
+    expect(ring.get_index("beta") == "http://127.0.0.1:5000", "other keys stay put");
+
+    // the router hashes the key out of the insert body
+    expect(json_string_member("{\"value\": {\"key\": \"no\"}, \"key\": \"h\\u00e9llo\\u2713\"}", "key") ==
+           std::string("h\xc3\xa9llo\xe2\x9c\x93"), "key after a nested key");
+    expect(!json_string_member("{\"key\": 5}", "key"), "key that isn't a string");
+    expect(percent_decode("a%20b%2Fc") == std::string("a b/c"), "percent decoding");
+
+    return finish("Hash ring ok");
+}
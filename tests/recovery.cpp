@@ -0,0 +1,163 @@
+// Writes, closes the database and checks a fresh instance sees the same data
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../database/Rocask.hpp"
+#include "TestUtils.hpp"
+
+const int db_id = 9000;
+const size_t num_records = 2000;
+const size_t key_size = 50;
+const size_t value_size = 5000;
+
+// half the values compress well, the rest are stored raw
+std::string gen_value() {
+    std::string value = gen_random_string(value_size);
+    if(get_random_index(1) == 0) {
+        for(size_t i = 64; i < value.size(); i++) {
+            value[i] = value[i % 64];
+        }
+    }
+    return value;
+}
+
+int check(Rocask& db, const std::map<std::string, std::string>& real_map, const std::set<std::string>& deleted) {
+    for(const std::string& key : deleted) {
+        try {
+            db.read<std::string, std::string>(key);
+            std::cerr << "Deleted key came back: " << key << "\n";
+            return 1;
+        } catch(const std::out_of_range&) {
+        }
+    }
+
+    for(const auto& [key, actual_value] : real_map) {
+        std::string db_value = db.read<std::string, std::string>(key);
+        if(db_value != actual_value) {
+            std::cerr << "Key: " << key << "\n";
+            std::cerr << "DB Value: " << db_value.substr(0, 5) << "\n";
+            std::cerr << "Actual Value: " << actual_value.substr(0, 5) << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main() {
+    fs::remove_all("datafiles/" + std::to_string(db_id));
+    fs::remove_all("hintfiles/" + std::to_string(db_id));
+
+    std::vector<std::string> keys;
+    std::map<std::string, std::string> real_map;
+    std::set<std::string> deleted;
+
+    RocaskOptions options;
+    options.compression = Codec::Lz4;
+
+    {
+        Rocask db(db_id, options);
+        for(size_t i = 0; i < num_records; i++) {
+            std::string key = gen_random_string(key_size);
+            std::string value = gen_value();
+            db.write<std::string, std::string>(key, value);
+            keys.push_back(key);
+            real_map[key] = value;
+
+            // overwrite an old key, enough garbage to get compaction going
+            std::string old_key = keys[get_random_index(keys.size() - 1)];
+            std::string new_value = gen_value();
+            db.write<std::string, std::string>(old_key, new_value);
+            real_map[old_key] = new_value;
+        }
+    }
+
+    for(int restart = 0; restart < 2; restart++) {
+        Rocask db(db_id, options);
+        if(check(db, real_map, deleted)) {
+            std::cerr << "Mismatch after restart " << restart << "\n";
+            return 1;
+        }
+
+        // writes after a restart must win over the recovered ones
+        for(size_t i = 0; i < 100; i++) {
+            std::string key = keys[get_random_index(keys.size() - 1)];
+            std::string value = gen_value();
+            db.write<std::string, std::string>(key, value);
+            real_map[key] = value;
+            deleted.erase(key);
+        }
+
+        // and so must a batch, which lands in a single append
+        std::vector<std::pair<std::string, std::string>> batch;
+        for(size_t i = 0; i < 100; i++) {
+            std::string key = keys[get_random_index(keys.size() - 1)];
+            std::string value = gen_value();
+            batch.emplace_back(key, value);
+            real_map[key] = value;
+            deleted.erase(key);
+        }
+        db.write_batch(batch);
+
+        // tombstones have to shadow the recovered values too
+        for(size_t i = 0; i < 50; i++) {
+            std::string key = keys[get_random_index(keys.size() - 1)];
+            if(real_map.erase(key)) {
+                db.remove(key);
+                deleted.insert(key);
+            }
+        }
+    }
+
+    // writes whose timestamps run against the order they reach the log in
+    // (a racing writer, a clock stepping back), each open writes a new file
+    // so they end up in different ones: the log order still wins after a
+    // restart
+    uint64_t now = get_timestamp();
+    {
+        Rocask db(db_id, options);
+        db.apply_records({LogRecord{"inverted", "first", now - 1000, 0, Codec::None}});
+        db.apply_records({LogRecord{"inverted:deleted", "value", now - 1000, 0, Codec::None}});
+    }
+    {
+        Rocask db(db_id, options);
+        db.apply_records({LogRecord{"inverted", "second", now - 2000, 0, Codec::None}});
+        db.apply_records({LogRecord{"inverted:deleted", "", now - 2000, TOMBSTONE_EXPIRY, Codec::None}});
+        real_map["inverted"] = "second";
+        deleted.insert("inverted:deleted");
+    }
+
+    // a batch too large for the keydir to address is refused whole, before
+    // any of it is logged
+    std::set<std::string> refused;
+    {
+        Rocask db(db_id, options);
+        std::vector<std::pair<std::string, std::string>> batch;
+        for(size_t i = 0; i < 3; i++) {
+            std::string key = "oversized:" + std::to_string(i);
+            batch.emplace_back(key, std::string(100 * 1024 * 1024, 'o'));
+            refused.insert(key);
+        }
+        bool threw = false;
+        try {
+            db.write_batch(batch);
+        } catch(const std::invalid_argument&) {
+            threw = true;
+        }
+        if(!threw || check(db, real_map, refused)) {
+            std::cerr << "Oversized batch was not refused\n";
+            return 1;
+        }
+    }
+
+    Rocask db(db_id, options);
+    if(check(db, real_map, deleted) || check(db, real_map, refused)) {
+        return 1;
+    }
+
+    std::cout << "Recovered " << real_map.size() << " keys" << std::endl;
+    return 0;
+}
@@ -0,0 +1,182 @@
+// Checks scan and prefix_scan against a std::map, with the ordered index
+// and without it, across deletes, ttls and a restart
+
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../database/Rocask.hpp"
+#include "../datastructures/SkipList.hpp"
+#include "TestUtils.hpp"
+
+const int indexed_id = 9301;
+const int unindexed_id = 9302;
+
+// what scan should return, by walking the map
+std::vector<std::pair<std::string, std::string>> expected_range(
+    const std::map<std::string, std::string>& real_map,
+    const std::string& start,
+    const std::optional<std::string>& end,
+    size_t limit
+) {
+    std::vector<std::pair<std::string, std::string>> items;
+    for(auto it = real_map.lower_bound(start); it != real_map.end() && items.size() < limit; ++it) {
+        if(end.has_value() && !(it->first < *end)) {
+            break;
+        }
+        items.emplace_back(it->first, it->second);
+    }
+    return items;
+}
+
+// every page of prefix, cursor by cursor
+std::vector<std::pair<std::string, std::string>> all_pages(Rocask& db, const std::string& prefix, size_t limit) {
+    std::vector<std::pair<std::string, std::string>> items;
+    std::string from;
+    while(true) {
+        ScanPage page = db.prefix_scan(prefix, limit, from);
+        items.insert(items.end(), page.items.begin(), page.items.end());
+        if(!page.more) {
+            return items;
+        }
+        from = page.last_key + '\0';
+    }
+}
+
+void check(Rocask& db, const std::map<std::string, std::string>& real_map, const std::string& name) {
+    std::vector<std::pair<std::string, std::string>> everything(real_map.begin(), real_map.end());
+
+    ScanPage page = db.scan("", std::nullopt, real_map.size() + 1);
+    expect(page.items == everything && !page.more, name + ": whole keyspace in order");
+
+    page = db.scan("user:2", std::string("user:5"), 1000000);
+    expect(page.items == expected_range(real_map, "user:2", std::string("user:5"), 1000000), name + ": bounded range");
+
+    page = db.scan("user:3", std::nullopt, 7);
+    expect(page.items == expected_range(real_map, "user:3", std::nullopt, 7), name + ": limit");
+    expect(page.more && page.last_key == page.items.back().first, name + ": more after a full page");
+
+    for(const std::string prefix : {"user:1", "user:4:", "session:", "nothing:"}) {
+        std::optional<std::string> end = prefix;
+        end->back()++;
+        expect(
+            all_pages(db, prefix, 13) == expected_range(real_map, prefix, end, real_map.size()),
+            name + ": pages of prefix " + prefix
+        );
+    }
+}
+
+int main() {
+    for(int id : {indexed_id, unindexed_id}) {
+        fs::remove_all("datafiles/" + std::to_string(id));
+        fs::remove_all("hintfiles/" + std::to_string(id));
+    }
+
+    // the skip list on its own against std::set
+    {
+        SkipList<std::string> list;
+        std::set<std::string> real_set;
+        std::mt19937 rng(7);
+        for(int i = 0; i < 20000; i++) {
+            std::string key = std::to_string(rng() % 3000);
+            if(rng() % 3 == 0) {
+                expect(list.erase(key) == (real_set.erase(key) > 0), "skip list erase");
+            } else {
+                expect(list.insert(key) == real_set.insert(key).second, "skip list insert");
+            }
+        }
+        std::vector<std::string> keys = list.range("", std::nullopt, SIZE_MAX);
+        expect(keys == std::vector<std::string>(real_set.begin(), real_set.end()), "skip list in order");
+        expect(list.size() == real_set.size(), "skip list size");
+        expect(list.range("2", std::string("3"), 5).size() == 5, "skip list range limit");
+        list.assign_sorted(keys);
+        expect(list.range("", std::nullopt, SIZE_MAX) == keys, "skip list from sorted keys");
+    }
+
+    RocaskOptions indexed_options;
+    indexed_options.ordered_index = true;
+    RocaskOptions unindexed_options;
+
+    std::map<std::string, std::string> real_map;
+    {
+        Rocask indexed(indexed_id, indexed_options);
+        Rocask unindexed(unindexed_id, unindexed_options);
+
+        std::vector<std::string> keys;
+        for(int user = 0; user < 60; user++) {
+            for(int session = 0; session < 20; session++) {
+                keys.push_back("user:" + std::to_string(user) + ":" + gen_random_string(6));
+            }
+            keys.push_back("session:" + gen_random_string(10));
+        }
+        for(const std::string& key : keys) {
+            std::string value = gen_random_string(100);
+            indexed.write<std::string, std::string>(key, value);
+            unindexed.write<std::string, std::string>(key, value);
+            real_map[key] = value;
+        }
+        // overwrites don't add keys, deletes drop them
+        for(size_t i = 0; i < keys.size(); i += 3) {
+            std::string value = gen_random_string(50);
+            indexed.write<std::string, std::string>(keys[i], value);
+            unindexed.write<std::string, std::string>(keys[i], value);
+            real_map[keys[i]] = value;
+        }
+        for(size_t i = 1; i < keys.size(); i += 5) {
+            indexed.remove<std::string>(keys[i]);
+            unindexed.remove<std::string>(keys[i]);
+            real_map.erase(keys[i]);
+        }
+        std::vector<std::pair<std::string, std::string>> batch;
+        for(int i = 0; i < 40; i++) {
+            batch.emplace_back("user:4:" + gen_random_string(6), gen_random_string(30));
+            real_map[batch.back().first] = batch.back().second;
+        }
+        indexed.write_batch<std::string, std::string>(batch);
+        unindexed.write_batch<std::string, std::string>(batch);
+
+        check(indexed, real_map, "indexed");
+        check(unindexed, real_map, "unindexed");
+
+        // an expired key leaves the scan, and the index with it
+        indexed.write<std::string, std::string>("user:1:expiring", "soon", 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+        ScanPage page = indexed.prefix_scan("user:1:expiring", 10);
+        expect(page.items.empty(), "expired key isn't scanned");
+        uint64_t index_memory = indexed.stats().key_index_memory;
+        expect(index_memory > 0, "index memory is counted");
+
+        // scans while keys come and go stay in order
+        std::thread writer([&indexed]() {
+            for(int i = 0; i < 3000; i++) {
+                std::string key = "churn:" + std::to_string(i % 300);
+                if(i % 4 == 3) {
+                    indexed.remove<std::string>(key);
+                } else {
+                    indexed.write<std::string, std::string>(key, "x");
+                }
+            }
+        });
+        for(int i = 0; i < 200; i++) {
+            ScanPage churn = indexed.prefix_scan("churn:", 1000);
+            bool sorted = std::is_sorted(churn.items.begin(), churn.items.end());
+            expect(sorted, "scan during writes is in order");
+        }
+        writer.join();
+        for(int i = 0; i < 300; i++) {
+            indexed.remove<std::string>("churn:" + std::to_string(i));
+        }
+    }
+
+    // the index is rebuilt from the keydir on open
+    {
+        Rocask indexed(indexed_id, indexed_options);
+        check(indexed, real_map, "indexed after a restart");
+    }
+
+    return finish("Scan checks passed");
+}